@@ -0,0 +1,134 @@
+/*
+  mixer_test.c
+
+  Regression test of the replay. A small MOD is built in memory in the
+  31 sample and in the old 15 sample format and rendered through the
+  reference and the cached mixer. Both mixers have to give the same
+  output, and that output has to match the hash of the reference
+  mixer recorded when this test was added. The hash was recorded with
+  this renderer, not taken from the Mac or the simulation, so it only
+  catches changes of the output, not errors it always had.
+
+  $ ./mixer_test
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wc_replay.h"
+#include "../modfile.h"
+
+#define VBLS          1600    // the song of 768 VBLs is played twice
+#define PATTERNS      2
+#define ROWS          64
+
+/* output of the reference mixer when this test was added. Both files */
+/* use only samples 1 and 2 and have the same song and pattern data. */
+/* wc_load() converts the 15 sample file into the 31 sample layout, */
+/* with empty entries for samples 16 to 31, before the replay sees it. */
+/* The replay thus gets the same data and both have to give this hash */
+#define GOLDEN        0x15b631a348bcd3e4ull
+
+/* amiga periods of the notes played */
+static const uint16_t periods[] = { 428, 381, 339, 320, 285, 254, 226, 214 };
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+
+static void note(uint8_t *p, int sample, int period, int effect, int param) {
+  p[0] = (sample & 0xf0) | (period >> 8);
+  p[1] = period;
+  p[2] = ((sample & 15) << 4) | effect;
+  p[3] = param;
+}
+
+/* a square wave looping over its second half and a saw without loop */
+static long build_mod(uint8_t *mod, int format31) {
+  int samples = format31?31:15;
+  uint8_t *info = mod + MOD_SAMPLE_INFO;
+
+  memcpy(mod, "mixer test", 10);
+
+  put16(info + 22, 32);               // length in words
+  info[25] = 64;                      // volume
+  put16(info + 26, 16);               // repeat start
+  put16(info + 28, 16);               // repeat length
+
+  info += MOD_SAMPLE_INFO_LEN;
+  put16(info + 22, 256);
+  info[25] = 48;
+  put16(info + 28, 1);
+
+  uint8_t *song = mod + MOD_SAMPLE_INFO + samples*MOD_SAMPLE_INFO_LEN;
+  song[0] = PATTERNS;
+  song[1] = 127;
+  for(int i=0;i<PATTERNS;i++) song[2+i] = i;
+
+  uint8_t *pattern;
+  if(format31) {
+    memcpy(mod + MOD_TAG_OFFSET, "M.K.", 4);
+    pattern = mod + MOD_PATTERN_DATA_OFFSET;
+  } else
+    pattern = mod + MOD15_PATTERN_DATA_OFFSET;
+
+  for(int p=0;p<PATTERNS;p++)
+    for(int r=0;r<ROWS;r++) {
+      uint8_t *row = pattern + (p*ROWS + r)*16;
+      if(!(r & 3)) note(row, 1, periods[(r/4 + p) & 7], 0, 0);
+      if(!(r & 7)) note(row+4, 2, periods[(r/8 + 3*p) & 7], 0xc, 32 + r/2);
+      if((r & 7) == 4) note(row+8, 1, 2*periods[r/8 & 7], 0, 0);
+      if(r == 16) note(row+12, 2, 214, 0xc, 64);
+      if(!p && !r) note(row+12, 0, 0, 0xf, 5);          // speed
+    }
+
+  int8_t *data = (int8_t*)(pattern + PATTERNS*ROWS*16);
+  for(int i=0;i<64;i++)  data[i] = (i & 8)?100:-100;
+  for(int i=0;i<512;i++) data[64+i] = (int8_t)(i*4);
+
+  return (uint8_t*)(data + 64 + 512) - mod;
+}
+
+static uint64_t render(const uint8_t *mod, long size, int flags) {
+  struct wc_state s;
+  if(wc_load(&s, mod, size, flags)) {
+    printf("Preparation failed: %s\n", s.error);
+    exit(1);
+  }
+
+  uint8_t out[WC_LEN];
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for(int v=0;v<VBLS;v++) {
+    wc_vbl(&s, out);
+    for(int i=0;i<WC_LEN;i++) {
+      hash ^= out[i];
+      hash *= 0x100000001b3ull;
+    }
+  }
+
+  if(s.out_of_range) printf("Warning: %u accesses outside the replay tables\n", s.out_of_range);
+  wc_free(&s);
+  return hash;
+}
+
+static int check(const char *name, int format31, uint64_t golden) {
+  static uint8_t mod[MOD_PATTERN_DATA_OFFSET + PATTERNS*ROWS*16 + 1024];
+  memset(mod, 0, sizeof(mod));
+  long size = build_mod(mod, format31);
+
+  uint64_t ref = render(mod, size, 0);
+  uint64_t cached = render(mod, size, WC_CACHED);
+
+  printf("%s: reference %016llx, cached %016llx, golden %016llx\n", name,
+	 (unsigned long long)ref, (unsigned long long)cached, (unsigned long long)golden);
+
+  if(ref != golden) { printf("%s: reference mixer FAILED\n", name); return 1; }
+  if(cached != ref) { printf("%s: cached mixer FAILED\n", name); return 1; }
+  return 0;
+}
+
+int main(void) {
+  int failed = check("31 samples", 1, GOLDEN);
+  failed |= check("15 samples", 0, GOLDEN);
+  if(!failed) printf("ok\n");
+  return failed;
+}
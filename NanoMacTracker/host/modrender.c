@@ -0,0 +1,407 @@
+/*
+  modrender.c
+
+  Host side renderer for the NanoMacTracker replay. The MOD is prepared
+  and played exactly like on the Mac using the C version of the Wizzcat
+  routine in wc_replay.c and written as 22254 Hz PCM.
+
+  By default the output is passed through a model of the NanoMac audio
+  path (volume and low pass in dataController.sv) and scaled like the
+  audio capture of the simulation. The result can thus be compared
+  sample by sample against an audio.wav or audio.s16 of a simulation
+  run of NanoMacTracker:
+
+  $ ./modrender AXELF.MOD axelf.wav
+  $ ./modrender --compare=../../sim/audio.wav AXELF.MOD
+
+  --bench measures the throughput of the replay. Unless a mixer is
+  selected with --mixer both mixers of wc_mod.s are measured and have
+  to give identical results.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "wc_replay.h"
+
+#define VBL_RATE     60           // VBLs per second
+#define MAX_SECONDS  600          // songs usually loop forever
+#define COMPARE_WIN  4096         // samples used to find the alignment
+
+static int volume = 7;            // Mac sound volume 0..7, -1 = detect when comparing
+static int unfiltered = 0;
+static int embedded = 0;
+static int mixer = -1;            // WC_CACHED or 0, -1 = not given
+static int halfrate = 0;
+static double seconds = 0;        // 0 = until the song loops
+static int bench_runs = 0;
+static double bench_seconds = 60;
+static const char *compare_name = NULL;
+
+/* ----------------------------- audio path model -------------------------- */
+
+/* NanoMac audio path: the unsigned sample is made signed, scaled by the */
+/* volume setting and filtered with a 1/2 1 1/2 low pass. The simulation */
+/* writes the 12 bit result multiplied by 16 */
+struct audio_path {
+  int latch[2];
+};
+
+static int16_t audio_path_sample(struct audio_path *a, uint8_t sample, int vol) {
+  if(unfiltered) return (sample - 128) << 8;
+
+  int v = (int8_t)(sample - 128) * vol;
+  int out = (v >> 1) + a->latch[0] + (a->latch[1] >> 1);
+  a->latch[1] = a->latch[0];
+  a->latch[0] = v;
+  return (int16_t)(out << 4);
+}
+
+static void audio_path_convert(const uint8_t *in, int16_t *out, long n, int vol) {
+  struct audio_path a = { { 0, 0 } };
+  for(long i=0;i<n;i++) out[i] = audio_path_sample(&a, in[i], vol);
+}
+
+/* ---------------------------------- files -------------------------------- */
+
+static uint8_t *load_file(const char *name, long *size) {
+  FILE *fd = fopen(name, "rb");
+  if(!fd) { perror(name); return NULL; }
+
+  fseek(fd, 0, SEEK_END);
+  *size = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+
+  uint8_t *data = malloc(*size);
+  if(!data || fread(data, 1, *size, fd) != (size_t)*size) {
+    printf("%s: read failed\n", name);
+    free(data);
+    data = NULL;
+  }
+  fclose(fd);
+  return data;
+}
+
+static void put_le16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put_le32(uint8_t *p, uint32_t v) { put_le16(p, v); put_le16(p+2, v >> 16); }
+
+static int ends_with(const char *name, const char *ext) {
+  return strlen(name) > strlen(ext) && !strcmp(name + strlen(name) - strlen(ext), ext);
+}
+
+/* .u8 writes the raw Mac sound buffer contents, .s16 and .wav the */
+/* output of the audio path model */
+static int write_output(const char *name, const uint8_t *data, long n) {
+  FILE *fd = fopen(name, "wb");
+  if(!fd) { perror(name); return -1; }
+
+  if(ends_with(name, ".u8"))
+    fwrite(data, 1, n, fd);
+  else {
+    if(!ends_with(name, ".s16")) {
+      uint8_t hdr[44];
+      memcpy(hdr, "RIFF", 4);
+      put_le32(hdr+4, 36 + 2*n);
+      memcpy(hdr+8, "WAVEfmt ", 8);
+      put_le32(hdr+16, 16);
+      put_le16(hdr+20, 1);          // PCM
+      put_le16(hdr+22, 1);          // mono
+      put_le32(hdr+24, WC_RATE);
+      put_le32(hdr+28, 2*WC_RATE);
+      put_le16(hdr+32, 2);
+      put_le16(hdr+34, 16);
+      memcpy(hdr+36, "data", 4);
+      put_le32(hdr+40, 2*n);
+      fwrite(hdr, 1, sizeof(hdr), fd);
+    }
+
+    int16_t *pcm = malloc(n * sizeof(int16_t));
+    uint8_t *le = malloc(2*n);
+    audio_path_convert(data, pcm, n, volume < 0?7:volume);
+    for(long i=0;i<n;i++) put_le16(le+2*i, pcm[i]);
+    fwrite(le, 2, n, fd);
+    free(le);
+    free(pcm);
+  }
+
+  fclose(fd);
+  return 0;
+}
+
+/* load a wav or raw s16 file as written by the simulation */
+static int16_t *load_capture(const char *name, long *n) {
+  long size;
+  uint8_t *data = load_file(name, &size);
+  if(!data) return NULL;
+
+  long offset = 0;
+  if(size >= 12 && !memcmp(data, "RIFF", 4) && !memcmp(data+8, "WAVE", 4)) {
+    /* skip to data chunk */
+    offset = 12;
+    while(offset + 8 <= size && memcmp(data+offset, "data", 4))
+      offset += 8 + (data[offset+4] | (data[offset+5]<<8) | (data[offset+6]<<16) | (data[offset+7]<<24));
+    offset += 8;
+  }
+
+  *n = (size > offset)?(size - offset)/2:0;
+  int16_t *pcm = malloc((*n+1) * sizeof(int16_t));
+  for(long i=0;i<*n;i++)
+    pcm[i] = (int16_t)(data[offset+2*i] | (data[offset+2*i+1]<<8));
+
+  free(data);
+  return pcm;
+}
+
+/* -------------------------------- rendering ------------------------------ */
+
+static uint64_t hash64(const uint8_t *p, long len, uint64_t hash) {
+  while(len--) {
+    hash ^= *p++;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/* render up to max_vbls VBLs, stop earlier at the song loop if requested */
+static long render(struct wc_state *s, uint8_t *out, long max_vbls, int stop_at_loop) {
+  long vbls;
+  for(vbls=0;vbls<max_vbls;vbls++) {
+    if(stop_at_loop && s->looped) break;
+    wc_vbl(s, out + vbls*WC_LEN);
+  }
+  return vbls;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int bench(const uint8_t *file, long size, int flags, uint64_t *result) {
+  long vbls = (long)(bench_seconds * VBL_RATE);
+  uint8_t *out = malloc(vbls * WC_LEN);
+  double best = 0, sum = 0, prep = 0;
+  uint64_t hash = 0;
+
+  for(int run=0;run<bench_runs;run++) {
+    struct wc_state s;
+    double t0 = now();
+    if(wc_load(&s, file, size, flags)) {
+      printf("Preparation failed: %s\n", s.error);
+      return -1;
+    }
+    double t1 = now();
+    render(&s, out, vbls, 0);
+    double t2 = now();
+    wc_free(&s);
+
+    if(!run || t2 - t1 < best) best = t2 - t1;
+    sum += t2 - t1;
+    prep += t1 - t0;
+
+    /* all runs must give the same result */
+    uint64_t h = hash64(out, vbls*WC_LEN, 0xcbf29ce484222325ull);
+    if(run && h != hash) {
+      printf("Bench: run %d gave a different result!\n", run);
+      return -1;
+    }
+    hash = h;
+  }
+
+  printf("Bench: %s mixer%s, %ld VBLs (%.1fs) of audio, %d runs, result hash %016llx\n",
+	 (flags & WC_CACHED)?"cached":"reference", (flags & WC_HALFRATE)?" at half rate":"", vbls, bench_seconds, bench_runs, (unsigned long long)hash);
+  printf("Bench: prepare %.3f ms, render best %.3f ms / mean %.3f ms\n",
+	 1e3*prep/bench_runs, 1e3*best, 1e3*sum/bench_runs);
+  printf("Bench: %.1f ns per sample, %.2f us per VBL, %.0fx realtime\n",
+	 1e9*best/(vbls*WC_LEN), 1e6*best/vbls, bench_seconds/best);
+
+  free(out);
+  *result = hash;
+  return 0;
+}
+
+/* ------------------------------- comparison ------------------------------ */
+
+/* find the reference within the capture and compare sample by sample */
+static int compare(const uint8_t *ref_u8, long ref_n) {
+  long cap_n;
+  int16_t *cap = load_capture(compare_name, &cap_n);
+  if(!cap) return -1;
+
+  /* the capture starts with the Mac booting, so the anchor is the */
+  /* first non silent sample after the initial buffer */
+  long anchor;
+  for(anchor=WC_LEN;anchor<ref_n && ref_u8[anchor] == 0x80;anchor++);
+  long win = (ref_n - anchor < COMPARE_WIN)?ref_n - anchor:COMPARE_WIN;
+  if(win < 16) {
+    printf("Compare: reference is silent\n");
+    return -1;
+  }
+
+  int16_t *ref = malloc(ref_n * sizeof(int16_t));
+  long offset = -1;
+  int vol;
+  for(vol=(volume < 0)?1:volume;vol<=((volume < 0)?7:volume) && offset < 0;vol++) {
+    audio_path_convert(ref_u8, ref, ref_n, vol);
+    for(long o=0;o+win<=cap_n && offset < 0;o++)
+      if(!memcmp(cap+o, ref+anchor, win*sizeof(int16_t)))
+	offset = o - anchor;
+  }
+  vol--;
+
+  if(offset < 0) {
+    printf("Compare: reference not found in %s (%ld samples)\n", compare_name, cap_n);
+    free(ref);
+    free(cap);
+    return 1;
+  }
+
+  /* compare everything that overlaps */
+  long first = -1, last = -1, errors = 0, compared = 0;
+  for(long i=(offset < 0)?-offset:0;i<ref_n && i+offset<cap_n;i++) {
+    /* the sim may run with a different buffer content before the player starts */
+    if(i < anchor) continue;
+
+    compared++;
+    if(cap[i+offset] != ref[i]) {
+      if(first < 0) first = i;
+      last = i;
+      errors++;
+    }
+  }
+
+  printf("Compare: reference found at sample %ld of %s, volume %d\n", offset+anchor, compare_name, vol);
+  if(errors) {
+    printf("Compare: %ld of %ld samples differ\n", errors, compared);
+    printf("Compare: first difference in VBL %ld line %ld (%d != %d), last in VBL %ld line %ld\n",
+	   first/WC_LEN, first%WC_LEN, cap[first+offset], ref[first], last/WC_LEN, last%WC_LEN);
+  } else
+    printf("Compare: %ld samples (%.2fs) are bit exact\n", compared, (double)compared/WC_RATE);
+
+  free(ref);
+  free(cap);
+  return errors?1:0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void usage(const char *name) {
+  printf("Usage: %s [options] FILE.MOD [OUTPUT]\n", name);
+  printf("  OUTPUT                  .wav/.s16 through the NanoMac audio path, .u8 raw Mac buffer\n");
+  printf("  -t, --time=SECONDS      render length (default until the song loops)\n");
+  printf("  -v, --volume=N          Mac sound volume 0..7 (default 7)\n");
+  printf("  -u, --unfiltered        write plain samples without the audio path model\n");
+  printf("  -e, --embedded          memory layout of the mod built into wc_mod.s\n");
+  printf("  -m, --mixer=MIXER       reference (default, like wc_mod.s) or cached\n");
+  printf("  -r, --rate=RATE         full (default) or half, mixing rate of the cached mixer\n");
+  printf("  -c, --compare=CAPTURE   compare against a simulation audio capture\n");
+  printf("  -b, --bench[=RUNS]      measure the replay throughput (default 5 runs)\n");
+  printf("  -s, --bench-time=SECONDS audio length rendered per benchmark run (default 60)\n");
+  printf("  -h, --help              this help\n");
+}
+
+int main(int argc, char **argv) {
+  static const struct option long_options[] = {
+    { "time",       required_argument, NULL, 't' },
+    { "volume",     required_argument, NULL, 'v' },
+    { "unfiltered", no_argument,       NULL, 'u' },
+    { "embedded",   no_argument,       NULL, 'e' },
+    { "mixer",      required_argument, NULL, 'm' },
+    { "rate",       required_argument, NULL, 'r' },
+    { "compare",    required_argument, NULL, 'c' },
+    { "bench",      optional_argument, NULL, 'b' },
+    { "bench-time", required_argument, NULL, 's' },
+    { "help",       no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  int volume_given = 0;
+  int c;
+
+  while((c = getopt_long(argc, argv, "t:v:uem:r:c:b::s:h", long_options, NULL)) != -1) {
+    switch(c) {
+    case 't': seconds = atof(optarg); break;
+    case 'v': volume = atoi(optarg) & 7; volume_given = 1; break;
+    case 'u': unfiltered = 1; break;
+    case 'e': embedded = 1; break;
+    case 'm':
+      if(!strcmp(optarg, "cached"))         mixer = WC_CACHED;
+      else if(!strcmp(optarg, "reference")) mixer = 0;
+      else { printf("Unknown mixer %s\n", optarg); return -1; }
+      break;
+    case 'r':
+      if(!strcmp(optarg, "full"))      halfrate = 0;
+      else if(!strcmp(optarg, "half")) halfrate = 1;
+      else { printf("Unknown rate %s\n", optarg); return -1; }
+      break;
+    case 'c': compare_name = optarg; break;
+    case 'b': bench_runs = optarg?atoi(optarg):5; break;
+    case 's': bench_seconds = atof(optarg); break;
+    case 'h': usage(argv[0]); return 0;
+    default:  usage(argv[0]); return -1;
+    }
+  }
+
+  if(optind >= argc) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  long size;
+  uint8_t *file = load_file(argv[optind], &size);
+  if(!file) return -1;
+
+  int flags = embedded?WC_EMBEDDED:0;
+  if(halfrate) {
+    /* only the cached mixer implements the half rate */
+    if(!mixer) { printf("Half rate needs the cached mixer\n"); return -1; }
+    flags |= WC_HALFRATE;
+    mixer = WC_CACHED;
+  }
+
+  if(bench_runs > 0) {
+    uint64_t hash[2];
+    if(mixer >= 0)
+      return bench(file, size, flags | mixer, hash)?1:0;
+
+    /* compare both mixers */
+    if(bench(file, size, flags, hash) || bench(file, size, flags | WC_CACHED, hash+1))
+      return 1;
+    if(hash[0] != hash[1]) {
+      printf("Bench: the mixers give different results!\n");
+      return 1;
+    }
+    return 0;
+  }
+
+  /* the volume used in the simulation is usually not known */
+  if(compare_name && !volume_given) volume = -1;
+
+  struct wc_state s;
+  if(wc_load(&s, file, size, flags | ((mixer < 0)?0:mixer))) {
+    printf("Preparation failed: %s\n", s.error);
+    return 1;
+  }
+
+  long max_vbls = (long)((seconds > 0?seconds:MAX_SECONDS) * VBL_RATE);
+  uint8_t *out = malloc(max_vbls * WC_LEN);
+  long vbls = render(&s, out, max_vbls, seconds <= 0);
+  long n = vbls * WC_LEN;
+
+  printf("Rendered %ld VBLs (%.2fs)%s, hash %016llx\n", vbls, (double)n/WC_RATE,
+	 s.looped?", song looped":"", (unsigned long long)hash64(out, n, 0xcbf29ce484222325ull));
+  if(s.out_of_range)
+    printf("Warning: %u accesses outside the replay tables, result may not match the Mac\n", s.out_of_range);
+
+  int ret = 0;
+  if(optind+1 < argc && write_output(argv[optind+1], out, n)) ret = 1;
+  if(compare_name && compare(out, n)) ret = 1;
+
+  wc_free(&s);
+  free(out);
+  free(file);
+  return ret;
+}
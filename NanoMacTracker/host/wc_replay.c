@@ -0,0 +1,666 @@
+/*
+  wc_replay.c
+
+  Portable C version of the Mac variant of the Wizzcat replay routine
+  in wc_mod.s. This is meant as a reference for developing the replay
+  off-target and thus follows the asm code instruction by instruction
+  where the result may differ otherwise: word sized arithmetic, the
+  16.16 add/addx stepping, signed and unsigned compares and even the
+  known oddities of the original code are kept. The labels of the asm
+  code are given in the comments.
+
+  The only deliberate difference is that accesses the 68000 would do
+  outside of its tables (e.g. for periods beyond the increment table)
+  read zero here and are counted in out_of_range.
+
+  Both mixers of wc_mod.s are available: the original one looking up
+  step and volume table for every chunk of 74 samples and the one
+  selected by CACHED_MIX which uses values cached by the music routine
+  and a volume table with the unsigned offset built in. Both must give
+  identical results.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../modfile.h"
+#include "wc_replay.h"
+
+/* offsets into the voiceN structures */
+#define V_NOTE     0x00   // pattern entry, 4 bytes
+#define V_CMD      0x02
+#define V_PARAM    0x03
+#define V_START    0x04   // long
+#define V_LEN      0x08
+#define V_LOOP     0x0A   // long
+#define V_REPLEN   0x0E
+#define V_PERIOD   0x10
+#define V_VOL      0x12
+#define V_DMA      0x14
+#define V_PORTDIR  0x16
+#define V_PORTSPD  0x17
+#define V_PORTDST  0x18
+#define V_VIBCMD   0x1A
+#define V_VIBPOS   0x1B
+
+/* offsets into the audNxxx structures */
+#define A_LC       0x00   // long
+#define A_LEN      0x04
+#define A_PER      0x06
+#define A_VOL      0x08
+
+static const uint8_t sin_tab[32] = {
+  0x00,0x18,0x31,0x4A,0x61,0x78,0x8D,0xA1,0xB4,0xC5,0xD4,0xE0,0xEB,0xF4,0xFA,0xFD,
+  0xFF,0xFD,0xFA,0xF4,0xEB,0xE0,0xD4,0xC5,0xB4,0xA1,0x8D,0x78,0x61,0x4A,0x31,0x18 };
+
+static const uint16_t periods[39] = {
+  0x0358,0x0328,0x02FA,0x02D0,0x02A6,0x0280,0x025C,0x023A,0x021A,0x01FC,0x01E0,
+  0x01C5,0x01AC,0x0194,0x017D,0x0168,0x0153,0x0140,0x012E,0x011D,0x010D,0xFE,
+  0xF0,0xE2,0xD6,0xCA,0xBE,0xB4,0xAA,0xA0,0x97,0x8F,0x87,
+  0x7F,0x78,0x71,0x00,0x00 };
+
+/* ---------------------------- big endian access -------------------------- */
+
+static uint16_t get16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static uint32_t get32(const uint8_t *p) { return ((uint32_t)get16(p) << 16) | get16(p+2); }
+static void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v >> 16); put16(p+2, v); }
+
+/* accesses to the emulated address space are range checked as broken */
+/* modules may make the original code access random memory */
+static int in_mem(struct wc_state *s, uint32_t addr, int n) {
+  if(addr <= s->mem_size - n) return 1;
+  if(!s->error) s->error = "memory access outside module and workspace";
+  s->out_of_range++;
+  return 0;
+}
+
+static uint8_t rb(struct wc_state *s, uint32_t a) { return in_mem(s, a, 1)?s->mem[a]:0; }
+static uint16_t rw(struct wc_state *s, uint32_t a) { return in_mem(s, a, 2)?get16(s->mem+a):0; }
+static uint32_t rl(struct wc_state *s, uint32_t a) { return in_mem(s, a, 4)?get32(s->mem+a):0; }
+static void ww(struct wc_state *s, uint32_t a, uint16_t v) { if(in_mem(s, a, 2)) put16(s->mem+a, v); }
+static void wl(struct wc_state *s, uint32_t a, uint32_t v) { if(in_mem(s, a, 4)) put32(s->mem+a, v); }
+
+/* ------------------------------- tables ---------------------------------- */
+
+/* vol: */
+static void vol(struct wc_state *s) {
+  for(int v=64;v>=0;v--)
+    for(int b=255;b>=0;b--) {
+      s->vtab[v*256+b] = (int8_t)(int16_t)((int8_t)b * v / WC_MVOL);
+      s->utab[v*256+b] = s->vtab[v*256+b] + 0x80;
+    }
+}
+
+/* incrcal: the two divu give the exact 32 bit quotient */
+static void incrcal(struct wc_state *s) {
+  memset(s->itab, 0, sizeof(s->itab));
+  for(uint32_t p=0x30;p<WC_PERIODS;p++)
+    s->itab[p] = (uint32_t)WC_INC / p;
+}
+
+/* ------------------------------ init/prepare ----------------------------- */
+
+static void init(struct wc_state *s) {
+  uint32_t a1 = s->module + MOD_PATTERN_TABLE_OFFSET + 2;
+
+  /* find highest pattern number. Note that each new maximum costs */
+  /* an additional count, so not all 128 entries are being checked */
+  int16_t d0 = 0x7F;
+  uint8_t d1 = 0, d2;
+  for(;;) {
+    d2 = d1;                                      // loop:
+    d0--;
+    do {
+      d1 = rb(s, a1++);                           // lop2:
+      if((int8_t)d1 > (int8_t)d2) break;
+    } while(--d0 != -1);
+    if((int8_t)d1 <= (int8_t)d2) break;
+  }
+  d2++;
+
+  uint32_t a2 = ((uint32_t)d2 << 10) + MOD_PATTERN_DATA_OFFSET + s->module;
+  uint32_t a0 = s->module;
+  for(int i=0;i<MOD_MAX_SAMPLES;i++) {            // lop3:
+    wl(s, a2, 0);
+    s->samplestarts[i] = a2;
+    a2 += 2 * (uint32_t)rw(s, a0+42);
+    a0 += 30;
+  }
+  s->end_of_samples = a2;
+}
+
+static void copyw(struct wc_state *s, uint32_t dst, uint32_t src) {
+  ww(s, dst, rw(s, src));
+}
+
+static int prepare(struct wc_state *s) {
+  uint32_t a6 = s->workspc;
+  uint32_t a0 = s->samplestarts[0];
+  uint32_t a1 = s->end_of_samples;
+
+  /* move all samples to stack */
+  do {                                            // tostack:
+    a1 -= 2; a6 -= 2;
+    copyw(s, a6, a1);
+  } while((int32_t)a1 > (int32_t)a0);
+
+  a1 = s->module;
+  a0 = s->samplestarts[0];
+  uint32_t a5 = a0, a4 = 0, a3;
+
+  for(int i=0;i<MOD_MAX_SAMPLES;i++,a1+=30) {     // roop:
+    s->samplestarts[i] = a0;
+    if(!rw(s, a1+42)) continue;                   // len=0 -> no sample
+
+    uint16_t d4;
+    if(!rw(s, a1+46)) {                           // repeq:
+      uint16_t n = d4 = rw(s, a1+42);
+      a4 = a0;
+      for(uint32_t k=0;k<n;k++,a0+=2,a6+=2)       // fromstk:
+	copyw(s, a0, a6);
+    } else {                                      // repne:
+      uint16_t n = d4 = rw(s, a1+46);
+      a4 = a6;
+      for(uint32_t k=0;k<n;k++,a0+=2,a4+=2)       // get1st:
+	copyw(s, a0, a4);
+
+      /* like the asm code this only moves a6 by half the sample length */
+      a6 += (int16_t)rw(s, a1+42);
+    }
+
+    a5 = a0;                                      // rep:
+    uint16_t d1 = 0;
+    do {                                          // toosmal:
+      a3 = a4;
+      uint32_t n = rw(s, a1+48);
+      if(!n) n = 0x10000;                         // dbra with -1
+      for(uint32_t k=0;k<n;k++,a0+=2,a3+=2,d1+=2) // moverep:
+	copyw(s, a0, a3);
+    } while((int16_t)d1 < 320);
+
+    for(int k=0;k<160;k++,a0+=2,a5+=2)            // last320:
+      copyw(s, a0, a5);
+
+    ww(s, a1+42, d4+d4);                          // length
+    ww(s, a1+48, d1);                             // replen
+    ww(s, a1+46, 0);
+  }
+
+  if((int32_t)a0 > (int32_t)s->workspc) {
+    s->error = "workspace too small";             // nospac: illegal
+    return -1;
+  }
+  return 0;
+}
+
+/* -------------------------------- effects -------------------------------- */
+
+/* the arpeggio may read beyond the end of the period table and thus */
+/* sees the variables that follow it in wc_mod.s */
+static uint16_t periods_word(struct wc_state *s, int i) {
+  if(i < 39) return periods[i];
+  switch(i) {
+  case 39: return s->speed;
+  case 40: return s->counter;
+  case 41: return (s->songpos << 8) | s->brk;
+  case 42: return s->pattpos;
+  case 43: return s->dmacon;
+  }
+  i -= 44;
+  return (i&1)?(uint16_t)s->samplestarts[i/2]:(s->samplestarts[i/2] >> 16);
+}
+
+static void arpeggio(struct wc_state *s, uint8_t *vo, uint8_t *au) {
+  int r = s->counter % 3;
+  if(!r) {                                        // arp2:
+    put16(au+A_PER, get16(vo+V_PERIOD));
+    return;
+  }
+
+  int d0 = (r == 2)?(vo[V_PARAM] & 0x0F):(vo[V_PARAM] >> 4);
+  int16_t d1 = get16(vo+V_PERIOD);
+  for(int i=0;i<=0x24;i++) {                      // arploop:
+    uint16_t d2 = periods_word(s, i+d0);
+    if(d1 >= (int16_t)periods[i]) {
+      put16(au+A_PER, d2);                         // arp4:
+      return;
+    }
+  }
+}
+
+static void portup(uint8_t *vo, uint8_t *au) {
+  put16(vo+V_PERIOD, get16(vo+V_PERIOD) - vo[V_PARAM]);
+  if((get16(vo+V_PERIOD) & 0x0FFF) < 0x71)
+    put16(vo+V_PERIOD, (get16(vo+V_PERIOD) & 0xF000) | 0x71);
+  put16(au+A_PER, get16(vo+V_PERIOD) & 0x0FFF);     // por2:
+}
+
+static void portdown(uint8_t *vo, uint8_t *au) {
+  put16(vo+V_PERIOD, get16(vo+V_PERIOD) + vo[V_PARAM]);
+  if((get16(vo+V_PERIOD) & 0x0FFF) >= 0x358)
+    put16(vo+V_PERIOD, (get16(vo+V_PERIOD) & 0xF000) | 0x358);
+  put16(au+A_PER, get16(vo+V_PERIOD) & 0x0FFF);     // por3:
+}
+
+static void setmyport(uint8_t *vo) {
+  int16_t d2 = get16(vo+V_NOTE) & 0x0FFF;
+  put16(vo+V_PORTDST, d2);
+  int16_t d0 = get16(vo+V_PERIOD);
+  vo[V_PORTDIR] = 0;
+  if(d2 == d0)     put16(vo+V_PORTDST, 0);         // clrport:
+  else if(d2 < d0) vo[V_PORTDIR] = 1;
+}
+
+static void myslide(uint8_t *vo, uint8_t *au) {
+  if(!get16(vo+V_PORTDST)) return;
+
+  uint16_t d0 = vo[V_PORTSPD];
+  if(!vo[V_PORTDIR]) {
+    put16(vo+V_PERIOD, get16(vo+V_PERIOD) + d0);
+    if((int16_t)get16(vo+V_PORTDST) <= (int16_t)get16(vo+V_PERIOD)) {
+      put16(vo+V_PERIOD, get16(vo+V_PORTDST));
+      put16(vo+V_PORTDST, 0);
+    }
+  } else {                                        // mysub:
+    put16(vo+V_PERIOD, get16(vo+V_PERIOD) - d0);
+    if((int16_t)get16(vo+V_PORTDST) >= (int16_t)get16(vo+V_PERIOD)) {
+      put16(vo+V_PERIOD, get16(vo+V_PORTDST));
+      put16(vo+V_PORTDST, 0);
+    }
+  }
+  put16(au+A_PER, get16(vo+V_PERIOD));              // myok:
+}
+
+static void myport(uint8_t *vo, uint8_t *au) {
+  if(vo[V_PARAM]) {
+    vo[V_PORTSPD] = vo[V_PARAM];
+    vo[V_PARAM] = 0;
+  }
+  myslide(vo, au);
+}
+
+static void vi(uint8_t *vo, uint8_t *au) {
+  uint16_t d2 = sin_tab[(vo[V_VIBPOS] >> 2) & 0x1F];
+  d2 = (d2 * (vo[V_VIBCMD] & 0x0F)) >> 6;
+  uint16_t d0 = get16(vo+V_PERIOD);
+  if(vo[V_VIBPOS] & 0x80) d0 -= d2;               // vibmin:
+  else                    d0 += d2;
+  put16(au+A_PER, d0);                             // vib2:
+  vo[V_VIBPOS] += (vo[V_VIBCMD] >> 2) & 0x3C;
+}
+
+static void vib(uint8_t *vo, uint8_t *au) {
+  if(vo[V_PARAM]) vo[V_VIBCMD] = vo[V_PARAM];
+  vi(vo, au);
+}
+
+static void volslide(uint8_t *vo, uint8_t *au) {
+  uint16_t d0 = vo[V_PARAM] >> 4;
+  if(d0) {
+    put16(vo+V_VOL, get16(vo+V_VOL) + d0);
+    /* bmi: the finetune in the upper byte makes this clip as well */
+    if(!((get16(vo+V_VOL) - 0x40) & 0x8000))
+      put16(vo+V_VOL, 0x40);
+  } else {                                        // voldown:
+    put16(vo+V_VOL, get16(vo+V_VOL) - (vo[V_PARAM] & 0x0F));
+    if(get16(vo+V_VOL) & 0x8000)
+      put16(vo+V_VOL, 0);
+  }
+  put16(au+A_VOL, get16(vo+V_VOL));                 // vol2: / vol3:
+}
+
+static void checkcom(struct wc_state *s, uint8_t *vo, uint8_t *au) {
+  if(!(get16(vo+V_CMD) & 0x0FFF)) {
+    put16(au+A_PER, get16(vo+V_PERIOD));            // nop:
+    return;
+  }
+
+  switch(vo[V_CMD] & 0x0F) {
+  case 0: arpeggio(s, vo, au); break;
+  case 1: portup(vo, au); break;
+  case 2: portdown(vo, au); break;
+  case 3: myport(vo, au); break;
+  case 4: vib(vo, au); break;
+  case 5: myslide(vo, au); volslide(vo, au); break;    // port_toneslide:
+  case 6: vi(vo, au); volslide(vo, au); break;         // vib_toneslide:
+  default:
+    put16(au+A_PER, get16(vo+V_PERIOD));
+    if((vo[V_CMD] & 0x0F) == 0x0A) volslide(vo, au);
+    break;
+  }
+}
+
+static void checkcom2(struct wc_state *s, uint8_t *vo, uint8_t *au) {
+  switch(vo[V_CMD] & 0x0F) {
+  case 0x0D:                                      // pattbreak:
+    s->brk = 0xFF;
+    break;
+  case 0x0B:                                      // posjmp:
+    s->songpos = vo[V_PARAM] - 1;
+    s->brk = 0xFF;
+    break;
+  case 0x0C:                                      // setvol:
+    if(vo[V_PARAM] > 0x40) vo[V_PARAM] = 0x40;
+    au[A_VOL+1] = vo[V_PARAM];
+    vo[V_VOL+1] = vo[V_PARAM];
+    break;
+  case 0x0F:                                      // setspeed:
+    /* signed compare, values >= 0x80 are taken as they are */
+    if((int8_t)vo[V_PARAM] > 0x1F) vo[V_PARAM] = 0x1F;
+    if(vo[V_PARAM]) {
+      s->speed = vo[V_PARAM];
+      s->counter = 0;
+    }
+    break;
+  }
+}
+
+/* --------------------------------- music --------------------------------- */
+
+static void playvoice(struct wc_state *s, int v, uint32_t a0, uint32_t *d1, uint32_t a2) {
+  uint8_t *vo = s->voice[v], *au = s->aud[v];
+
+  put32(vo+V_NOTE, rl(s, a0 + *d1));
+  *d1 += 4;
+
+  uint8_t d2 = (vo[V_CMD] >> 4) | (vo[V_NOTE] & 0xF0);
+  if(d2) {
+    uint32_t d4 = d2 * 30;
+
+    /* samplestarts only has 31 entries, the asm code would read beyond */
+    if(d2 <= MOD_MAX_SAMPLES) put32(vo+V_START, s->samplestarts[d2-1]);
+    else { put32(vo+V_START, 0); s->out_of_range++; }
+
+    put16(vo+V_LEN, rw(s, a2+d4));
+    put16(vo+V_VOL, rw(s, a2+d4+2));               // finetune and volume
+    uint16_t d3 = rw(s, a2+d4+4);
+    if(d3) {
+      /* prepare() clears all repeat starts, so this isn't used */
+      put32(vo+V_LOOP, get32(vo+V_START) + (uint16_t)(d3+d3));
+      put16(vo+V_LEN, rw(s, a2+d4+4) + rw(s, a2+d4+6));
+      put16(vo+V_REPLEN, rw(s, a2+d4+6));
+    } else {                                      // noloop:
+      put32(vo+V_LOOP, get32(vo+V_START));
+      put16(vo+V_REPLEN, rw(s, a2+d4+6));
+    }
+    put16(au+A_VOL, get16(vo+V_VOL));
+  }
+
+  if(get16(vo+V_NOTE) & 0x0FFF) {                  // setregs:
+    if((vo[V_CMD] & 0x0F) == 0x03)
+      setmyport(vo);
+    else {                                        // setperiod:
+      put16(vo+V_PERIOD, get16(vo+V_NOTE) & 0x0FFF);
+      s->dmactrl = get16(vo+V_DMA);
+      vo[V_VIBPOS] = 0;
+
+      put32(au+A_LC, get32(vo+V_START));
+      put16(au+A_LEN, get16(vo+V_LEN));
+      put16(au+A_PER, get16(vo+V_PERIOD) & 0x0FFF);
+      s->dmacon |= get16(vo+V_DMA);
+    }
+  }
+  checkcom2(s, vo, au);
+}
+
+static void getnew(struct wc_state *s) {
+  uint32_t a0 = s->module + MOD_PATTERN_DATA_OFFSET;
+  uint32_t a2 = s->module + 12;
+  uint32_t d1 = (uint32_t)rb(s, s->module + MOD_PATTERN_TABLE_OFFSET + 2 + s->songpos) << 10;
+  d1 += s->pattpos;
+
+  if(!s->pattpos) {
+    if(s->visited[s->songpos & 0x7F]) s->looped = 1;
+    s->visited[s->songpos & 0x7F] = 1;
+  }
+
+  s->dmacon = 0;
+  for(int v=0;v<4;v++)
+    playvoice(s, v, a0, &d1, a2);
+
+  /* setdma: */
+  for(int v=0;v<4;v++) {
+    if(!(s->dmacon & (1<<v))) continue;
+    struct wc_channel *c = &s->wiz[v];
+    c->lc = get32(s->aud[v]+A_LC);
+    c->rpt = get16(s->voice[v]+V_REPLEN);
+    c->len = get16(s->aud[v]+A_LEN) + c->rpt;
+    c->pos = 0;
+  }
+
+  s->pattpos += 0x10;
+  if(s->pattpos == 0x400 || s->brk) {
+    s->pattpos = 0;                               // nex:
+    s->brk = 0;
+    s->songpos = (s->songpos + 1) & 0x7F;
+    if(s->songpos == rb(s, s->module + MOD_PATTERN_TABLE_OFFSET))
+      /* the asm code takes the restart position from the wrong */
+      /* place, which is the second byte of the pattern data */
+      s->songpos = rb(s, a0 + 1);
+  }
+}
+
+static uint32_t step(struct wc_state *s, const uint8_t *au) {
+  int16_t i = get16(au+A_PER) * 4;                // add.w/add.w
+  if(i < 0 || i >= 4*WC_PERIODS) { s->out_of_range++; return 0; }
+  return s->itab[i/4];
+}
+
+static const int8_t *voltab(struct wc_state *s, const int8_t *tab, const uint8_t *au) {
+  uint8_t v = au[A_VOL+1];                        // asl.w #8 drops the upper byte
+  if(v > 64) { s->out_of_range++; v = 64; }
+  return tab + 256*v;
+}
+
+/* cache: mixer parameters only change when music has run */
+static void cache(struct wc_state *s) {
+  /* the rate may only change together with the steps */
+  s->mixhalf = s->halfrate;
+
+  for(int v=0;v<4;v++) {
+    s->stp[v] = step(s, s->aud[v]);
+    if(s->mixhalf) s->stp[v] <<= 1;               // add.l %d2,%d2
+    s->vtb[v] = voltab(s, s->vtab, s->aud[v]);
+  }
+
+  /* channel 1 is mixed last and adds the unsigned offset */
+  s->vtb[0] = voltab(s, s->utab, s->aud[0]);
+}
+
+static void music(struct wc_state *s) {
+  if((int16_t)++s->counter >= (int16_t)s->speed) {
+    s->counter = 0;
+    getnew(s);
+  } else {
+    /* nonew: break is only ever set and cleared again in getnew */
+    for(int v=0;v<4;v++)
+      checkcom(s, s->voice[v], s->aud[v]);
+  }
+
+  if(s->flags & WC_CACHED) cache(s);
+}
+
+/* --------------------------------- mixer --------------------------------- */
+
+/* mix channels a and b, final adds the result to the precomputed */
+/* channels and converts to unsigned */
+static void mix(struct wc_state *s, int a, int b, uint8_t *out, int final) {
+  struct wc_channel *ca = &s->wiz[a], *cb = &s->wiz[b];
+  const uint8_t *pa = s->mem + ca->lc, *pb = s->mem + cb->lc;
+  uint16_t pos_a = ca->pos, frc_a = ca->frc;
+  uint16_t pos_b = cb->pos, frc_b = cb->frc;
+  uint32_t step_a = step(s, s->aud[a]), step_b = step(s, s->aud[b]);
+  const int8_t *va = voltab(s, s->vtab, s->aud[a]), *vb = voltab(s, s->vtab, s->aud[b]);
+
+  for(int i=0;i<WC_SAMPLES;i++) {
+    uint32_t f;
+    f = frc_a + (step_a & 0xffff);                // add.w %a4,%d1
+    frc_a = f;
+    pos_a += (step_a >> 16) + (f >> 16);          // addx.w %d2,%d0
+    f = frc_b + (step_b & 0xffff);
+    frc_b = f;
+    pos_b += (step_b >> 16) + (f >> 16);
+
+    uint8_t d7 = va[pa[pos_a]] + vb[pb[pos_b]];
+    if(final) d7 = (d7 + out[i]) ^ 0x80;
+    out[i] = d7;
+  }
+
+  if(pos_a >= ca->len) pos_a -= ca->rpt;
+  ca->pos = pos_a;
+  ca->frc = frc_a;
+
+  if(pos_b >= cb->len) pos_b -= cb->rpt;
+  cb->pos = pos_b;
+  cb->frc = frc_b;
+}
+
+/* the same using the cached parameters. The unsigned offset is part */
+/* of the volume table of the first channel in the final pass */
+static void mix_cached(struct wc_state *s, int a, int b, uint8_t *out, int final) {
+  struct wc_channel *ca = &s->wiz[a], *cb = &s->wiz[b];
+  const uint8_t *pa = s->mem + ca->lc, *pb = s->mem + cb->lc;
+  uint16_t pos_a = ca->pos, frc_a = ca->frc;
+  uint16_t pos_b = cb->pos, frc_b = cb->frc;
+  const uint16_t inc_a = s->stp[a] >> 16, fstep_a = s->stp[a];
+  const uint16_t inc_b = s->stp[b] >> 16, fstep_b = s->stp[b];
+  const int8_t *va = s->vtb[a], *vb = s->vtb[b];
+
+  /* at half rate every sample is written twice */
+  const int n = s->mixhalf?2:1;
+
+  for(int i=0;i<WC_SAMPLES;i+=n) {
+    uint32_t f;
+    f = frc_a + fstep_a;
+    frc_a = f;
+    pos_a += inc_a + (f >> 16);
+    f = frc_b + fstep_b;
+    frc_b = f;
+    pos_b += inc_b + (f >> 16);
+
+    uint8_t d7 = va[pa[pos_a]] + vb[pb[pos_b]];
+    if(final) d7 += out[i];
+    out[i] = d7;
+    out[i+n-1] = d7;
+  }
+
+  if(pos_a >= ca->len) pos_a -= ca->rpt;
+  ca->pos = pos_a;
+  ca->frc = frc_a;
+
+  if(pos_b >= cb->len) pos_b -= cb->rpt;
+  cb->pos = pos_b;
+  cb->frc = frc_b;
+}
+
+static void sample(struct wc_state *s, uint8_t *out) {
+  if(s->flags & WC_CACHED) {
+    mix_cached(s, 1, 2, out, 0);
+    mix_cached(s, 0, 3, out, 1);
+  } else {
+    mix(s, 1, 2, out, 0);                         // v1:
+    mix(s, 0, 3, out, 1);                         // v2:
+  }
+}
+
+/* the music routine is run five times every six VBLs */
+static void stereo(struct wc_state *s) {
+  uint8_t *out = s->mem + s->sample1;
+
+  s->count--;
+  int m = (s->count >= 0 && s->count <= 4)?4-s->count:-1;
+  for(int i=0;i<WC_PARTS;i++) {
+    if(i == m) music(s);
+    sample(s, out + i*WC_SAMPLES);
+  }
+  if(m < 0) s->count = WC_PARTS;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* load and start a mod like load_mod() and muson() do */
+int wc_load(struct wc_state *s, const uint8_t *file, long size, int flags) {
+  memset(s, 0, sizeof(*s));
+  s->flags = flags;
+
+  if(size < MOD15_PATTERN_DATA_OFFSET) {
+    s->error = "file too short";
+    return -1;
+  }
+
+  if((flags & WC_HALFRATE) && !(flags & WC_CACHED)) {
+    s->error = "half rate needs the cached mixer";
+    return -1;
+  }
+  s->halfrate = (flags & WC_HALFRATE)?1:0;
+
+  /* memory layout as set up by load_mod() in nanomactracker.c */
+  uint8_t head[MOD_PATTERN_DATA_OFFSET];
+  memset(head, 0, sizeof(head));
+  memcpy(head, file, size < (long)sizeof(head)?size:(long)sizeof(head));
+  if(mod_channels(head) != 4) {
+    s->error = "only 4 channel modules are supported";
+    return -1;
+  }
+  long body = mod_is_31_sample(head)?size:size + MOD_CONVERT_EXTRA;
+  mod_convert_header(head);
+
+  long end;
+  if(flags & WC_EMBEDDED) end = size + MOD_CONVERT_EXTRA + 4*16384;
+  else                    end = mod_workspace_end(head, body);
+  if(end < 0) {
+    s->error = "sample repeat too long";
+    return -1;
+  }
+
+  /* the tables are kept outside, but the space is reserved like on the Mac */
+  uint32_t alloc = (end > body?end:body) + MOD_TABLES + 1;
+  s->sample1 = (alloc + 1) & ~1;
+  s->dummy = s->sample1 + WC_LEN;
+  s->mem_size = s->dummy + 4;
+
+  /* sample positions are 16 bit, so the mixer may read up to 64k */
+  /* beyond a sample start */
+  s->mem = calloc(s->mem_size + 0x10000 + 4, 1);
+  if(!s->mem) {
+    s->error = "out of memory";
+    return -1;
+  }
+  memcpy(s->mem, file, size);
+  mod_convert(s->mem, size);
+  s->module = 0;
+  s->workspc = end;
+
+  /* initial values of the variables in wc_mod.s */
+  s->count = WC_PARTS;
+  s->speed = 6;
+  for(int v=0;v<4;v++) {
+    s->wiz[v].lc = s->sample1;
+    put32(s->aud[v]+A_LC, s->dummy);
+    put16(s->voice[v]+V_DMA, 1<<v);
+  }
+
+  /* muson: */
+  vol(s);
+  incrcal(s);
+  init(s);
+  if(prepare(s)) return -1;
+  if(flags & WC_CACHED) cache(s);
+  memset(s->mem + s->sample1, 0xff, WC_LEN);
+
+  /* errors during preparation would have crashed the Mac */
+  return s->error?-1:0;
+}
+
+/* one VBL: hand the buffer to the "hardware" and calculate the next one */
+void wc_vbl(struct wc_state *s, uint8_t *out) {
+  memcpy(out, s->mem + s->sample1, WC_LEN);
+  stereo(s);
+  s->vbls++;
+}
+
+void wc_free(struct wc_state *s) {
+  free(s->mem);
+  s->mem = NULL;
+}
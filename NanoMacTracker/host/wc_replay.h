@@ -0,0 +1,84 @@
+/*
+  wc_replay.h
+
+  Portable C version of the Wizzcat replay routine in wc_mod.s
+*/
+
+#ifndef WC_REPLAY_H
+#define WC_REPLAY_H
+
+#include <stdint.h>
+
+/* same parameters as the Mac variant of wc_mod.s */
+#define WC_MVOL     0x100
+#define WC_PARTS    5
+#define WC_LEN      370                           // samples per VBL
+#define WC_SAMPLES  (WC_LEN/WC_PARTS)             // samples per call of sample()
+#define WC_INC      (3579546/(60*WC_LEN)*65536)   // integer division as done by gas
+
+#define WC_RATE     22254                         // nominal Mac sample rate
+
+#define WC_PERIODS  0x3A0                         // size of the increment table
+
+/* flags for wc_load() */
+#define WC_EMBEDDED 1     // memory layout of the mod built into wc_mod.s
+#define WC_CACHED   2     // mix with cached step and volume table pointers
+#define WC_HALFRATE 4     // cached mixer at half rate like with halfrate set in wc_mod.s
+
+/* wizNxxx, the state of the mixer */
+struct wc_channel {
+  uint32_t lc;        // sample address
+  uint32_t len;       // length in bytes incl. unrolled repeat
+  uint16_t rpt;       // repeat length in bytes
+  uint16_t pos;       // current position
+  uint16_t frc;       // fractional part of the position
+};
+
+struct wc_state {
+  /* The 68000 address space as seen by the replay. The module, the */
+  /* workspace behind it, the output buffer and the dummy long word all */
+  /* live in here and "addresses" are offsets into this buffer. */
+  uint8_t *mem;
+  uint32_t mem_size;
+
+  uint32_t module;              // module_ptr
+  uint32_t workspc;
+  uint32_t end_of_samples;
+  uint32_t samplestarts[31];
+  uint32_t sample1;             // 370 byte output buffer
+  uint32_t dummy;
+
+  int flags;
+
+  int8_t vtab[65*256];
+  int8_t utab[65*256];          // vtab + 0x80, for the cached mixer
+  uint32_t itab[WC_PERIODS];
+
+  /* stpN and vtbN of the cached mixer */
+  uint32_t stp[4];
+  const int8_t *vtb[4];
+  uint16_t halfrate, mixhalf;   // may be changed any time like on the Mac
+
+  /* audNxxx and voiceN are kept as big endian byte images as the */
+  /* asm code accesses them bytewise as well as wordwise */
+  uint8_t aud[4][16];
+  uint8_t voice[4][28];
+  struct wc_channel wiz[4];
+
+  uint16_t speed, counter, pattpos, dmacon, dmactrl;
+  uint8_t songpos, brk;
+  int16_t count;
+
+  /* host side bookkeeping only, doesn't influence the replay */
+  uint8_t visited[128];         // song positions played so far
+  int looped;                   // song has started over
+  uint32_t vbls;
+  uint32_t out_of_range;        // accesses the 68000 would have done outside the tables
+  const char *error;
+};
+
+int wc_load(struct wc_state *s, const uint8_t *file, long size, int flags);
+void wc_vbl(struct wc_state *s, uint8_t *out);
+void wc_free(struct wc_state *s);
+
+#endif // WC_REPLAY_H
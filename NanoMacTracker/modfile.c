@@ -0,0 +1,157 @@
+/*
+  modfile.c
+
+  MOD file preparation shared by the Mac player and the host tools.
+  All multi byte values are accessed bytewise, so this gives the same
+  result on the big endian 68000 and on little endian hosts.
+*/
+
+#include <string.h>
+#include "modfile.h"
+
+/* number of channels given by the tag of a 31 sample file, 0 if there's */
+/* no known tag and the file thus has the old 15 sample format */
+static int mod_tag_channels(const uint8_t *data) {
+  const uint8_t *tag = data+MOD_TAG_OFFSET;
+
+  if(!memcmp(tag, "M.K.", 4) || !memcmp(tag, "M!K!", 4) || !memcmp(tag, "FLT4", 4))
+    return 4;
+  if(!memcmp(tag+1, "CHN", 3) && tag[0] >= '1' && tag[0] <= '9')
+    return tag[0] - '0';
+  if(!memcmp(tag+2, "CH", 2) && tag[0] >= '0' && tag[0] <= '9' && tag[1] >= '0' && tag[1] <= '9')
+    return 10 * (tag[0] - '0') + tag[1] - '0';
+  if(!memcmp(tag, "FLT8", 4) || !memcmp(tag, "CD81", 4) || !memcmp(tag, "OKTA", 4))
+    return 8;
+  return 0;
+}
+
+/* check for a valid tag (new format only). Accepts the same tags as */
+/* mod_channels(), so e.g. "4CHN" files aren't taken for 15 sample ones */
+int mod_is_31_sample(const uint8_t *data) {
+  return mod_tag_channels(data) != 0;
+}
+
+/* number of channels as given by the tag, 4 for 15 sample files. The */
+/* replay only supports 4 channels, other files must not be mistaken */
+/* for 15 sample ones */
+int mod_channels(const uint8_t *data) {
+  int channels = mod_tag_channels(data);
+  return channels?channels:4;
+}
+
+/* convert the header of a 15 sample file to the 31 sample format and */
+/* adjust the repeat lengths. data must hold the first 1084 bytes of the */
+/* file. Of a 15 sample file only the first 600 bytes are used and the */
+/* caller has to take care of the pattern data read beyond that */
+void mod_convert_header(uint8_t *data) {
+  if(!mod_is_31_sample(data)) {
+    /* copy number of patterns, jump position and pattern table*/
+    memmove(data+MOD_PATTERN_TABLE_OFFSET, data+MOD15_PATTERN_TABLE_OFFSET, 128+2);
+
+    /* clear additional 16 sample entries */
+    memset(data+MOD_SAMPLE_INFO+15*MOD_SAMPLE_INFO_LEN, 0, 16*MOD_SAMPLE_INFO_LEN);
+
+    /* set tag (not really needed by wizzcat player */
+    memcpy(data+MOD_TAG_OFFSET, "M.K.", 4);
+  }
+
+  /* check for sample repeat len being 0 */
+  uint8_t *p = data+MOD_SAMPLE_INFO;
+  for(int i=0;i<MOD_MAX_SAMPLES;i++,p+=MOD_SAMPLE_INFO_LEN)
+    if(!p[28] && !p[29])
+      p[29] = 1;
+}
+
+/* prepare the given mod data for replay with the Wizzcat routine: */
+/* - convert from original 15 sample format to newer 31 sample format if needed */
+/* - adjust repeat lengths */
+/* The buffer needs MOD_CONVERT_EXTRA bytes of space behind the file data */
+void mod_convert(uint8_t *data, long len) {
+  /* copy pattern and sample data from 600 to 1084 */
+  if(!mod_is_31_sample(data) && len > MOD15_PATTERN_DATA_OFFSET)
+    memmove(data+MOD_PATTERN_DATA_OFFSET, data+MOD15_PATTERN_DATA_OFFSET,
+	    len-MOD15_PATTERN_DATA_OFFSET);
+
+  mod_convert_header(data);
+}
+
+static long get16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+/* end of the sample data (offset from data) of a converted header as */
+/* calculated by init in wc_mod.s. Returns -1 if init would scan beyond */
+/* the pattern table */
+long mod_samples_end(const uint8_t *data) {
+  const uint8_t *p = data+MOD_PATTERN_TABLE_OFFSET+2;
+  int16_t count = 0x7F;
+  uint8_t cur = 0, max;
+
+  /* same scan for the highest pattern number as in init */
+  for(;;) {
+    max = cur;
+    count--;
+    do {
+      if(p >= data+MOD_PATTERN_DATA_OFFSET) return -1;
+      cur = *p++;
+      if((int8_t)cur > (int8_t)max) break;
+    } while(--count != -1);
+    if((int8_t)cur <= (int8_t)max) break;
+  }
+
+  long end = MOD_PATTERN_DATA_OFFSET + (long)((max+1) & 0xff) * 1024;
+  for(int i=0;i<MOD_MAX_SAMPLES;i++)
+    end += 2 * get16(data+MOD_SAMPLE_INFO+i*MOD_SAMPLE_INFO_LEN+22);
+  return end;
+}
+
+/* Space needed between the end of the sample data and the end of the */
+/* workspace. prepare in wc_mod.s moves all samples to the end of the */
+/* workspace and then unrolls them one by one to their final place. */
+/* This follows its pointer arithmetic and returns how far the unrolled */
+/* samples grow beyond the sample data not yet read back. Returns -1 if */
+/* prepare would never finish (repeats of 32k or more) */
+long mod_workspace(const uint8_t *data) {
+  const uint8_t *p = data+MOD_SAMPLE_INFO;
+  long src = 0, dst = 0, need = 0;
+
+  for(int i=0;i<MOD_MAX_SAMPLES;i++,p+=MOD_SAMPLE_INFO_LEN) {
+    long len = get16(p+22), repstart = get16(p+26), replen = get16(p+28);
+    if(!len) continue;
+
+    long start = src;
+    if(!repstart) {
+      dst += 2*len;
+      src += 2*len;
+    } else {
+      dst += 2*repstart;
+      src += (int16_t)len;        /* prepare only advances by half the sample */
+    }
+
+    /* repeat is unrolled to at least 320 bytes using a signed 16 bit count */
+    uint16_t count = 0;
+    int n = 0;
+    do {
+      count += 2*replen;
+      dst += 2*replen;
+      if(++n > 320) return -1;
+    } while((int16_t)count < 320);
+    dst += 320;
+
+    if(dst - start > need) need = dst - start;
+  }
+  return need;
+}
+
+/* offset of the end of the workspace for a converted header and the */
+/* given length of the (converted) data. Returns -1 if the module can't */
+/* be prepared */
+long mod_workspace_end(const uint8_t *data, long len) {
+  long end = mod_samples_end(data);
+  long need = mod_workspace(data);
+  if(need < 0) return -1;
+
+  /* init would run away, use the fixed workspace */
+  if(end < 0) return (len + MOD_WORKSPACE + 1) & ~1;
+
+  if(end < len) end = len;
+  return (end + need + MOD_WORKSPACE_MARGIN + 1) & ~1;
+}
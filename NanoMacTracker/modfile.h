@@ -0,0 +1,45 @@
+/*
+  modfile.h
+
+  MOD file preparation shared by the Mac player and the host tools
+*/
+
+#ifndef MODFILE_H
+#define MODFILE_H
+
+#include <stdint.h>
+
+/* layout of the 31 sample format the Wizzcat routine expects */
+#define MOD_SAMPLE_INFO         20
+#define MOD_SAMPLE_INFO_LEN     30
+#define MOD_MAX_SAMPLES         31
+#define MOD_PATTERN_TABLE_OFFSET 950
+#define MOD_TAG_OFFSET        1080
+#define MOD_PATTERN_DATA_OFFSET 1084
+
+/* the old 15 sample format */
+#define MOD15_PATTERN_TABLE_OFFSET 470
+#define MOD15_PATTERN_DATA_OFFSET  600
+
+/* additional bytes needed behind the file data for the conversion */
+#define MOD_CONVERT_EXTRA      (MOD_PATTERN_DATA_OFFSET - MOD15_PATTERN_DATA_OFFSET)
+
+/* the Wizzcat init routines need 64k workspace behind the (converted) file */
+#define MOD_WORKSPACE          (4*16384+2)
+
+/* the volume and increment tables of the replay are calculated into */
+/* the memory behind the workspace. Must match TABLES_SIZE in wc_mod.s */
+#define MOD_TABLES             (2*65*256+0x3A0*4)
+
+/* safety margin added to the calculated workspace */
+#define MOD_WORKSPACE_MARGIN   256
+
+int mod_is_31_sample(const uint8_t *data);
+int mod_channels(const uint8_t *data);
+void mod_convert_header(uint8_t *data);
+void mod_convert(uint8_t *data, long len);
+long mod_samples_end(const uint8_t *data);
+long mod_workspace(const uint8_t *data);
+long mod_workspace_end(const uint8_t *data, long len);
+
+#endif // MODFILE_H
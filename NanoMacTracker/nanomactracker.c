@@ -10,6 +10,9 @@
 #include <Dialogs.h>
 #include <Fonts.h>
 #include <StandardFile.h>
+#include <Events.h>
+
+#include "modfile.h"
 
 pascal void ButtonFrameProc(DialogRef dlg, DialogItemIndex itemNo) {
   DialogItemType type;
@@ -32,44 +35,106 @@ extern uint8_t module_data[], module_data_end[];
 extern void muson(void);
 extern void musoff(void);
 
-/* prepare the given mod data for replay with the Wizzcat routine: */
-/* - convert from original 15 sample format to newer 31 sample format if needed */
-/* - adjust repeat lengths */
-
 extern uint8_t *module_ptr, *workspc;
+#ifdef CACHED_MIX
+extern volatile uint16_t halfrate;
+#else
+static uint16_t halfrate = 0;   // the original mixer only runs at full rate
+#endif
 
-  
-void prepare(uint8_t *data, int len) {
-  // check for valid tag (new format only)
-  if( (*(uint32_t*)(data+1080) != 'M.K.') &&
-      (*(uint32_t*)(data+1080) != 'M!K!') && 
-      (*(uint32_t*)(data+1080) != 'FLT4') ) {
+static int playing = 0;
+static uint8_t *builtin_workspc;   // workspace of the built-in mod
 
-    /* copy pattern and sample data from 600 to 1084 */
-    bcopy(data+600, data+1084, len-600);
+static void start(void) {
+  muson();
+  playing = 1;
+}
 
-    /* copy number of patterns, jump position and pattern table*/
-    bcopy(data+470, data+950, 128+2);
+/* The mixer runs at half the rate if less than MIN_FREE percent of */
+/* the CPU time would be left to the main task at full rate */
+#define MIN_FREE       10
+#define MEASURE_TICKS  30
 
-    /* clear additional 16 sample entries */
-    bzero(data+20+15*30, 16*30);    
+static uint32_t idle_loops;       // measure() without playback
 
-    /* set tag (not really needed by wizzcat player */
-    *(uint32_t*)(data+1080) = 'M.K.';
-  }
+/* count how often the main task gets through a loop within some ticks */
+static uint32_t measure(void) {
+  uint32_t n = 0, t = TickCount();
 
-  /* check for sample repeat len being 0 */
-  uint8_t *p = data+20;
-  for(int i=0;i<31;i++,p+=30)
-    if(*(uint16_t*)(p+28) == 0)
-      *(uint16_t*)(p+28) = 1;
+  /* start at the beginning of a tick */
+  while(TickCount() == t);
+  t += 1 + MEASURE_TICKS;
+  while(TickCount() < t) n++;
+  return n;
+}
 
+/* start playback and select the mixing rate from the measured CPU */
+/* time left */
+static void start_measured(void) {
+  halfrate = 0;
+  start();
+#ifdef CACHED_MIX
+  if(measure() * 100 < idle_loops * MIN_FREE)
+    halfrate = 1;
+#endif
+}
+
+static void stop(void) {
+  /* musoff restores the VBL vector saved by muson */
+  if(playing) musoff();
+  playing = 0;
+}
+
+/* convert the mod data (see modfile.c) and hand it to the Wizzcat routine */
+void prepare(uint8_t *data, int len) {
+  mod_convert(data, len);
   module_ptr = data;
 }
 
 #define CHK(n,f) { OSErr e = f; if(e) { /* wprintf("%s failed with error %d\n", n, e); */ return NULL; } }
 
-uint8_t *load_mod() {
+#define LOAD_CHUNK  8192   // bytes read between progress updates
+
+static uint8_t head[MOD_PATTERN_DATA_OFFSET];
+static uint8_t extra[MOD_CONVERT_EXTRA];
+static uint8_t *load_workspc;      // workspace end of the mod returned by load_mod()
+static char load_error[32];       // why load_mod() rejected a file
+
+static void show_progress(DialogPtr dlg, long done, long total) {
+  DialogItemType type;
+  Handle itemH;
+  Rect box;
+  char str[32];
+
+  sprintf(str+1, "Loading %ld%%", total?100*done/total:100);
+  str[0] = strlen(str+1);
+  GetDialogItem(dlg, 4, &type, &itemH, &box);
+  SetDialogItemText(itemH, (unsigned char*)str);
+}
+
+/* read len bytes in chunks and report the progress */
+static OSErr read_chunks(DialogPtr dlg, short ref, uint8_t *dst, long len) {
+  long done = 0;
+  while(done < len) {
+    long count = len - done;
+    if(count > LOAD_CHUNK) count = LOAD_CHUNK;
+
+    OSErr e = FSRead(ref, &count, dst + done);
+    if(e) return e;
+    done += count;
+    show_progress(dlg, done, len);
+  }
+  return noErr;
+}
+
+/* Load a mod file in the format expected by the Wizzcat routine. The */
+/* header and pattern table are read first. They tell the format and */
+/* how much workspace prepare in wc_mod.s needs, so the buffer can be */
+/* sized exactly. 15 sample files are converted while being read by */
+/* placing the pattern and sample data directly behind the 31 sample */
+/* header. The song currently playing continues while the file is read */
+/* unless there isn't enough memory for both. */
+uint8_t *load_mod(DialogPtr dlg) {
   short int ref;
   //Str255 volName;
   //Str255 name;
@@ -84,7 +149,7 @@ uint8_t *load_mod() {
   if(reply.good)
     {
 		  
-  strcat(name, reply.fName);
+  memcpy(name, reply.fName, reply.fName[0]+1);
 
 /*	
   CHK("GetVol()", GetVol(volName, &vref));
@@ -109,27 +174,109 @@ uint8_t *load_mod() {
 
   // wprintf("File size: %d bytes\n", size);  
 
-  /* prepare() needs some additional 484 bytes and there needs */
-  /* to be 64k extra "workspace" for the wizzcat init routines */
-  if(data != NULL) DisposePtr(data);
-  data = NewPtr(size+484+4*16384+2);
+  /* read the header incl. the first bytes of pattern data of a 15 */
+  /* sample file */
+  long count = (size < MOD_PATTERN_DATA_OFFSET)?size:MOD_PATTERN_DATA_OFFSET;
+  memset(head, 0, sizeof(head));
+  if(size < MOD15_PATTERN_DATA_OFFSET || FSRead(ref, &count, head)) {
+    FSClose(ref);
+    return NULL;
+  }
+
+  if(mod_channels(head) != 4) {
+    sprintf(load_error, " (%d channel MOD rejected)", mod_channels(head));
+    FSClose(ref);
+    return NULL;
+  }
+
+  /* where the rest of the file goes */
+  long offset = MOD_PATTERN_DATA_OFFSET, body = size;
+  if(!mod_is_31_sample(head)) {
+    /* keep the pattern data read beyond the 15 sample header */
+    memcpy(extra, head+MOD15_PATTERN_DATA_OFFSET, MOD_CONVERT_EXTRA);
+    offset += MOD_CONVERT_EXTRA;
+    body += MOD_CONVERT_EXTRA;
+  }
+  mod_convert_header(head);
+
+  /* prepare in wc_mod.s needs some workspace behind the mod */
+  /* which is followed by the replay tables */
+  long end = mod_workspace_end(head, body);
+  if(end < 0) {
+    FSClose(ref);
+    return NULL;
+  }
 
-  if(!data) {
+  uint8_t *buf = NewPtr(end+MOD_TABLES+1);
+  if(!buf && data) {
+    /* not enough memory to keep the current song while loading */
+    stop();
+    DisposePtr(data);
+    data = NULL;
+    buf = NewPtr(end+MOD_TABLES+1);
+  }
+  if(!buf) {
     /* wprintf("No enough memory\n"); */
+    FSClose(ref);
+    return NULL;
+  }
+
+  memcpy(buf, head, MOD_PATTERN_DATA_OFFSET);
+  if(offset != MOD_PATTERN_DATA_OFFSET)
+    memcpy(buf+MOD_PATTERN_DATA_OFFSET, extra, MOD_CONVERT_EXTRA);
+
+  if(read_chunks(dlg, ref, buf+offset, size-count)) {
+    DisposePtr(buf);
+    FSClose(ref);
     return NULL;
   }
-  
-  CHK("FSRead()", FSRead(ref, &size, data));
   
   CHK("FSClose()", FSClose(ref));
 
-  prepare(data, size);
-  workspc = data+size+484+4*16384+2;
-  return data;
+  /* the workspace is accessed wordwise, mod_workspace_end() returns */
+  /* an even offset */
+  load_workspc = buf + end;
+  return buf;
  }
  return NULL;
 }
 
+/* load a mod and use the built-in one if that fails or if */
+/* no file is to be asked for */
+static void select_mod(DialogPtr dlg, int ask) {
+  DialogItemType type;
+  Handle itemH;
+  Rect box;
+
+  load_error[0] = 0;
+  uint8_t *mod = ask?load_mod(dlg):NULL;
+
+  stop();
+  if(data) DisposePtr(data);
+  data = mod;
+
+  //swap in the name in the dialog box
+  GetDialogItem(dlg, 4, &type, &itemH, &box);
+  if(mod) {
+    module_ptr = mod;
+    workspc = load_workspc;
+  } else {
+    prepare(module_data, module_data_end - module_data);
+    workspc = builtin_workspc;
+    memcpy(name, "\pAXELF.MOD", 10);
+  }
+
+  start_measured();
+
+  /* name with the reason a file wasn't played or the mixing rate */
+  const char *info = load_error[0]?load_error:halfrate?" (11 kHz)":"";
+  int len = strlen(info);
+  if(name[0] + len > 255) len = 255 - name[0];
+  memcpy(name+1+name[0], info, len);
+  name[0] += len;
+  SetDialogItemText(itemH,name);
+}
+
 void set_text(DialogPtr dlg, int item, char *text) {
   static char str[255] = "\0Hallo!";
   
@@ -171,26 +318,18 @@ int main(int argc, char** argv) {
   // every vbl and thus counts at 60hz
   vbl_test_var = 0;
 
-  /* try to load a mod and use the built-in one if that fails */
-  if(!load_mod()) 
-  {	  
-    prepare(module_data, module_data_end - module_data);
-    //swap in the name in the dialog box
-  GetDialogItem(dlg, 4, &type, &itemH, &box);
-  SetDialogItemText(itemH,"\pAXELF.MOD");
-  }
-  else
-  {
-  //swap in the name in the dialog box
-  GetDialogItem(dlg, 4, &type, &itemH, &box);
-  SetDialogItemText(itemH,name);
-  }
+  builtin_workspc = workspc;
+  idle_loops = measure();
+#ifdef AUTOPLAY
+  /* start right away, e.g. for unattended runs in the simulation */
+  select_mod(dlg, 0);
+#else
+  select_mod(dlg, 1);
+#endif
   
   // Set song name -> this doesn't work ...
   //set_text(dlg, 4, module_ptr);
 
-  muson();
-  
   /* playback now runs in the background in the VBL */
     
   short item;
@@ -198,33 +337,10 @@ int main(int argc, char** argv) {
     ModalDialog(NULL, &item);
 	
 	if(item == 5) //a new song is selected
-	{
-		musoff();
-  
-		  /* try to load a mod and use the built-in one if that fails */
-		  if(!load_mod()) 
-		  {	  
-			prepare(module_data, module_data_end - module_data);
-			//swap in the name in the dialog box
-		  GetDialogItem(dlg, 4, &type, &itemH, &box);
-		  SetDialogItemText(itemH,"\pAXELF.MOD");
-		  }
-		  else
-		  {
-		  //swap in the name in the dialog box
-		  GetDialogItem(dlg, 4, &type, &itemH, &box);
-		  SetDialogItemText(itemH,name);
-		  }
-		  //swap in the name in the dialog box
-		  GetDialogItem(dlg, 4, &type, &itemH, &box);
-		  //GetDialogItemText(itemH,4,
-		  SetDialogItemText(itemH,name);
-
-		muson();
-	}
+	  select_mod(dlg, 1);
   } while(item != 1);
 
-  musoff();
+  stop();
 
   FlushEvents(everyEvent, -1);
   return 0;
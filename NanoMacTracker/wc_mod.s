@@ -78,6 +78,28 @@
 .endif
 
 .equ FORWARD_TO_ORIG_IRQ, 1
+
+/* Mix using per channel step and volume table pointers which are only */
+/* recalculated when the music routine has run and a volume table with */
+/* the unsigned offset built in for the last channel being mixed. It is */
+/* selected with the build option CACHED_MIX, the original mixer is the */
+/* default until both have been measured */
+
+/* The cached mixer can mix at half the rate writing every sample twice */
+/* while halfrate is set. This is selected at runtime by the C code if */
+/* full rate mixing leaves too little CPU time to the main task */
+.ifndef STE
+.ifdef CACHED_MIX
+.equ HALF_MIX, 1
+.endif
+.endif
+
+/* The volume and increment tables are not part of the program but are */
+/* calculated into the memory behind the workspace (see load_mod()). */
+/* TABLES_SIZE must match MOD_TABLES in modfile.h */
+.equ VTAB_SIZE,   65*256
+.equ ITAB_SIZE,   0x03A0*4
+.equ TABLES_SIZE, 2*VTAB_SIZE+ITAB_SIZE
 	
 /* ================================================================================ */
 /* ================================================================================ */
@@ -179,6 +201,9 @@ muson:
 
         jsr     init                    /* Initialize music */
         jsr     prepare                 /* Prepare samples */
+.ifdef CACHED_MIX
+	bsr	cache			/* mixer parameters of the current state */
+.endif
 .ifdef STE
         move    #0x2700,%sr
 
@@ -266,8 +291,14 @@ oldtima:DC.L 0
 .endif
 	
 /*--------------------------------------------------------- Volume table --*/
-vol:	moveq	#64,%d0
-	lea	vtabend(%pc),%a0
+/* vtab holds the signed sample values scaled by volumes 0..64, utab   */
+/* the same with 0x80 added which makes the mixed result unsigned      */
+vol:	movea.l	workspc,%a0
+	move.l	%a0,vtabp
+	lea	VTAB_SIZE(%a0),%a0	/* end of vtab */
+	move.l	%a0,utabp
+	lea	VTAB_SIZE(%a0),%a1	/* end of utab */
+	moveq	#64,%d0
 
 ploop:	move.w	#255,%d1
 mloop:	move.w	%d1,%d2
@@ -275,16 +306,25 @@ mloop:	move.w	%d1,%d2
 	muls	%d0,%d2
 	divs	#MVOL,%d2		/* <---- Master volume*/
 	move.b	%d2,-(%a0)
+	add.b	#0x80,%d2
+	move.b	%d2,-(%a1)
 	dbra	%d1,mloop
 	dbra	%d0,ploop
 
 	rts
 
-vtab:	DS.B 65*256
-vtabend:	
+vtabp:	DC.L 0
+utabp:	DC.L 0
 
 /*------------------------------------------------------ Increment-table --*/
-incrcal:lea	stab(%pc),%a0
+/* itab is indexed by the period, the first 0x30 entries are unused    */
+incrcal:movea.l	workspc,%a0
+	lea	2*VTAB_SIZE(%a0),%a0
+	move.l	%a0,itabp
+	moveq	#0x30-1,%d0
+clritab:clr.l	(%a0)+
+	dbra	%d0,clritab
+
 	move.w	#0x30,%d1
 	move.w	#0x039F-0x30,%d0
 	move.l	#INC,%d2
@@ -306,8 +346,7 @@ recalc:	swap	%d2
 	dbra	%d0,recalc
 	rts
 
-itab:	DS.L 0x30
-stab:	DS.L 0x03A0-0x30
+itabp:	DC.L 0
 
 /*-------------------------------------------------------- DMA interrupt --*/
 stereo:
@@ -436,10 +475,27 @@ nomus:
 .endif
 
 sample:	
-	lea	itab(%pc),%a5
-	lea	vtab(%pc),%a3
 	moveq	#0,%d0
 	moveq	#0,%d4
+.ifdef CACHED_MIX
+v1:	movea.l	wiz2lc(%pc),%a0
+
+	move.w	wiz2pos(%pc),%d0
+	move.w	wiz2frc(%pc),%d1
+	move.w	stp2(%pc),%d2
+	movea.w	stp2+2(%pc),%a4
+	movea.l	vtb2(%pc),%a2
+
+	movea.l	wiz3lc(%pc),%a1
+
+	move.w	wiz3pos(%pc),%d4
+	move.w	wiz3frc(%pc),%d5
+	move.w	stp3(%pc),%d6
+	movea.w	stp3+2(%pc),%a5
+	movea.l	vtb3(%pc),%a3
+.else
+	movea.l	itabp(%pc),%a5
+	movea.l	vtabp(%pc),%a3
 
 v1:	movea.l	wiz2lc(%pc),%a0
 
@@ -472,10 +528,15 @@ v1:	movea.l	wiz2lc(%pc),%a0
 	move.w	aud3vol(%pc),%d7
 	asl.w	#8,%d7
 	lea	0(%a3,%d7.w),%a3
+.endif
 .ifdef STE	
 	movea.l	samp1(%pc),%a6
 .endif
 	moveq	#0,%d3
+.ifdef HALF_MIX
+	tst.w	mixhalf
+	bne	half1
+.endif
 
 	.rept SAMPLES
 	add.w	%a4,%d1    /* carry also goes into extended bit */
@@ -494,6 +555,24 @@ v1:	movea.l	wiz2lc(%pc),%a0
 	move.b	%d7,(%a6)+
 .endif	
 	.endr
+.ifdef HALF_MIX
+	bra	end1
+
+	/* half rate, the steps are doubled by cache */
+half1:	.rept SAMPLES/2
+	add.w	%a4,%d1
+	addx.w	%d2,%d0
+	add.w	%a5,%d5
+	addx.w	%d6,%d4
+	move.b	0(%a0,%d0.l),%d3
+	move.b	0(%a2,%d3.w),%d7
+	move.b	0(%a1,%d4.l),%d3
+	add.b	0(%a3,%d3.w),%d7
+	move.b	%d7,(%a6)+
+	move.b	%d7,(%a6)+
+	.endr
+end1:
+.endif
 
 	cmp.l	wiz2len(%pc),%d0
 	blt.s	ok2
@@ -511,10 +590,27 @@ ok3:	move.w	%d4,wiz3pos
 
 
 
-	lea	itab(%pc),%a5
-	lea	vtab(%pc),%a3
 	moveq	#0,%d0
 	moveq	#0,%d4
+.ifdef CACHED_MIX
+v2:	movea.l	wiz1lc(%pc),%a0
+
+	move.w	wiz1pos(%pc),%d0
+	move.w	wiz1frc(%pc),%d1
+	move.w	stp1(%pc),%d2
+	movea.w	stp1+2(%pc),%a4
+	movea.l	vtb1(%pc),%a2		/* points into utab */
+
+	movea.l	wiz4lc(%pc),%a1
+
+	move.w	wiz4pos(%pc),%d4
+	move.w	wiz4frc(%pc),%d5
+	move.w	stp4(%pc),%d6
+	movea.w	stp4+2(%pc),%a5
+	movea.l	vtb4(%pc),%a3
+.else
+	movea.l	itabp(%pc),%a5
+	movea.l	vtabp(%pc),%a3
 
 v2:	movea.l	wiz1lc(%pc),%a0
 
@@ -546,6 +642,7 @@ v2:	movea.l	wiz1lc(%pc),%a0
 	move.w	aud4vol(%pc),%d7
 	asl.w	#8,%d7
 	lea	0(%a3,%d7.w),%a3
+.endif
 
 .ifdef STE
 	movea.l	samp1(%pc),%a6
@@ -556,6 +653,10 @@ v2:	movea.l	wiz1lc(%pc),%a0
 	sub.l   #SAMPLES,%a6
 .endif
 	moveq	#0,%d3
+.ifdef HALF_MIX
+	tst.w	mixhalf
+	bne	half2
+.endif
 
 	.rept SAMPLES
 	add.w	%a4,%d1
@@ -572,10 +673,31 @@ v2:	movea.l	wiz1lc(%pc),%a0
 	addq.w	#2,%a6
 .else
 	add.b   (%a6),%d7    /* add signed value of precomputed channels 1+2 */
+.ifndef CACHED_MIX
 	eor.b   #0x80,%d7    /* convert to unsigned */
+.endif
 	move.b	%d7,(%a6)+   /* store final unsigned value */		
 .endif
 	.endr
+.ifdef HALF_MIX
+	bra	end2
+
+	/* both bytes of channels 2+3 are the same */
+half2:	.rept SAMPLES/2
+	add.w	%a4,%d1
+	addx.w	%d2,%d0
+	add.w	%a5,%d5
+	addx.w	%d6,%d4
+	move.b	0(%a0,%d0.l),%d3
+	move.b	0(%a2,%d3.w),%d7
+	move.b	0(%a1,%d4.l),%d3
+	add.b	0(%a3,%d3.w),%d7
+	add.b	(%a6),%d7
+	move.b	%d7,(%a6)+
+	move.b	%d7,(%a6)+
+	.endr
+end2:
+.endif
 
 	cmp.l	wiz1len(%pc),%d0
 	blt.s	ok1
@@ -645,6 +767,22 @@ aud4vol:DC.W 0
 
 dmactrl:DC.W 0
 
+.ifdef HALF_MIX
+	.globl halfrate
+halfrate:DC.W 0		/* requested by the C code */
+mixhalf:DC.W 0		/* used by the mixer, set by cache */
+.endif
+
+/* cached mixer parameters of the four channels, see cache */
+stp1:	DC.L 0
+stp2:	DC.L 0
+stp3:	DC.L 0
+stp4:	DC.L 0
+vtb1:	DC.L 0
+vtb2:	DC.L 0
+vtb3:	DC.L 0
+vtb4:	DC.L 0
+
 dummy:	DC.L 0
 
 .ifdef STE
@@ -783,7 +921,53 @@ lop3:	clr.l	(%a2)
 	move.l	%a2,end_of_samples	/**/
 	rts
 
-music:	/* lea	module_data(%pc),%a0 */
+music:	bsr	tick
+.ifdef CACHED_MIX
+	/* fall through into cache */
+
+/* get step and volume table pointer of all channels as used by the */
+/* mixer. These only change when the music routine has run */
+cache:	movea.l	itabp(%pc),%a0
+	lea	aud1per(%pc),%a1
+	lea	stp1(%pc),%a2
+	lea	vtb1(%pc),%a3
+	moveq	#3,%d1
+.ifdef HALF_MIX
+	/* the rate may only change together with the steps */
+	move.w	halfrate(%pc),%d3
+	move.w	%d3,mixhalf
+.endif
+
+cachelp:move.w	(%a1),%d0		/* period */
+	add.w	%d0,%d0
+	add.w	%d0,%d0
+.ifdef HALF_MIX
+	move.l	0(%a0,%d0.w),%d2
+	tst.w	%d3
+	beq.s	cachefr
+	add.l	%d2,%d2			/* twice the step at half rate */
+cachefr:move.l	%d2,(%a2)+
+.else
+	move.l	0(%a0,%d0.w),(%a2)+
+.endif
+	move.w	2(%a1),%d0		/* volume */
+	asl.w	#8,%d0
+	movea.l	vtabp(%pc),%a4
+	lea	0(%a4,%d0.w),%a4
+	move.l	%a4,(%a3)+
+	lea	16(%a1),%a1		/* next audNxxx */
+	dbra	%d1,cachelp
+
+	/* channel 1 is mixed last and adds the unsigned offset */
+	move.w	aud1vol(%pc),%d0
+	asl.w	#8,%d0
+	movea.l	utabp(%pc),%a4
+	lea	0(%a4,%d0.w),%a4
+	move.l	%a4,vtb1
+.endif
+	rts
+
+tick:	/* lea	module_data(%pc),%a0 */
 	movea.l module_ptr(%pc),%a0
 	addq.w	#0x01,counter
 	move.w	counter(%pc),%d0
@@ -1247,7 +1431,7 @@ module_data_end:
 	ds.b	16*30+4  /* extra space for format conversion (see prepare() function) */
 	
 	DS.l	16384			/* Workspace*/
-workspcend :DS.W	1
+workspcend :DS.B	TABLES_SIZE		/* volume and increment tables */
 
 	.globl workspc
 workspc:DC.L	workspcend	
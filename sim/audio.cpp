@@ -0,0 +1,199 @@
+/*
+  audio.cpp
+
+  Audio capture for the NanoMac simulation. The Mac fetches one audio
+  sample from the RAM sound buffer per video line. The testbench thus
+  hands one sample per hsync to this sink which buffers them and writes
+  them either as a WAV file or as raw 16 bit signed samples (if the file
+  name ends with .s16). This works with and without video.
+
+  At the end of the simulation the captured audio can optionally be
+  resampled offline to a standard rate like 44.1 or 48 kHz and some
+  statistics (level, DC offset, clipping) are printed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cstdint>
+#include <vector>
+
+// The Mac outputs one sample per video line. A real Mac has a 15.6672 MHz
+// pixel clock and 704 pixels per line which gives 22254.5 Hz. The simulation
+// runs the video at a 16 MHz pixel clock, but the Mac software generates
+// its audio for the nominal rate. That is thus what's written into the header.
+#define AUDIO_RATE   22254
+
+// number of samples collected before they are written to disk
+#define AUDIO_BLOCK  4096
+
+// half the number of taps of the resampling filter
+#define RESAMPLE_TAPS 32
+
+static FILE *audio_fd = NULL;
+static char *audio_name = NULL;
+static int audio_raw = 0;           // write headerless .s16
+static int audio_resample_rate = 0; // 0 = don't resample
+
+static std::vector<int16_t> audio_samples;  // all samples, used for resampling and stats
+static size_t audio_written = 0;            // samples already written to disk
+static size_t audio_clipped = 0;            // samples at full scale
+
+static void put_le16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put_le32(uint8_t *p, uint32_t v) { put_le16(p, v); put_le16(p+2, v >> 16); }
+
+static void wav_header(FILE *fd, int rate, uint32_t samples) {
+  uint8_t hdr[44];
+
+  memcpy(hdr, "RIFF", 4);
+  put_le32(hdr+4, 36 + 2*samples);
+  memcpy(hdr+8, "WAVEfmt ", 8);
+  put_le32(hdr+16, 16);         // fmt chunk size
+  put_le16(hdr+20, 1);          // PCM
+  put_le16(hdr+22, 1);          // mono
+  put_le32(hdr+24, rate);       // sample rate
+  put_le32(hdr+28, 2*rate);     // byte rate
+  put_le16(hdr+32, 2);          // block align
+  put_le16(hdr+34, 16);         // bits per sample
+  memcpy(hdr+36, "data", 4);
+  put_le32(hdr+40, 2*samples);
+
+  fseek(fd, 0, SEEK_SET);
+  if(fwrite(hdr, 1, sizeof(hdr), fd) != sizeof(hdr))
+    perror("audio header");
+}
+
+static void write_samples(FILE *fd, const int16_t *data, size_t n) {
+  uint8_t buffer[2*AUDIO_BLOCK];
+
+  while(n) {
+    size_t chunk = (n > AUDIO_BLOCK)?AUDIO_BLOCK:n;
+    for(size_t i=0;i<chunk;i++) put_le16(buffer+2*i, data[i]);
+    if(fwrite(buffer, 2, chunk, fd) != chunk) perror("audio write");
+    data += chunk;
+    n -= chunk;
+  }
+}
+
+void audio_open(const char *name, int resample_rate) {
+  if(!name || !*name || !strcmp(name, "none"))
+    return;
+
+  audio_fd = fopen(name, "wb");
+  if(!audio_fd) {
+    perror(name);
+    return;
+  }
+
+  audio_name = strdup(name);
+  audio_raw = strlen(name) > 4 && !strcmp(name + strlen(name) - 4, ".s16");
+  audio_resample_rate = resample_rate;
+  audio_samples.reserve(60*AUDIO_RATE);
+
+  // reserve space for the header, the real one is written on close
+  if(!audio_raw) wav_header(audio_fd, AUDIO_RATE, 0);
+}
+
+// to be called with the 12 bit signed value of the core, returns it
+// sign extended and scaled to 16 bits as written to the file
+int16_t audio_sample(uint16_t value) {
+  int v = (value & 0x800)?(int)(value | ~0xfff):(int)(value & 0xfff);
+  int16_t sample = (int16_t)(v << 4);
+  if(!audio_fd) return sample;
+
+  if(v >= 2047 || v <= -2048) audio_clipped++;
+
+  audio_samples.push_back(sample);
+  if(audio_samples.size() - audio_written >= AUDIO_BLOCK) {
+    write_samples(audio_fd, audio_samples.data() + audio_written, audio_samples.size() - audio_written);
+    audio_written = audio_samples.size();
+  }
+  return sample;
+}
+
+// windowed sinc interpolation, the input is considered to be zero
+// outside the captured range
+static void resample(const std::vector<int16_t> &in, std::vector<int16_t> &out, int in_rate, int out_rate) {
+  double ratio = (double)in_rate / out_rate;
+  double cutoff = (out_rate < in_rate)?0.95*out_rate/in_rate:0.95;
+  size_t n = (size_t)(in.size() / ratio);
+
+  out.resize(n);
+  for(size_t i=0;i<n;i++) {
+    double t = i * ratio;
+    long center = (long)floor(t);
+    double acc = 0;
+
+    for(long k = center - RESAMPLE_TAPS + 1; k <= center + RESAMPLE_TAPS; k++) {
+      if(k < 0 || k >= (long)in.size()) continue;
+
+      double x = t - k;
+      double sinc = (x == 0)?1.0:sin(M_PI*cutoff*x)/(M_PI*cutoff*x);
+      double w = 0.42 + 0.5*cos(M_PI*x/RESAMPLE_TAPS) + 0.08*cos(2*M_PI*x/RESAMPLE_TAPS);  // blackman
+      acc += in[k] * cutoff * sinc * w;
+    }
+
+    if(acc >  32767) acc =  32767;
+    if(acc < -32768) acc = -32768;
+    out[i] = (int16_t)lrint(acc);
+  }
+}
+
+static void audio_stats(void) {
+  size_t n = audio_samples.size();
+  if(!n) return;
+
+  int min = 32767, max = -32768;
+  double sum = 0, sum2 = 0;
+
+  for(size_t i=0;i<n;i++) {
+    int s = audio_samples[i];
+    if(s < min) min = s;
+    if(s > max) max = s;
+    sum += s;
+    sum2 += (double)s * s;
+  }
+
+  double dc = sum / n;
+  double rms = sqrt(sum2 / n - dc*dc);
+
+  printf("Audio: %zu samples (%.3fs), min %d, max %d, DC offset %.1f, AC RMS %.1f (%.1f dBFS), %zu clipped\n",
+	 n, (double)n / AUDIO_RATE, min, max, dc, rms, (rms > 0)?20*log10(rms/32768):-INFINITY, audio_clipped);
+}
+
+void audio_close(void) {
+  if(!audio_fd) return;
+
+  write_samples(audio_fd, audio_samples.data() + audio_written, audio_samples.size() - audio_written);
+  audio_written = audio_samples.size();
+  if(!audio_raw) wav_header(audio_fd, AUDIO_RATE, audio_written);
+  fclose(audio_fd);
+  audio_fd = NULL;
+
+  audio_stats();
+
+  if(audio_resample_rate && audio_resample_rate != AUDIO_RATE && !audio_samples.empty()) {
+    // audio.wav -> audio-44100.wav
+    char name[1024];
+    snprintf(name, sizeof(name) - 16, "%s", audio_name);
+    char *ext = strrchr(name, '.');
+    if(ext) *ext = 0;
+    sprintf(name + strlen(name), "-%d.%s", audio_resample_rate, audio_raw?"s16":"wav");
+
+    std::vector<int16_t> out;
+    resample(audio_samples, out, AUDIO_RATE, audio_resample_rate);
+
+    FILE *fd = fopen(name, "wb");
+    if(fd) {
+      if(!audio_raw) wav_header(fd, audio_resample_rate, out.size());
+      write_samples(fd, out.data(), out.size());
+      fclose(fd);
+      printf("Audio: resampled to %d Hz into %s\n", audio_resample_rate, name);
+    } else
+      perror(name);
+  }
+
+  free(audio_name);
+  audio_name = NULL;
+}
@@ -0,0 +1,85 @@
+#!/bin/bash
+#
+# bench.sh
+#
+# Standard performance benchmark of the simulation, run by "make bench".
+# Each scenario runs from reset until a fixed goal or simulated time.
+# The simulated seconds per wall clock second, the peak RSS and the
+# disk and file I/O of each run are printed and appended as one JSON
+# object per line to the log, so results can be compared across RTL
+# and testbench changes:
+#
+#   $ ./bench.sh BINARY LOG
+#
+# The disk images are taken from the environment, scenarios without
+# their images are skipped:
+#
+#   FLOPPY   boot floppy, e.g. system30.dsk
+#   DESKTOP  PBM of its desktop, see --save-frame in README.md
+#   SCSI     bootable SCSI disk image
+#
+# The fields of a log line don't change, new ones are only ever added
+# at the end.
+
+BIN=$1
+LOG=$2
+if [ -z "$BIN" ] || [ -z "$LOG" ]; then
+    echo "Usage: $0 BINARY LOG"
+    exit 1
+fi
+
+# same for all scenarios: fast RAM model, no audio file
+COMMON="--mem=sram --audio=none"
+
+# name, images needed, arguments
+SCENARIOS=(
+    "first_frame||--floppy=none --stop=frame:0 --stop=time:2:fail"
+    "rom_to_floppy|FLOPPY|--floppy=$FLOPPY --stop=leds:0x01 --stop=time:10:fail"
+    "desktop|FLOPPY DESKTOP|--floppy=$FLOPPY --golden-target=$DESKTOP:50 --stop=time:60:fail"
+    "floppy_reads|FLOPPY|--floppy=$FLOPPY --rom-patch=fastboot --stop=time:10:ok"
+    "scsi_boot|SCSI|--floppy=none --scsi=$SCSI --rom-patch=fastboot --stop=time:10:ok"
+)
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+git diff --quiet HEAD 2>/dev/null || COMMIT="$COMMIT-dirty"
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+FAILED=0
+
+printf "%-14s %10s %10s %10s %10s %10s %6s\n" scenario sim_s wall_s sim/wall rss_kB sectors exit
+for s in "${SCENARIOS[@]}"; do
+    IFS='|' read -r NAME NEEDS ARGS <<< "$s"
+
+    MISSING=
+    for n in $NEEDS; do
+	[ -f "${!n}" ] || MISSING="$MISSING $n"
+    done
+    if [ -n "$MISSING" ]; then
+	printf "%-14s skipped, no image in%s\n" $NAME "$MISSING"
+	continue
+    fi
+
+    OUT=$($BIN $COMMON $ARGS 2>&1)
+    STATUS=$?
+    [ $STATUS -ne 0 ] && FAILED=1
+
+    # stopped after 123.456ms, 789ms real time, speed factor 6
+    # resources: peak RSS 1234kB, 5 sectors read, 6 sectors written, 7 bytes read, 8 bytes written
+    read SIM_MS WALL_MS <<< $(echo "$OUT" | sed -n 's/^stopped after \([0-9.]*\)ms, \([0-9]*\)ms real time.*/\1 \2/p')
+    read RSS SRD SWR BRD BWR <<< $(echo "$OUT" | sed -n 's/^resources: peak RSS \([0-9]*\)kB, \([0-9]*\) sectors read, \([0-9]*\) sectors written, \([0-9]*\) bytes read, \([0-9]*\) bytes written/\1 \2 \3 \4 \5/p')
+
+    LINE=$(awk -v d="$DATE" -v c="$COMMIT" -v b="$(basename $BIN)" -v n="$NAME" -v st="$STATUS" \
+	       -v sim="${SIM_MS:-0}" -v wall="${WALL_MS:-0}" -v rss="${RSS:-0}" \
+	       -v srd="${SRD:-0}" -v swr="${SWR:-0}" -v brd="${BRD:-0}" -v bwr="${BWR:-0}" 'BEGIN {
+	printf "{\"date\":\"%s\",\"commit\":\"%s\",\"binary\":\"%s\",\"scenario\":\"%s\",\"exit\":%d,", d, c, b, n, st
+	printf "\"sim_s\":%.6f,\"wall_s\":%.3f,\"sim_per_wall\":%.6f,\"peak_rss_kb\":%d,", sim/1000, wall/1000, (wall > 0)?sim/wall:0, rss
+	printf "\"sectors_read\":%d,\"sectors_written\":%d,\"bytes_read\":%.0f,\"bytes_written\":%.0f}\n", srd, swr, brd, bwr
+    }')
+    echo "$LINE" >> $LOG
+
+    awk -v n="$NAME" -v st="$STATUS" -v sim="${SIM_MS:-0}" -v wall="${WALL_MS:-0}" -v rss="${RSS:-0}" -v sec="$(( ${SRD:-0} + ${SWR:-0} ))" 'BEGIN {
+	printf "%-14s %10.3f %10.3f %10.6f %10d %10d %6d\n", n, sim/1000, wall/1000, (wall > 0)?sim/wall:0, rss, sec, st
+    }'
+done
+
+echo "results appended to $LOG"
+exit $FAILED
@@ -0,0 +1,248 @@
+/*
+  display.cpp
+
+  SDL video window. SDL may only handle its window and events on the
+  main thread of the process on some platforms, e.g. macOS. SDL thus
+  stays on the main thread, while the simulation loop is run in a
+  thread of its own by display_run(). Presenting a frame waits for the
+  vsync of the host display, and the compositor may delay it further,
+  which this way never holds up the simulation.
+
+  Completed frames are passed through a triple buffer. The simulation
+  writes into its back buffer and swaps it with the middle one when a
+  frame is complete. The display swaps the middle buffer with its front
+  buffer whenever it contains a new frame, shows it and saves it in
+  the screenshots directory. Neither side ever waits for the other. If
+  the display falls behind, frames are dropped and neither shown nor
+  saved, and their number is reported at the end.
+
+  Events go the other way through a single producer, single consumer
+  queue which the simulation polls once per frame.
+*/
+
+#ifdef VIDEO
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include "display.h"
+
+#define SCALE 1
+
+// triple buffer of frames
+#define FRESH  4    // flag in middle, buffer holds a frame not taken yet
+
+static struct display_buffer {
+  int width, height, number;
+  Pixel pixels[DISPLAY_MAX_W*DISPLAY_MAX_H];
+} *buffers;
+
+static int back = 0;          // owned by the simulation
+static int front = 1;         // owned by the display
+static SDL_atomic_t middle;   // index of the third buffer and FRESH flag
+
+// events from the display
+#define EVENTS 64
+static struct display_event events[EVENTS];
+static SDL_atomic_t ev_head, ev_tail;
+
+static SDL_Window *window = NULL;
+static SDL_Renderer *renderer = NULL;
+static SDL_Texture *texture = NULL;
+static SDL_threadID main_thread;
+static SDL_atomic_t sim_done;
+static uint32_t dropped;
+
+static void save_frame(struct display_buffer *b) {
+  SDL_Surface *surf = NULL, *scaled = NULL;
+  char name[32];
+
+  surf = SDL_CreateRGBSurfaceWithFormatFrom(b->pixels, b->width, b->height, 32,
+					    b->width*sizeof(Pixel), SDL_PIXELFORMAT_RGBA8888);
+  if (!surf) { SDL_Log("Failed creating surface: %s\n", SDL_GetError()); return; }
+
+  // adjust aspect ratio
+  int w = b->width;
+  while(w > 2*b->height) w/=2;
+
+  if(w != b->width) {
+    scaled = SDL_CreateRGBSurfaceWithFormat(0, w, b->height, 32, SDL_PIXELFORMAT_RGBA8888);
+    if (!scaled) { SDL_Log("Failed creating surface: %s\n", SDL_GetError()); goto cleanup; }
+    if (SDL_BlitScaled(surf, NULL, scaled, NULL) != 0) { SDL_Log("Failed scaling frame: %s\n", SDL_GetError()); goto cleanup; }
+  }
+
+  sprintf(name, "screenshots/frame%04d.png", b->number);
+  if (IMG_SavePNG(scaled?scaled:surf, name) != 0) SDL_Log("Failed saving image: %s\n", SDL_GetError());
+
+cleanup:
+  SDL_FreeSurface(scaled);
+  SDL_FreeSurface(surf);
+}
+
+static void push_event(int type, int key) {
+  int head = SDL_AtomicGet(&ev_head);
+  if((head + 1) % EVENTS == SDL_AtomicGet(&ev_tail)) return;  // queue full
+
+  events[head].type = type;
+  events[head].key = key;
+  SDL_AtomicSet(&ev_head, (head + 1) % EVENTS);
+}
+
+static void show(struct display_buffer *b) {
+  // check if current texture matches the frame size
+  if(texture) {
+    int w=-1, h=-1;
+    SDL_QueryTexture(texture, NULL, NULL, &w, &h);
+    if(w != b->width || h != b->height) {
+      SDL_DestroyTexture(texture);
+      texture = NULL;
+    }
+  }
+
+  if(!texture) {
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+				SDL_TEXTUREACCESS_STREAMING, b->width, b->height);
+    if (!texture) {
+      printf("Texture creation failed: %s\n", SDL_GetError());
+      push_event(DISPLAY_QUIT, 0);
+      return;
+    }
+  }
+
+  SDL_UpdateTexture(texture, NULL, b->pixels, b->width*sizeof(Pixel));
+
+  SDL_RenderClear(renderer);
+  SDL_RenderCopy(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+}
+
+/*
+  Mac video = 512x342, physical 704x370€60Hz -> 15.664 MHz pixel clock
+ */
+
+// to be called by the main thread
+void display_open(void) {
+  main_thread = SDL_ThreadID();
+
+  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    printf("SDL init failed.\n");
+    return;
+  }
+
+  window = SDL_CreateWindow("NanoMac", SDL_WINDOWPOS_CENTERED,
+        SDL_WINDOWPOS_CENTERED, SCALE*704, SCALE*370, SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
+  if (!window) {
+    printf("Window creation failed: %s\n", SDL_GetError());
+    return;
+  }
+
+  renderer = SDL_CreateRenderer(window, -1,
+            SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  if (!renderer) {
+    printf("Renderer creation failed: %s\n", SDL_GetError());
+    SDL_DestroyWindow(window);
+    window = NULL;
+    return;
+  }
+
+  buffers = (struct display_buffer*)malloc(3*sizeof(struct display_buffer));
+  if(!buffers) {
+    printf("Display: out of memory\n");
+    return;
+  }
+  SDL_AtomicSet(&middle, 2);
+}
+
+static int sim_thread(void *data) {
+  int (*run)(void) = (int (*)(void))data;
+  int result = run();
+  SDL_AtomicSet(&sim_done, 1);
+  return result;
+}
+
+// to be called by the main thread. Runs the simulation loop run() in a
+// thread of its own and handles window and events until it returns
+int display_run(int (*run)(void)) {
+  if(!renderer || !buffers) return run();
+
+  // the macOS default of 512kB for secondary threads is tight for a
+  // verilated model
+  SDL_SetHint(SDL_HINT_THREAD_STACK_SIZE, "8388608");
+  SDL_Thread *thread = SDL_CreateThread(sim_thread, "simulation", (void*)run);
+  if(!thread) {
+    printf("Simulation thread creation failed: %s\n", SDL_GetError());
+    return run();
+  }
+
+  while(!SDL_AtomicGet(&sim_done)) {
+    // wait for events, but check for new frames regularly
+    SDL_Event event;
+    if(SDL_WaitEventTimeout(&event, 10)) {
+      do {
+	if(event.type == SDL_QUIT)
+	  push_event(DISPLAY_QUIT, 0);
+
+	if(event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)
+	  push_event((event.type == SDL_KEYDOWN)?DISPLAY_KEY_DOWN:DISPLAY_KEY_UP,
+		     event.key.keysym.sym);
+      } while(SDL_PollEvent(&event));
+    }
+
+    if(SDL_AtomicGet(&middle) & FRESH) {
+      front = SDL_AtomicSet(&middle, front) & 3;
+      show(&buffers[front]);
+      save_frame(&buffers[front]);
+    }
+  }
+
+  int result;
+  SDL_WaitThread(thread, &result);
+  return result;
+}
+
+// called by the simulation for each completed frame, never blocks
+void display_frame(const Pixel *pixels, int stride, int width, int height, int number) {
+  if(!renderer || !buffers || width > DISPLAY_MAX_W || height > DISPLAY_MAX_H) return;
+
+  struct display_buffer *b = &buffers[back];
+  b->width = width;
+  b->height = height;
+  b->number = number;
+  for(int y=0;y<height;y++)
+    memcpy(b->pixels + y*width, pixels + y*stride, width*sizeof(Pixel));
+
+  int old = SDL_AtomicSet(&middle, back | FRESH);
+  if(old & FRESH) dropped++;   // previous frame was never taken
+  back = old & 3;
+}
+
+// returns 1 if an event was taken from the queue
+int display_event(struct display_event *ev) {
+  int tail = SDL_AtomicGet(&ev_tail);
+  if(tail == SDL_AtomicGet(&ev_head)) return 0;
+
+  *ev = events[tail];
+  SDL_AtomicSet(&ev_tail, (tail + 1) % EVENTS);
+  return 1;
+}
+
+void display_close(void) {
+  // an exit() within the simulation thread leaves SDL to the main thread
+  if(!window || SDL_ThreadID() != main_thread) return;
+
+  if(texture) SDL_DestroyTexture(texture);
+  if(renderer) SDL_DestroyRenderer(renderer);
+  SDL_DestroyWindow(window);
+  texture = NULL;
+  renderer = NULL;
+  window = NULL;
+  SDL_Quit();
+
+  if(dropped) printf("Display: %u frames dropped, not shown and not saved\n", dropped);
+}
+
+#endif // VIDEO
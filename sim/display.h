@@ -0,0 +1,39 @@
+/*
+  display.h
+
+  SDL video window. SDL stays on the main thread while the simulation
+  runs in a thread of its own.
+*/
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <cstdint>
+
+#define DISPLAY_MAX_W   2048
+#define DISPLAY_MAX_H   1024
+
+typedef struct Pixel {  // for SDL texture
+  uint8_t a;  // transparency
+  uint8_t b;  // blue
+  uint8_t g;  // green
+  uint8_t r;  // red
+} Pixel;
+
+// window events passed to the simulation
+#define DISPLAY_QUIT      0
+#define DISPLAY_KEY_DOWN  1
+#define DISPLAY_KEY_UP    2
+
+struct display_event {
+  int type;
+  int key;        // SDL keycode for key events
+};
+
+extern void display_open(void);
+extern int display_run(int (*run)(void));
+extern void display_frame(const Pixel *pixels, int stride, int width, int height, int number);
+extern int display_event(struct display_event *ev);
+extern void display_close(void);
+
+#endif // DISPLAY_H
@@ -0,0 +1,386 @@
+/*
+  floppy.cpp
+
+  Mac floppy geometry and GCR track encoding. The Mac uses five speed
+  zones of 16 tracks each with 12, 11, 10, 9 and 8 sectors per track.
+  Images store the sectors of both sides of a track after each other.
+
+  floppy_codec_step() follows the read path of floppy_track_codec.v
+  register by register. Each call corresponds to one "ready" pulse of
+  the Verilog codec and returns the disk byte it outputs during that
+  cycle, so the model gives the very same byte stream including the
+  sector interleave and the pipeline delays of the nibbler. The
+  decoder is independent of this and works like the Mac does, so
+  decoding an encoded track verifies the encoder.
+*/
+
+#include <string.h>
+
+#include "floppy.h"
+
+// states of the encoder state machine in floppy_track_codec.v
+#define STATE_SYN0   0      // 56 bytes sync pattern (0xff)
+#define STATE_ADDR   1      // 10 bytes address block
+#define STATE_SYN1   2      // 5 bytes sync pattern (0xff)
+#define STATE_DHDR   3      // 4 bytes data block header
+#define STATE_DZRO   4      // 8 encoded zero bytes in data block
+#define STATE_DPRE   5      // 4 bytes data prefetch
+#define STATE_DATA   6      // the payload itself
+#define STATE_DSUM   7      // 4 bytes data checksum
+#define STATE_DTRL   8      // 3 bytes data block trailer
+#define STATE_WAIT  15      // wait until start of next sector
+
+#define TAG_SIZE    12      // tag bytes in front of the sector data
+
+// encoder table taken from MESS emulator
+static const uint8_t sony_to_disk_byte[64] = {
+  0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6,
+  0xa7, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb2, 0xb3,
+  0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba, 0xbb, 0xbc,
+  0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3,
+  0xd6, 0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde,
+  0xdf, 0xe5, 0xe6, 0xe7, 0xe9, 0xea, 0xeb, 0xec,
+  0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+  0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+/* ============================== geometry ================================= */
+
+int floppy_spt(int track) {
+  if(track >= 64) return 8;
+  if(track >= 48) return 9;
+  if(track >= 32) return 10;
+  if(track >= 16) return 11;
+  return 12;
+}
+
+// images of more than 400k are double sided, like floppy_track_buffer.v decides
+int floppy_sides(long size) {
+  return (size > 409600)?2:1;
+}
+
+int floppy_sectors(int sides) {
+  return sides * FLOPPY_MAX_SECTORS / 2;
+}
+
+// image sector of side/track/sector, -1 if out of range
+int floppy_lba(int sides, int side, int track, int sector) {
+  if(side < 0 || side >= sides || track < 0 || track >= FLOPPY_TRACKS ||
+     sector < 0 || sector >= floppy_spt(track))
+    return -1;
+
+  int lba = 0;
+  for(int t=0;t<track;t++)
+    lba += sides * floppy_spt(t);
+
+  return lba + side * floppy_spt(track) + sector;
+}
+
+// side/track/sector of an image sector, returns -1 if out of range
+int floppy_chs(int sides, int lba, int *side, int *track, int *sector) {
+  if(lba < 0 || lba >= floppy_sectors(sides))
+    return -1;
+
+  int t = 0;
+  while(lba >= sides * floppy_spt(t))
+    lba -= sides * floppy_spt(t++);
+
+  *track = t;
+  *side = lba / floppy_spt(t);
+  *sector = lba % floppy_spt(t);
+  return 0;
+}
+
+/* ================================= gcr =================================== */
+
+uint8_t floppy_gcr_encode(uint8_t val) {
+  return sony_to_disk_byte[val & 0x3f];
+}
+
+// 6 bit value of a disk byte, -1 if it's not a valid gcr byte
+int floppy_gcr_decode(uint8_t byte) {
+  static int8_t table[256];
+  static int init = 0;
+
+  if(!init) {
+    memset(table, -1, sizeof(table));
+    for(int i=0;i<64;i++) table[sony_to_disk_byte[i]] = i;
+    init = 1;
+  }
+  return table[byte];
+}
+
+/* =============================== encoder ================================= */
+
+void floppy_codec_reset(struct floppy_codec *c) {
+  memset(c, 0, sizeof(*c));
+  c->state = STATE_SYN0;
+}
+
+// address of the byte the codec requests from the track buffer
+uint16_t floppy_codec_addr(const struct floppy_codec *c) {
+  return (c->sector << 9) | c->src_offset;
+}
+
+// One ready cycle of the codec. data is the track buffer contents at
+// floppy_codec_addr(), the disk byte output during this cycle is returned
+uint8_t floppy_codec_step(struct floppy_codec *c, int side, int sides,
+			  int track, int spt, uint8_t data) {
+  // parts of an address block
+  uint8_t sec_in_tr = c->sector & 0x0f;
+  uint8_t track_low = track & 0x3f;
+  uint8_t track_hi = ((side & 1) << 5) | ((track >> 6) & 1);
+  uint8_t format = ((sides == 2) << 5) | 2;
+  uint8_t checksum = track_low ^ sec_in_tr ^ track_hi ^ format;
+
+  // nibbler is held in reset during the data block header
+  if(c->state == STATE_DHDR) {
+    c->c1 = c->c2 = c->c3 = 0;
+    c->c2x = c->c3x = 0;
+    c->cnt = 0;
+    memset(c->nib_xor, 0, sizeof(c->nib_xor));
+  }
+
+  // four six bit units come out of the nibbler
+  uint8_t nib_out =
+    (c->cnt == 1)?(c->nib_xor[0] & 0x3f):
+    (c->cnt == 2)?(c->nib_xor[1] & 0x3f):
+    (c->cnt == 3)?(c->nib_xor[2] & 0x3f):
+    (((c->nib_xor[0] >> 6) << 4) | ((c->nib_xor[1] >> 6) << 2) | (c->nib_xor[2] >> 6));
+
+  // feed data into sony encoder and demultiplex its output
+  uint8_t odata = 0xff;
+  switch(c->state) {
+  case STATE_ADDR: {
+    static const uint8_t mark[] = { 0xd5, 0xaa, 0x96 };
+    uint8_t si =
+      (c->count == 3)?track_low:
+      (c->count == 4)?sec_in_tr:
+      (c->count == 5)?track_hi:
+      (c->count == 6)?format:
+      checksum;
+    odata =
+      (c->count < 3)?mark[c->count]:
+      (c->count == 8)?0xde:
+      (c->count == 9)?0xaa:
+      floppy_gcr_encode(si);
+  } break;
+
+  case STATE_DHDR: {
+    static const uint8_t mark[] = { 0xd5, 0xaa, 0xad };
+    odata = (c->count < 3)?mark[c->count]:floppy_gcr_encode(sec_in_tr);
+  } break;
+
+  case STATE_DZRO:
+  case STATE_DPRE:
+  case STATE_DATA:
+    odata = floppy_gcr_encode(nib_out);
+    break;
+
+  case STATE_DSUM:
+    odata = floppy_gcr_encode(
+      (c->count == 0)?(((c->c3 >> 6) << 4) | ((c->c2 >> 6) << 2) | (c->c1 >> 6)):
+      (c->count == 1)?c->c3:
+      (c->count == 2)?c->c2:
+      c->c1);
+    break;
+
+  case STATE_DTRL:
+    odata = (c->count == 0)?0xde:(c->count == 1)?0xaa:0xff;
+    break;
+  }
+
+  // request an input byte. this happens 4 byte ahead of output
+  int strobe = ((c->state == STATE_DPRE) ||
+		((c->state == STATE_DATA) && (c->count < 683-4-1))) && (c->cnt != 3);
+
+  // bytes going into the nibbler
+  uint8_t nib_in = (c->state == STATE_DZRO)?0x00:c->data_latch;
+
+  if((c->state == STATE_DPRE) || (c->state == STATE_DATA)) {
+    uint8_t cnt = c->cnt;
+    c->cnt = (cnt + 1) & 3;
+
+    if(c->count < 683-4) {
+      if(cnt == 1) {
+	uint8_t rot = (c->c1 << 1) | (c->c1 >> 7);
+	uint16_t sum = c->c3 + nib_in + (c->c1 >> 7);
+	c->c1 = rot;
+	c->c3 = sum;
+	c->c3x = sum >> 8;
+	c->nib_xor[0] = nib_in ^ rot;
+      }
+
+      if(cnt == 2) {
+	uint16_t sum = c->c2 + nib_in + c->c3x;
+	c->c2 = sum;
+	c->c2x = sum >> 8;
+	c->c3x = 0;
+	c->nib_xor[1] = nib_in ^ c->c3;
+      }
+
+      if(cnt == 3) {
+	c->c1 = c->c1 + nib_in + c->c2x;
+	c->c2x = 0;
+	c->nib_xor[2] = nib_in ^ c->c2;
+      }
+    } else if(cnt == 3)
+      // the last run of the 512/3 = 170 2/3 blocks is filled up with zeros
+      c->nib_xor[2] = 0x00;
+  }
+
+  if(strobe) {
+    c->data_latch = data;
+    c->src_offset = (c->src_offset + 1) & 0x1ff;
+  }
+
+  // byte counts per state are those of the Verilog state machine
+  static const uint16_t last[] = { 55-12, 9, 4+12, 3, 11, 3, 682, 3, 2 };
+  uint16_t count = c->count;
+  c->count = (count + 1) & 0x3ff;
+
+  if(c->state == STATE_WAIT) {
+    c->count = 0;
+    c->state = STATE_SYN0;
+    c->src_offset = 0;
+
+    // interleave of 2
+    if((c->sector == ((spt-2) & 15)) || (c->sector == ((spt-1) & 15)))
+      c->sector = !(c->sector & 1);
+    else
+      c->sector = (c->sector + 2) & 15;
+  } else if(count == last[c->state]) {
+    c->state = (c->state == STATE_DTRL)?STATE_WAIT:c->state + 1;
+    c->count = 0;
+  }
+
+  return odata;
+}
+
+// Encode a complete track the way the codec sends it after a reset,
+// starting with the sync bytes of sector 0. sectors holds the sectors
+// of the given side. Returns the number of bytes written to out which
+// needs to hold up to FLOPPY_TRACK_BYTES
+int floppy_encode_track(int sides, int side, int track,
+			const uint8_t *sectors, uint8_t *out) {
+  struct floppy_codec c;
+  int spt = floppy_spt(track);
+  int len = spt * FLOPPY_SECTOR_BYTES;
+
+  floppy_codec_reset(&c);
+  for(int i=0;i<len;i++)
+    out[i] = floppy_codec_step(&c, side, sides, track, spt,
+			       sectors[floppy_codec_addr(&c)]);
+
+  return len;
+}
+
+/* =============================== decoder ================================= */
+
+// 6 bit values of gcr bytes of a circular track, -1 on invalid bytes
+static int gcr_at(const uint8_t *in, int len, int pos) {
+  return floppy_gcr_decode(in[pos % len]);
+}
+
+static int mark_at(const uint8_t *in, int len, int pos, uint8_t m0, uint8_t m1, uint8_t m2) {
+  return in[pos % len] == m0 && in[(pos+1) % len] == m1 && in[(pos+2) % len] == m2;
+}
+
+// decode the 6:2 encoded tag and data of a sector starting at pos,
+// returns 0 if the checksum and the trailer are fine
+static int decode_data(const uint8_t *in, int len, int pos, uint8_t *out) {
+  uint8_t c0 = 0, c1 = 0, c2 = 0;
+  uint8_t buf[TAG_SIZE + FLOPPY_SECTOR_SIZE];
+  int n = 0;
+
+  while(n < (int)sizeof(buf)) {
+    int upper = gcr_at(in, len, pos++);
+    int n0 = gcr_at(in, len, pos++);
+    int n1 = gcr_at(in, len, pos++);
+    if(upper < 0 || n0 < 0 || n1 < 0) return -1;
+
+    int carry = c2 >> 7;
+    c2 = (c2 << 1) | carry;
+
+    uint8_t v = (((upper << 2) & 0xc0) | n0) ^ c2;
+    uint16_t sum = c0 + v + carry;
+    c0 = sum; carry = sum >> 8;
+    buf[n++] = v;
+
+    v = (((upper << 4) & 0xc0) | n1) ^ c0;
+    sum = c1 + v + carry;
+    c1 = sum; carry = sum >> 8;
+    buf[n++] = v;
+
+    // the last run only carries two bytes
+    if(n == (int)sizeof(buf)) break;
+
+    int n2 = gcr_at(in, len, pos++);
+    if(n2 < 0) return -1;
+    v = (((upper << 6) & 0xc0) | n2) ^ c1;
+    c2 = c2 + v + carry;
+    buf[n++] = v;
+  }
+
+  int upper = gcr_at(in, len, pos++);
+  int s0 = gcr_at(in, len, pos++);
+  int s1 = gcr_at(in, len, pos++);
+  int s2 = gcr_at(in, len, pos++);
+  if(upper < 0 || s0 < 0 || s1 < 0 || s2 < 0) return -1;
+
+  if(((((upper << 2) & 0xc0) | s0) != c0) ||
+     ((((upper << 4) & 0xc0) | s1) != c1) ||
+     ((((upper << 6) & 0xc0) | s2) != c2))
+    return -1;
+
+  if(in[pos % len] != 0xde || in[(pos+1) % len] != 0xaa)
+    return -1;
+
+  memcpy(out, buf + TAG_SIZE, FLOPPY_SECTOR_SIZE);
+  return 0;
+}
+
+// Decode a circular track of len disk bytes like the Mac reads it.
+// Sectors with valid address and data blocks for the given side and
+// track are stored in sectors and flagged in the found bitmap. Returns
+// the number of sectors found
+int floppy_decode_track(const uint8_t *in, int len, int side, int track,
+			uint8_t *sectors, uint32_t *found) {
+  int spt = floppy_spt(track);
+  int count = 0;
+  *found = 0;
+
+  for(int pos=0;pos<len;pos++) {
+    if(!mark_at(in, len, pos, 0xd5, 0xaa, 0x96))
+      continue;
+
+    // address block: track, sector, side/track hi, format, checksum
+    int a[5];
+    for(int i=0;i<5;i++)
+      if((a[i] = gcr_at(in, len, pos+3+i)) < 0)
+	break;
+    if(a[0] < 0 || a[1] < 0 || a[2] < 0 || a[3] < 0 || a[4] < 0) continue;
+    if((a[0] ^ a[1] ^ a[2] ^ a[3]) != a[4]) continue;
+    if(in[(pos+8) % len] != 0xde || in[(pos+9) % len] != 0xaa) continue;
+
+    int sector = a[1];
+    if((a[0] | ((a[2] & 1) << 6)) != track || ((a[2] >> 5) & 1) != side ||
+       sector >= spt || (*found & (1 << sector)))
+      continue;
+
+    // data block header follows within a few sync bytes
+    int dpos;
+    for(dpos=pos+10;dpos<pos+10+64;dpos++)
+      if(mark_at(in, len, dpos, 0xd5, 0xaa, 0xad))
+	break;
+    if(dpos == pos+10+64 || gcr_at(in, len, dpos+3) != sector)
+      continue;
+
+    if(decode_data(in, len, dpos+4, sectors + sector * FLOPPY_SECTOR_SIZE))
+      continue;
+
+    *found |= 1 << sector;
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,53 @@
+/*
+  floppy.h
+
+  Mac floppy geometry and a bit exact model of the GCR track encoder
+  in src/macplus/floppy_track_codec.v.
+*/
+
+#ifndef FLOPPY_H
+#define FLOPPY_H
+
+#include <cstdint>
+
+#define FLOPPY_TRACKS        80
+#define FLOPPY_MAX_SPT       12     // sectors per track in the outermost zone
+#define FLOPPY_SECTOR_SIZE   512
+#define FLOPPY_MAX_SECTORS   1600   // double sided 800k disk
+#define FLOPPY_SECTOR_BYTES  782    // disk bytes per sector sent by the encoder
+#define FLOPPY_TRACK_BYTES   (FLOPPY_MAX_SPT*FLOPPY_SECTOR_BYTES)
+
+// register state of the read path of floppy_track_codec.v
+struct floppy_codec {
+  uint8_t state;
+  uint16_t count;
+  uint8_t sector;
+  uint16_t src_offset;
+
+  // nibbler
+  uint8_t c1, c2, c3, c2x, c3x;
+  uint8_t cnt;
+  uint8_t nib_xor[3];
+  uint8_t data_latch;
+};
+
+extern int floppy_spt(int track);
+extern int floppy_sides(long size);
+extern int floppy_sectors(int sides);
+extern int floppy_lba(int sides, int side, int track, int sector);
+extern int floppy_chs(int sides, int lba, int *side, int *track, int *sector);
+
+extern uint8_t floppy_gcr_encode(uint8_t val);
+extern int floppy_gcr_decode(uint8_t byte);
+
+extern void floppy_codec_reset(struct floppy_codec *c);
+extern uint16_t floppy_codec_addr(const struct floppy_codec *c);
+extern uint8_t floppy_codec_step(struct floppy_codec *c, int side, int sides,
+				 int track, int spt, uint8_t data);
+
+extern int floppy_encode_track(int sides, int side, int track,
+			       const uint8_t *sectors, uint8_t *out);
+extern int floppy_decode_track(const uint8_t *in, int len, int side, int track,
+			       uint8_t *sectors, uint32_t *found);
+
+#endif // FLOPPY_H
@@ -0,0 +1,132 @@
+/*
+  floppy_check.cpp
+
+  Checks of the floppy track encoding based on the model in floppy.cpp.
+
+  --floppy-check runs the model in lockstep with the track encoder of
+  the internal floppy drive. The model is fed with the same track buffer
+  data and every disk byte is compared against the output of
+  floppy_track_codec.v. This also covers sectors the Mac has written
+  and which haven't been written back to the image yet.
+
+  --floppy-dump=TRACK[/SIDE] encodes a track of the internal floppy
+  image without running the simulation. The result is decoded again
+  and compared with the image to verify the encoder.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+#include "floppy.h"
+
+#define MAX_LOGGED_MISMATCHES  10
+
+static int check_enabled = 0;
+static struct floppy_codec codec;
+static uint64_t checked, mismatches;
+
+void floppy_check_enable(void) {
+  check_enabled = 1;
+  floppy_codec_reset(&codec);
+}
+
+// to be called once per clock
+void floppy_check_tick(Vnanomac_tb *tb, double time) {
+  if(!check_enabled) return;
+
+  if(tb->fdc_rst) {
+    floppy_codec_reset(&codec);
+    return;
+  }
+  if(!tb->fdc_ready) return;
+
+  uint16_t addr = floppy_codec_addr(&codec);
+  uint8_t sector = codec.sector;
+  uint8_t odata = floppy_codec_step(&codec, tb->fdc_side, tb->fdc_sides?2:1,
+				    tb->fdc_track, tb->fdc_spt, tb->fdc_data);
+  checked++;
+
+  if(odata != tb->fdc_odata || addr != tb->fdc_addr) {
+    if(mismatches < MAX_LOGGED_MISMATCHES)
+      printf("%.3fms Floppy check: track %d/%d sector %d: codec %02x @%04x, model %02x @%04x\n",
+	     time*1000, tb->fdc_track, tb->fdc_side, sector,
+	     tb->fdc_odata, tb->fdc_addr, odata, addr);
+    mismatches++;
+  }
+}
+
+// returns 1 if the codec and the model differ
+int floppy_check_report(void) {
+  if(!check_enabled) return 0;
+
+  printf("Floppy check: %llu disk bytes compared, %llu mismatches\n",
+	 (unsigned long long)checked, (unsigned long long)mismatches);
+  return mismatches?1:0;
+}
+
+// hexdump with offsets within the track
+static void dump_bytes(const uint8_t *data, int size, int offset) {
+  for(int i=0;i<size;i++) {
+    if(!(i&15)) printf("%04x: ", offset+i);
+    printf("%02x%s", data[i], ((i&15) == 15 || i == size-1)?"\n":" ");
+  }
+}
+
+// encode, print and verify a track of an image, returns 0 if it decodes
+// to the original sectors
+int floppy_dump(const char *image, const char *spec) {
+  int track = 0, side = 0;
+  if(sscanf(spec, "%d/%d", &track, &side) < 1 ||
+     track < 0 || track >= FLOPPY_TRACKS || side < 0 || side > 1) {
+    printf("Invalid floppy track '%s', expecting TRACK[/SIDE]\n", spec);
+    return -1;
+  }
+
+  FILE *fd = image?fopen(image, "rb"):NULL;
+  if(!fd) { printf("Floppy dump: no floppy image\n"); return -1; }
+
+  fseek(fd, 0, SEEK_END);
+  int sides = floppy_sides(ftell(fd));
+  int spt = floppy_spt(track);
+  int lba = floppy_lba(sides, side, track, 0);
+  if(lba < 0) {
+    printf("Floppy dump: %s is single sided\n", image);
+    fclose(fd);
+    return -1;
+  }
+
+  static uint8_t sectors[FLOPPY_MAX_SPT*FLOPPY_SECTOR_SIZE];
+  static uint8_t decoded[FLOPPY_MAX_SPT*FLOPPY_SECTOR_SIZE];
+  static uint8_t encoded[FLOPPY_TRACK_BYTES];
+
+  fseek(fd, lba * FLOPPY_SECTOR_SIZE, SEEK_SET);
+  if(fread(sectors, FLOPPY_SECTOR_SIZE, spt, fd) != (size_t)spt) {
+    printf("Floppy dump: short read from %s\n", image);
+    fclose(fd);
+    return -1;
+  }
+  fclose(fd);
+
+  int len = floppy_encode_track(sides, side, track, sectors, encoded);
+  printf("Floppy dump: %s track %d side %d, lba %d, %d sectors, %d disk bytes\n",
+	 image, track, side, lba, spt, len);
+
+  // the sector number is the second gcr byte of the address block
+  // which follows the sync bytes and the d5 aa 96 mark
+  for(int i=0;i<spt;i++) {
+    const uint8_t *s = encoded + i * FLOPPY_SECTOR_BYTES;
+    printf("Sector %d:\n", floppy_gcr_decode(s[44+3+1]));
+    dump_bytes(s, FLOPPY_SECTOR_BYTES, i * FLOPPY_SECTOR_BYTES);
+  }
+
+  uint32_t found;
+  int n = floppy_decode_track(encoded, len, side, track, decoded, &found);
+  int ok = (n == spt) && !memcmp(sectors, decoded, spt * FLOPPY_SECTOR_SIZE);
+  printf("Floppy dump: %d of %d sectors decoded%s\n", n, spt,
+	 ok?", data matches image":", data DOESN'T match image");
+
+  return ok?0:1;
+}
@@ -0,0 +1,71 @@
+/*
+  floppybench.cpp
+
+  Benchmark of the floppy track loading. Enabled with --floppy-bench
+  it reports how often and for how long the Mac had to wait for the
+  track buffer. A stall is counted while the motor of the selected
+  drive runs with a disk inserted but the track buffer isn't ready,
+  which is the case after stepping to a track not yet loaded from the
+  SD card. The number of SD card sector requests is reported as well.
+
+  Runs before and after a change of the track loading, e.g. with
+  "make compare" and an RTL define, show its effect on the stalls.
+*/
+
+#include <stdio.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+#include "sim.h"
+
+static int bench_enabled = 0;
+
+static uint32_t stalls;
+static double stall_start = -1;
+static double stall_total, stall_max;
+static uint32_t sd_reads, sd_writes;
+
+void floppybench_enable(void) {
+  bench_enabled = 1;
+}
+
+// to be called once per clock
+void floppybench_tick(struct sim *s) {
+  if(!bench_enabled) return;
+
+  Vnanomac_tb *tb = s->tb;
+  double time = s->time;
+
+  if(tb->fdc_stall && stall_start < 0) {
+    stall_start = time;
+    stalls++;
+  }
+
+  if(!tb->fdc_stall && stall_start >= 0) {
+    double len = time - stall_start;
+    stall_total += len;
+    if(len > stall_max) stall_max = len;
+    stall_start = -1;
+  }
+
+  // sector requests to the sd card
+  if(tb->fdc_sd_rd && !s->floppy_last_rd) sd_reads++;
+  if(tb->fdc_sd_wr && !s->floppy_last_wr) sd_writes++;
+  s->floppy_last_rd = tb->fdc_sd_rd;
+  s->floppy_last_wr = tb->fdc_sd_wr;
+}
+
+void floppybench_report(double time) {
+  if(!bench_enabled) return;
+
+  // a stall still in progress counts up to now
+  if(stall_start >= 0) {
+    double len = time - stall_start;
+    stall_total += len;
+    if(len > stall_max) stall_max = len;
+  }
+
+  printf("Floppy bench: %u stalls, %.3fms total, %.3fms average, %.3fms max\n",
+	 stalls, 1000*stall_total, stalls?1000*stall_total/stalls:0, 1000*stall_max);
+  printf("Floppy bench: %u sector reads, %u sector writes\n", sd_reads, sd_writes);
+}
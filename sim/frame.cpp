@@ -0,0 +1,168 @@
+/*
+  frame.cpp
+
+  Headless frame capture. This collects the video output of the core
+  into a packed 1 bit per pixel raster, independent of any SDL display.
+  Completed frames are used e.g. for golden frame comparison. Frames
+  can be saved and loaded as binary PBM (P4) files.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+#include "frame.h"
+
+// 64 bit FNV-1a
+uint64_t hash64(const void *data, size_t len, uint64_t hash) {
+  const uint8_t *p = (const uint8_t*)data;
+  while(len--) {
+    hash ^= *p++;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void frame_grabber_init(struct frame_grabber *g) {
+  memset(g, 0, sizeof(struct frame_grabber));
+  g->last_hs_n = -1;
+  g->last_vs_n = -1;
+}
+
+// to be called once per pixel clock. Returns 1 if last has just been
+// updated with a complete frame
+int frame_capture(struct frame_grabber *g, struct frame *last, Vnanomac_tb *tb, double time) {
+  int done = 0;
+
+  if(tb->pix && g->sx < FRAME_MAX_W && g->sy < FRAME_MAX_H)
+    g->cur.data[g->sy*FRAME_STRIDE + g->sx/8] |= 0x80 >> (g->sx&7);
+  g->sx++;
+
+  if(tb->hs_n != g->last_hs_n) {
+    g->last_hs_n = tb->hs_n;
+
+    // trigger on rising hs edge
+    if(tb->hs_n) {
+      // all lines of a valid frame have the same length
+      if(g->line_len >= 0) {
+	if(g->line_len == 0)              g->line_len = g->sx;
+	else if(g->line_len != g->sx)     g->line_len = -1;
+      }
+      g->sx = 0;
+      g->sy++;
+    }
+  }
+
+  if(tb->vs_n != g->last_vs_n) {
+    g->last_vs_n = tb->vs_n;
+
+    // trigger on rising vs edge
+    if(tb->vs_n) {
+      if(g->line_len > 0 && g->line_len <= FRAME_MAX_W && g->sy <= FRAME_MAX_H) {
+	// whatever has been drawn into the current line is actually content for line 0
+	memcpy(last, &g->cur, sizeof(struct frame));
+	last->width = g->line_len;
+	last->height = g->sy;
+	last->number = g->number;
+	last->time = time;
+	last->hash = frame_hash(last);
+	done = 1;
+      }
+
+      // keep the partial first line as it belongs to the next frame
+      memmove(g->cur.data, g->cur.data + ((g->sy < FRAME_MAX_H)?g->sy:0)*FRAME_STRIDE, FRAME_STRIDE);
+      memset(g->cur.data + FRAME_STRIDE, 0, sizeof(g->cur.data) - FRAME_STRIDE);
+      g->number++;
+      g->line_len = 0;
+      g->sy = 0;
+    }
+  }
+
+  return done;
+}
+
+uint64_t frame_hash(const struct frame *f) {
+  uint64_t hash = FNV_OFFSET;
+
+  // only hash the visible part of each line
+  for(int y=0;y<f->height;y++) {
+    hash = hash64(f->data + y*FRAME_STRIDE, f->width/8, hash);
+    if(f->width & 7) {
+      uint8_t last = f->data[y*FRAME_STRIDE + f->width/8] & (0xff00 >> (f->width&7));
+      hash = hash64(&last, 1, hash);
+    }
+  }
+  return hash;
+}
+
+int frame_save_pbm(const struct frame *f, const char *name) {
+  FILE *fd = fopen(name, "wb");
+  if(!fd) { perror(name); return -1; }
+
+  // PBM uses 1 for black, the Mac outputs 1 for white
+  fprintf(fd, "P4\n%d %d\n", f->width, f->height);
+  for(int y=0;y<f->height;y++)
+    for(int x=0;x<(f->width+7)/8;x++)
+      fputc(~f->data[y*FRAME_STRIDE + x], fd);
+
+  fclose(fd);
+  return 0;
+}
+
+static int pbm_int(FILE *fd) {
+  int c, v = 0;
+
+  // skip whitespace and comments
+  while((c = fgetc(fd)) != EOF) {
+    if(c == '#') while((c = fgetc(fd)) != EOF && c != '\n');
+    else if(!isspace(c)) break;
+  }
+
+  while(c != EOF && isdigit(c)) {
+    v = 10*v + c - '0';
+    c = fgetc(fd);
+  }
+  return v;
+}
+
+int frame_load_pbm(struct frame *f, const char *name) {
+  FILE *fd = fopen(name, "rb");
+  if(!fd) { perror(name); return -1; }
+
+  char magic[2];
+  if(fread(magic, 1, 2, fd) != 2 || memcmp(magic, "P4", 2)) {
+    printf("%s: not a binary PBM file\n", name);
+    fclose(fd);
+    return -1;
+  }
+
+  memset(f, 0, sizeof(struct frame));
+  f->width = pbm_int(fd);
+  f->height = pbm_int(fd);
+  if(f->width <= 0 || f->width > FRAME_MAX_W || f->height <= 0 || f->height > FRAME_MAX_H) {
+    printf("%s: unsupported size %dx%d\n", name, f->width, f->height);
+    fclose(fd);
+    return -1;
+  }
+
+  for(int y=0;y<f->height;y++) {
+    for(int x=0;x<(f->width+7)/8;x++) {
+      int c = fgetc(fd);
+      if(c == EOF) {
+	printf("%s: truncated\n", name);
+	fclose(fd);
+	return -1;
+      }
+      f->data[y*FRAME_STRIDE + x] = ~c;
+    }
+    // clear padding bits of the last byte
+    if(f->width & 7)
+      f->data[y*FRAME_STRIDE + f->width/8] &= 0xff00 >> (f->width&7);
+  }
+
+  fclose(fd);
+  f->hash = frame_hash(f);
+  return 0;
+}
@@ -0,0 +1,44 @@
+/*
+  frame.h
+
+  Packed 1 bit per pixel video frames as captured by the testbench.
+*/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <cstdint>
+
+class Vnanomac_tb;
+
+// the Mac generates 704x370 including blanking
+#define FRAME_MAX_W   1024
+#define FRAME_MAX_H    512
+#define FRAME_STRIDE  (FRAME_MAX_W/8)
+
+#define FNV_OFFSET    0xcbf29ce484222325ull
+
+struct frame {
+  int width, height;        // size in pixels including blanking
+  uint32_t number;          // frame counter since start of simulation
+  double time;              // simulation time the frame was completed
+  uint64_t hash;            // hash over the visible pixels
+  uint8_t data[FRAME_STRIDE*FRAME_MAX_H];  // msb first, 1 = white
+};
+
+// capture state of a single simulation instance
+struct frame_grabber {
+  struct frame cur;         // frame currently being captured
+  int last_hs_n, last_vs_n;
+  int sx, sy, line_len;
+  uint32_t number;
+};
+
+extern uint64_t hash64(const void *data, size_t len, uint64_t hash);
+extern void frame_grabber_init(struct frame_grabber *g);
+extern int frame_capture(struct frame_grabber *g, struct frame *last, Vnanomac_tb *tb, double time);
+extern uint64_t frame_hash(const struct frame *f);
+extern int frame_save_pbm(const struct frame *f, const char *name);
+extern int frame_load_pbm(struct frame *f, const char *name);
+
+#endif // FRAME_H
@@ -0,0 +1,194 @@
+//
+// fx68k_hybrid.sv
+//
+// Replacement of the fx68k for the hybrid simulation (make hybrid).
+// The instructions are executed by an instruction level 68000 in C++
+// (hybrid68k.cpp). This module only runs the bus cycles requested by
+// it with the timing of the 68000 data sheet, generates E and VMA
+// exactly like the fx68k does and passes the interrupt level.
+//
+
+module fx68k(
+	input clk,
+
+	input extReset,			// External sync reset on emulated system
+	input pwrUp,			// Asserted together with reset on emulated system coldstart
+	input enPhi1, enPhi2,	// Clock enables. Next cycle is PHI1 or PHI2
+
+	output eRWn, output ASn, output LDSn, output UDSn,
+	output logic E, output VMAn,
+
+	// divide the E clock by two
+	input E_div,
+	// Next cycle would be raising/falling edge of E output
+	output E_PosClkEn, E_NegClkEn,
+
+	output FC0, output FC1, output FC2,
+	output BGn,
+	output oRESETn, output oHALTEDn,
+	input DTACKn, input VPAn,
+	input BERRn,
+	input BRn, BGACKn,
+	input IPL0n, input IPL1n, input IPL2n,
+	input [15:0] iEdb, output [15:0] oEdb,
+	output [23:1] eab
+	);
+
+	// request the next bus cycle, returns 0 if the bus stays idle for
+	// one clock, 1 for a bus cycle and 2 if the RESET instruction was
+	// executed. ctrl is the same as in hybrid68k.cpp
+	import "DPI-C" function int hybrid68k_request(input int ipl, output int addr, output int ctrl, output int data);
+	import "DPI-C" function void hybrid68k_done(input int data, input int vpa);
+	import "DPI-C" function void hybrid68k_reset();
+
+	localparam CTRL_READ = 1, CTRL_UDS = 2, CTRL_LDS = 4;
+
+	// bus cycle states S0 to S7, IDLE between cycles
+	localparam IDLE = 4'd8;
+	reg [3:0] state = IDLE;
+
+	reg rASn = 1'b1, rUDSn = 1'b1, rLDSn = 1'b1, rRWn = 1'b1;
+	reg [23:1] rAddr;
+	reg [2:0] rFc;
+	reg [15:0] rData;
+	reg [1:0] rDs;			// UDS/LDS of the current cycle
+	reg rRead, rVpa;
+	reg [6:0] resetCnt;		// RESET instruction drives oRESETn for 124 clocks
+
+	assign eRWn = rRWn;
+	assign ASn = rASn;
+	assign UDSn = rUDSn;
+	assign LDSn = rLDSn;
+	assign { FC2, FC1, FC0 } = rFc;
+	assign eab = rAddr;
+	assign oEdb = rData;
+	assign BGn = 1'b1;
+	assign oHALTEDn = 1'b1;
+	assign oRESETn = (resetCnt == 0);
+
+	wire [2:0] ipl = ~{ IPL2n, IPL1n, IPL0n };
+
+	// E clock and counter, VMA. Same as in the fx68k
+	reg [3:0] eCntr;
+	reg rVma;
+	reg Vpai;
+	reg en_E;
+
+	assign VMAn = rVma;
+
+	// VPA cycles end one cycle before E falling edge
+	wire xVma = ~rVma & (eCntr == 8);
+
+	assign E_PosClkEn = (enPhi2 & (eCntr == 5) & en_E);
+	assign E_NegClkEn = (enPhi2 & (eCntr == 9) & en_E);
+
+	always_ff @( posedge clk) begin
+		if( pwrUp) begin
+			E <= 1'b0;
+			eCntr <='0;
+			rVma <= 1'b1;
+		end
+
+		if( enPhi1) begin
+			if (E_div) en_E <= !en_E; else en_E <= 1'b1;
+			Vpai <= VPAn;
+		end
+
+		if( enPhi2 & en_E) begin
+			if( eCntr == 9)
+				E <= 1'b0;
+			else if( eCntr == 5)
+				E <= 1'b1;
+
+			if( eCntr == 9)
+				eCntr <= '0;
+			else
+				eCntr <= eCntr + 1'b1;
+		end
+
+		if( enPhi2 & ~rASn & ~Vpai & (eCntr == 3))
+			rVma <= 1'b0;
+		else if( enPhi1 & eCntr == '0)
+			rVma <= 1'b1;
+	end
+
+	// bus cycles
+	always_ff @( posedge clk) begin
+		int kind, addr, ctrl, data;
+
+		if( extReset) begin
+			state <= IDLE;
+			rASn <= 1'b1;
+			rUDSn <= 1'b1;
+			rLDSn <= 1'b1;
+			rRWn <= 1'b1;
+			resetCnt <= '0;
+			hybrid68k_reset();
+		end
+		else if( enPhi1) begin
+			case( state)
+			IDLE, 7: begin
+				// end of the previous cycle
+				rRWn <= 1'b1;
+				state <= IDLE;
+
+				if( resetCnt != 0)
+					resetCnt <= resetCnt - 1'd1;
+				else begin
+					kind = hybrid68k_request( { 29'd0, ipl }, addr, ctrl, data);
+					if( kind == 1) begin
+						// S0: function code and address
+						rAddr <= addr[23:1];
+						rFc <= ctrl[6:4];
+						rData <= data[15:0];
+						rRead <= (ctrl & CTRL_READ) != 0;
+						rDs <= { (ctrl & CTRL_UDS) != 0, (ctrl & CTRL_LDS) != 0 };
+						state <= 0;
+					end
+					else if( kind == 2)
+						resetCnt <= 7'd124;
+				end
+			end
+			1: begin
+				// S2: address strobe, data strobes for reads
+				rASn <= 1'b0;
+				if( rRead)
+					{ rUDSn, rLDSn } <= ~rDs;
+				else
+					rRWn <= 1'b0;
+				state <= 2;
+			end
+			3: begin
+				// S4: data strobes for writes
+				if( ~rRead)
+					{ rUDSn, rLDSn } <= ~rDs;
+				state <= 4;
+			end
+			5: state <= 6;
+			default: ;
+			endcase
+		end
+		else if( enPhi2) begin
+			case( state)
+			0: state <= 1;
+			2: state <= 3;
+			4: begin
+				// wait states until DTACK or the end of a VPA cycle
+				rVpa <= ~VPAn;
+				if( ~DTACKn | xVma)
+					state <= 5;
+			end
+			6: begin
+				// S7: latch data and end the cycle
+				rASn <= 1'b1;
+				rUDSn <= 1'b1;
+				rLDSn <= 1'b1;
+				hybrid68k_done( { 16'd0, iEdb }, { 31'd0, rVpa });
+				state <= 7;
+			end
+			default: ;
+			endcase
+		end
+	end
+
+endmodule
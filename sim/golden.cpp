@@ -0,0 +1,271 @@
+/*
+  golden.cpp
+
+  Regression checking against golden references. Three kinds of
+  references are supported:
+
+  - A frame hash timeline as written by --golden-record. Each captured
+    frame is compared by hash against the same frame of the reference
+    run and the first divergent frame is reported.
+  - A target image (PBM) which has to be reached, e.g. the desktop. Each
+    captured frame is compared pixel by pixel and the simulation may stop
+    as soon as a frame matches within the given tolerance.
+  - An audio reference (WAV or raw .s16) which is compared sample by
+    sample while the simulation runs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstdint>
+#include <vector>
+
+#include "frame.h"
+
+// ------------------------------ frame timeline ----------------------------
+
+static FILE *record_fd = NULL;
+
+static std::vector<uint64_t> timeline;          // hash per frame number
+static long timeline_diverged = -1;             // first divergent frame
+static uint32_t timeline_checked = 0;
+
+void golden_record(const char *name) {
+  record_fd = fopen(name, "w");
+  if(!record_fd) { perror(name); exit(-1); }
+  fprintf(record_fd, "# frame time hash\n");
+}
+
+void golden_timeline(const char *name) {
+  FILE *fd = fopen(name, "r");
+  if(!fd) { perror(name); exit(-1); }
+
+  char line[128];
+  while(fgets(line, sizeof(line), fd)) {
+    unsigned long number;
+    double time;
+    unsigned long long hash;
+
+    if(line[0] == '#') continue;
+    if(sscanf(line, "%lu %lf %llx", &number, &time, &hash) != 3) continue;
+    if(number >= timeline.size()) timeline.resize(number+1, 0);
+    timeline[number] = hash;
+  }
+  fclose(fd);
+
+  printf("Golden: loaded %zu frame hashes from %s\n", timeline.size(), name);
+}
+
+// -------------------------------- target image ----------------------------
+
+static struct frame *target = NULL;
+static const char *target_name;
+static int target_tolerance = 0;     // number of pixels allowed to differ
+static int target_block = 0;         // compare 8x8 block brightness instead of pixels
+static int target_best = -1;         // closest match seen so far
+static uint32_t target_best_frame;
+static long target_reached = -1;     // frame number the target was reached in
+
+// spec is "file.pbm[:tolerance][:block]", tolerance and block in any order
+void golden_target(const char *spec) {
+  char *name = strdup(spec);
+  char *p = strchr(name, ':');
+  if(p) {
+    *p++ = 0;
+    for(char *f = strtok(p, ":"); f; f = strtok(NULL, ":")) {
+      char *end;
+      long tol = strtol(f, &end, 10);
+      if(!strcmp(f, "block"))     target_block = 1;
+      else if(!*end && tol >= 0)  target_tolerance = tol;
+      else {
+	printf("Invalid golden target field '%s', expecting a tolerance or block\n", f);
+	exit(-1);
+      }
+    }
+  }
+
+  target = new struct frame;
+  if(frame_load_pbm(target, name)) exit(-1);
+  target_name = name;
+
+  printf("Golden: target %s (%dx%d), tolerance %d %s\n", name, target->width,
+	 target->height, target_tolerance, target_block?"block units":"pixels");
+}
+
+// number of differing pixels
+static int frame_diff_pixels(const struct frame *a, const struct frame *b, int *first_line) {
+  int diff = 0;
+  *first_line = -1;
+
+  for(int y=0;y<a->height;y++) {
+    const uint64_t *pa = (const uint64_t*)(a->data + y*FRAME_STRIDE);
+    const uint64_t *pb = (const uint64_t*)(b->data + y*FRAME_STRIDE);
+    int line_diff = 0;
+
+    for(int x=0;x<(a->width+63)/64;x++)
+      line_diff += __builtin_popcountll(pa[x] ^ pb[x]);
+
+    if(line_diff && *first_line < 0) *first_line = y;
+    diff += line_diff;
+  }
+  return diff;
+}
+
+// "perceptual" difference: dithered areas that are shifted by a few pixels
+// have a similar number of white pixels per 8x8 block. The sum of the
+// differences of the white pixel count in all blocks is returned
+static int frame_diff_blocks(const struct frame *a, const struct frame *b, int *first_line) {
+  int diff = 0;
+  *first_line = -1;
+
+  for(int by=0;by<a->height;by+=8) {
+    for(int bx=0;bx<(a->width+7)/8;bx++) {
+      int ca = 0, cb = 0;
+      for(int y=by;y<by+8 && y<a->height;y++) {
+	ca += __builtin_popcount(a->data[y*FRAME_STRIDE + bx]);
+	cb += __builtin_popcount(b->data[y*FRAME_STRIDE + bx]);
+      }
+      if(ca != cb && *first_line < 0) *first_line = by;
+      diff += (ca > cb)?(ca - cb):(cb - ca);
+    }
+  }
+  return diff;
+}
+
+// --------------------------------- audio ----------------------------------
+
+static std::vector<int16_t> audio_ref;
+static int audio_tolerance = 0;
+static size_t audio_pos = 0;
+static long audio_diverged = -1;
+static int audio_max_error = 0;
+
+// spec is "file.wav[:tolerance]" or "file.s16[:tolerance]"
+void golden_audio(const char *spec) {
+  char *name = strdup(spec);
+  char *p = strchr(name, ':');
+  if(p) {
+    *p++ = 0;
+    audio_tolerance = atoi(p);
+  }
+
+  FILE *fd = fopen(name, "rb");
+  if(!fd) { perror(name); exit(-1); }
+
+  // skip wav header and any chunks before the data chunk
+  uint8_t hdr[12];
+  if(fread(hdr, 1, 12, fd) == 12 && !memcmp(hdr, "RIFF", 4) && !memcmp(hdr+8, "WAVE", 4)) {
+    uint8_t chunk[8];
+    while(fread(chunk, 1, 8, fd) == 8 && memcmp(chunk, "data", 4))
+      fseek(fd, chunk[4] | (chunk[5]<<8) | (chunk[6]<<16) | (chunk[7]<<24), SEEK_CUR);
+  } else
+    fseek(fd, 0, SEEK_SET);
+
+  uint8_t s[2];
+  while(fread(s, 1, 2, fd) == 2)
+    audio_ref.push_back((int16_t)(s[0] | (s[1]<<8)));
+  fclose(fd);
+
+  printf("Golden: loaded %zu audio samples from %s, tolerance %d\n", audio_ref.size(), name, audio_tolerance);
+  free(name);
+}
+
+void golden_audio_sample(int16_t sample, double time) {
+  if(audio_pos >= audio_ref.size()) return;
+
+  int err = abs(sample - audio_ref[audio_pos]);
+  if(err > audio_max_error) audio_max_error = err;
+
+  if(err > audio_tolerance && audio_diverged < 0) {
+    audio_diverged = audio_pos;
+    printf("%.3fms Golden: audio diverges at sample %zu: %d != %d\n",
+	   time*1000, audio_pos, sample, audio_ref[audio_pos]);
+  }
+  audio_pos++;
+}
+
+// --------------------------------------------------------------------------
+
+// called for each completed frame. Returns 1 if the target has been reached
+int golden_frame(const struct frame *f) {
+  if(record_fd)
+    fprintf(record_fd, "%u %.6f %016llx\n", f->number, f->time, (unsigned long long)f->hash);
+
+  if(f->number < timeline.size()) {
+    timeline_checked++;
+    if(timeline[f->number] != f->hash && timeline_diverged < 0) {
+      timeline_diverged = f->number;
+      printf("%.3fms Golden: frame %u diverges from reference (%016llx != %016llx)\n", f->time*1000,
+	     f->number, (unsigned long long)f->hash, (unsigned long long)timeline[f->number]);
+    }
+  }
+
+  if(target && target_reached < 0) {
+    if(f->width != target->width || f->height != target->height)
+      return 0;
+
+    // cheap exact check first
+    if(f->hash == target->hash) {
+      target_reached = f->number;
+    } else {
+      int first_line;
+      int diff = target_block?frame_diff_blocks(f, target, &first_line):
+	frame_diff_pixels(f, target, &first_line);
+
+      if(target_best < 0 || diff < target_best) {
+	target_best = diff;
+	target_best_frame = f->number;
+      }
+
+      if(diff <= target_tolerance) {
+	target_reached = f->number;
+	printf("%.3fms Golden: frame %u matches %s with a difference of %d, first difference in line %d\n",
+	       f->time*1000, f->number, target_name, diff, first_line);
+      }
+    }
+
+    if(target_reached >= 0) {
+      printf("%.3fms Golden: target %s reached in frame %u\n", f->time*1000, target_name, f->number);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// print summary and return the number of failed checks
+int golden_report(void) {
+  int failed = 0;
+
+  if(record_fd) {
+    fclose(record_fd);
+    record_fd = NULL;
+  }
+
+  if(!timeline.empty()) {
+    if(timeline_diverged >= 0) {
+      printf("Golden: frame timeline FAILED, first divergence in frame %ld\n", timeline_diverged);
+      failed++;
+    } else
+      printf("Golden: frame timeline ok, %u frames compared\n", timeline_checked);
+  }
+
+  if(target) {
+    if(target_reached < 0) {
+      printf("Golden: target %s NOT reached", target_name);
+      if(target_best >= 0) printf(", closest was frame %u with a difference of %d", target_best_frame, target_best);
+      printf("\n");
+      failed++;
+    }
+  }
+
+  if(!audio_ref.empty()) {
+    if(audio_diverged >= 0) {
+      printf("Golden: audio FAILED, first divergence at sample %ld, max error %d\n", audio_diverged, audio_max_error);
+      failed++;
+    } else
+      printf("Golden: audio ok, %zu samples compared, max error %d\n", audio_pos, audio_max_error);
+  }
+
+  return failed;
+}
@@ -0,0 +1,41 @@
+/*
+  histogram.cpp
+
+  Histograms of durations in microseconds, see histogram.h.
+*/
+
+#include <stdio.h>
+
+#include "histogram.h"
+
+#define BAR_LEN  40
+
+void hist_add(struct histogram *h, double us) {
+  if(!h->count || us < h->min) h->min = us;
+  if(us > h->max) h->max = us;
+  h->count++;
+  h->total += us;
+
+  int b = 0;
+  while(b < HIST_BUCKETS-1 && us >= (1u << b)) b++;
+  h->bucket[b]++;
+}
+
+// one line per non-empty bucket with a bar scaled to the largest one
+void hist_print(const struct histogram *h) {
+  uint32_t most = 0;
+  for(int b=0;b<HIST_BUCKETS;b++) if(h->bucket[b] > most) most = h->bucket[b];
+
+  for(int b=0;b<HIST_BUCKETS;b++) {
+    if(!h->bucket[b]) continue;
+
+    char range[32];
+    if(!b)                       sprintf(range, "<1us");
+    else if(b == HIST_BUCKETS-1) sprintf(range, ">=%uus", 1u << (b-1));
+    else                         sprintf(range, "%u-%uus", 1u << (b-1), 1u << b);
+
+    printf("  %14s %8u ", range, h->bucket[b]);
+    for(uint32_t i=0;i<(h->bucket[b] * BAR_LEN + most - 1) / most;i++) putchar('#');
+    printf("\n");
+  }
+}
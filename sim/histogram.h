@@ -0,0 +1,24 @@
+/*
+  histogram.h
+
+  Histograms of durations in microseconds with power of two buckets,
+  used by the benchmarks.
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+
+#define HIST_BUCKETS  20      // up to 2^19 us
+
+struct histogram {
+  uint32_t count;
+  double total, min, max;     // in us
+  uint32_t bucket[HIST_BUCKETS];  // bucket n counts < 2^n us
+};
+
+extern void hist_add(struct histogram *h, double us);
+extern void hist_print(const struct histogram *h);
+
+#endif // HISTOGRAM_H
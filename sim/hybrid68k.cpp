@@ -0,0 +1,210 @@
+/*
+  hybrid68k.cpp
+
+  Instruction level 68000 for the hybrid simulation (make hybrid). The
+  cycle exact fx68k dominates the simulation time. The hybrid build
+  replaces it by fx68k_hybrid.sv and the Musashi 68000 emulator while
+  the chipset stays fully simulated. Musashi isn't part of this
+  repository, see README.md.
+
+  Musashi executes a whole instruction at once and expects memory
+  accesses to return immediately. It thus runs in a coroutine of its
+  own. Each access switches back to the simulation, which runs the
+  bus cycle in fx68k_hybrid.sv and resumes the coroutine once the
+  cycle is complete. The cycles of an instruction not spent on the
+  bus are inserted as idle clocks afterwards, so instructions take
+  about as long as on a real 68000.
+*/
+
+#ifdef HYBRID
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstdint>
+#include <ucontext.h>
+
+#include "Vnanomac_tb__Dpi.h"
+
+extern "C" {
+#define MUSASHI_CNF "hybrid68k_conf.h"
+#include "m68k.h"
+}
+
+#define STACK_SIZE  (256*1024)
+
+// bus cycle control as passed to fx68k_hybrid.sv
+#define CTRL_READ   1
+#define CTRL_UDS    2
+#define CTRL_LDS    4
+#define CTRL_FC(a)  ((a)<<4)
+
+static ucontext_t sim_context, cpu_context;
+static char *cpu_stack = NULL;
+
+static int reset_pending = 1;   // restart the cpu on the next request
+static int reset_out = 0;       // RESET instruction executed
+
+// bus cycle requested by the cpu
+static struct {
+  int pending;
+  uint32_t addr;
+  int ctrl;
+  uint16_t data;
+} bus;
+
+static uint16_t bus_data;       // data read by the last cycle
+static int bus_vpa;             // VPA was asserted in the last cycle
+
+static unsigned int fc = 6;     // supervisor program
+static int ipl = 0;
+static int idle = 0;            // clocks until the next bus cycle
+static int cycles_on_bus;       // bus clocks of the current instruction
+
+static uint64_t bus_cycles, idle_clocks;
+
+// run a bus cycle, returns once it has been completed
+static uint16_t bus_cycle(uint32_t addr, int ctrl, uint16_t data) {
+  bus.addr = addr & 0xfffffe;
+  bus.ctrl = ctrl | CTRL_FC(fc);
+  bus.data = data;
+  bus.pending = 1;
+  cycles_on_bus += 4;
+
+  swapcontext(&cpu_context, &sim_context);
+  return bus_data;
+}
+
+extern "C" {
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+  uint16_t d = bus_cycle(address, CTRL_READ | ((address & 1)?CTRL_LDS:CTRL_UDS), 0);
+  return (address & 1)?(d & 0xff):(d >> 8);
+}
+
+unsigned int m68k_read_memory_16(unsigned int address) {
+  return bus_cycle(address, CTRL_READ | CTRL_UDS | CTRL_LDS, 0);
+}
+
+unsigned int m68k_read_memory_32(unsigned int address) {
+  unsigned int hi = m68k_read_memory_16(address);
+  return (hi << 16) | m68k_read_memory_16(address + 2);
+}
+
+void m68k_write_memory_8(unsigned int address, unsigned int value) {
+  // a byte is output on both halves of the data bus
+  bus_cycle(address, (address & 1)?CTRL_LDS:CTRL_UDS, (value & 0xff) * 0x101);
+}
+
+void m68k_write_memory_16(unsigned int address, unsigned int value) {
+  bus_cycle(address, CTRL_UDS | CTRL_LDS, value);
+}
+
+void m68k_write_memory_32(unsigned int address, unsigned int value) {
+  m68k_write_memory_16(address, value >> 16);
+  m68k_write_memory_16(address + 2, value & 0xffff);
+}
+
+// interrupt acknowledge cycle, the level is output on A1-A3
+int hybrid68k_int_ack(int level) {
+  fc = 7;
+  uint16_t vector = bus_cycle(0xfffff0 | (level << 1), CTRL_READ | CTRL_LDS, 0);
+  return bus_vpa?M68K_INT_ACK_AUTOVECTOR:(vector & 0xff);
+}
+
+void hybrid68k_reset_out(void) {
+  reset_out = 1;
+}
+
+void hybrid68k_set_fc(unsigned int new_fc) {
+  fc = new_fc;
+}
+
+}
+
+static void cpu_main(void) {
+  // reads the initial stack pointer and pc over the bus
+  m68k_pulse_reset();
+
+  for(;;) {
+    m68k_set_irq(ipl);
+
+    cycles_on_bus = 0;
+    int cycles = m68k_execute(1);
+
+    // internal cycles, at least one clock if there was no bus cycle at
+    // all, e.g. while stopped, to return to the simulation
+    idle = cycles - cycles_on_bus;
+    if(idle < 1 && !cycles_on_bus) idle = 1;
+    if(idle > 0) swapcontext(&cpu_context, &sim_context);
+  }
+}
+
+static void cpu_start(void) {
+  if(!cpu_stack) {
+    cpu_stack = (char*)malloc(STACK_SIZE);
+    if(!cpu_stack) { printf("Hybrid 68000: out of memory\n"); exit(-1); }
+
+    m68k_init();
+    m68k_set_cpu_type(M68K_CPU_TYPE_68000);
+  }
+
+  getcontext(&cpu_context);
+  cpu_context.uc_stack.ss_sp = cpu_stack;
+  cpu_context.uc_stack.ss_size = STACK_SIZE;
+  cpu_context.uc_link = NULL;
+  makecontext(&cpu_context, cpu_main, 0);
+
+  bus.pending = 0;
+  idle = 0;
+  reset_out = 0;
+  fc = 6;
+}
+
+// called by fx68k_hybrid.sv once per clock while the bus is idle
+int hybrid68k_request(int new_ipl, int *addr, int *ctrl, int *data) {
+  ipl = new_ipl;
+
+  if(reset_pending) {
+    reset_pending = 0;
+    cpu_start();
+  }
+
+  if(idle <= 0 && !bus.pending)
+    swapcontext(&sim_context, &cpu_context);
+
+  if(!bus.pending) {
+    idle--;
+    idle_clocks++;
+
+    if(reset_out) {
+      reset_out = 0;
+      return 2;
+    }
+    return 0;
+  }
+
+  *addr = bus.addr;
+  *ctrl = bus.ctrl;
+  *data = bus.data;
+  return 1;
+}
+
+void hybrid68k_done(int data, int vpa) {
+  bus_data = data;
+  bus_vpa = vpa;
+  bus.pending = 0;
+  bus_cycles++;
+}
+
+void hybrid68k_reset(void) {
+  reset_pending = 1;
+}
+
+void hybrid68k_report(void) {
+  uint64_t clocks = 4*bus_cycles + idle_clocks;
+  printf("Hybrid 68000: %llu bus cycles, %llu idle clocks, bus %.1f%% busy\n",
+	 (unsigned long long)bus_cycles, (unsigned long long)idle_clocks,
+	 clocks?100.0*4*bus_cycles/clocks:0);
+}
+
+#endif // HYBRID
@@ -0,0 +1,77 @@
+/*
+  hybrid68k_conf.h
+
+  Configuration of the Musashi 68000 emulator for the hybrid
+  simulation, used instead of Musashi's m68kconf.h. All memory
+  accesses, interrupt acknowledge cycles and the RESET instruction
+  are passed to hybrid68k.cpp, which runs them on the simulated bus.
+*/
+
+#ifndef M68KCONF__HEADER
+#define M68KCONF__HEADER
+
+#define OPT_OFF             0
+#define OPT_ON              1
+#define OPT_SPECIFY_HANDLER 2
+
+#define M68K_COMPILE_FOR_MAME      OPT_OFF
+
+// the Mac Plus has a plain 68000
+#define M68K_EMULATE_010            OPT_OFF
+#define M68K_EMULATE_EC020          OPT_OFF
+#define M68K_EMULATE_020            OPT_OFF
+#define M68K_EMULATE_030            OPT_OFF
+#define M68K_EMULATE_040            OPT_OFF
+
+// all reads go over the bus
+#define M68K_SEPARATE_READS         OPT_OFF
+#define M68K_SIMULATE_PD_WRITES     OPT_OFF
+
+// interrupt acknowledge cycles are run on the bus, the Mac uses VPA
+// for autovectored interrupts
+#define M68K_EMULATE_INT_ACK        OPT_SPECIFY_HANDLER
+#define M68K_INT_ACK_CALLBACK(A)    hybrid68k_int_ack(A)
+
+#define M68K_EMULATE_BKPT_ACK       OPT_OFF
+#define M68K_BKPT_ACK_CALLBACK()    0
+
+#define M68K_EMULATE_TRACE          OPT_OFF
+
+// the RESET instruction drives the reset output
+#define M68K_EMULATE_RESET          OPT_SPECIFY_HANDLER
+#define M68K_RESET_CALLBACK()       hybrid68k_reset_out()
+
+#define M68K_CMPILD_HAS_CALLBACK    OPT_OFF
+#define M68K_CMPILD_CALLBACK(v,r)   0
+#define M68K_RTE_HAS_CALLBACK       OPT_OFF
+#define M68K_RTE_CALLBACK()         0
+#define M68K_TAS_HAS_CALLBACK       OPT_OFF
+#define M68K_TAS_CALLBACK()         0
+#define M68K_ILLG_HAS_CALLBACK      OPT_OFF
+#define M68K_ILLG_CALLBACK(opcode)  0
+
+// function codes are output on FC0-FC2
+#define M68K_EMULATE_FC             OPT_SPECIFY_HANDLER
+#define M68K_SET_FC_CALLBACK(A)     hybrid68k_set_fc(A)
+
+#define M68K_MONITOR_PC             OPT_OFF
+#define M68K_SET_PC_CALLBACK(A)     0
+#define M68K_INSTRUCTION_HOOK       OPT_OFF
+#define M68K_INSTRUCTION_CALLBACK(pc) 0
+
+// the 68000 prefetch isn't bus cycle exact in Musashi anyway
+#define M68K_EMULATE_PREFETCH       OPT_OFF
+#define M68K_EMULATE_ADDRESS_ERROR  OPT_OFF
+#define M68K_EMULATE_PMMU           OPT_OFF
+
+#define M68K_LOG_ENABLE             OPT_OFF
+#define M68K_LOG_1010_1111_A_LINE   OPT_OFF
+#define M68K_LOG_FILEHANDLE         stdout
+
+#define M68K_USE_64_BIT             OPT_ON
+
+int hybrid68k_int_ack(int level);
+void hybrid68k_reset_out(void);
+void hybrid68k_set_fc(unsigned int fc);
+
+#endif // M68KCONF__HEADER
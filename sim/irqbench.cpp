@@ -0,0 +1,172 @@
+/*
+  irqbench.cpp
+
+  Interrupt latency of the simulated Mac. Enabled with --irq-bench it
+  watches the enabled and pending sources of the VIA and the SCC
+  interrupt:
+
+  - The latency of a source lasts from the moment it becomes pending
+    until the CPU runs the interrupt acknowledge cycle for its level.
+    The CPU delays this while the interrupt is masked in its status
+    register or a higher level handler is running.
+
+  - The handler time lasts from the acknowledge cycle until the RTE of
+    the handler, see irqhandler.cpp. The level is taken from A3-A1 of
+    the acknowledge cycle. Handlers of a higher level running meanwhile
+    are included in the time.
+
+  Sources cleared without an acknowledge, e.g. by polling or because
+  they were disabled, are counted separately.
+
+  For the VBL (VIA CA1) the period between consecutive acknowledge
+  cycles is reported as well. Its spread is the jitter a VBL driven
+  replay routine like NanoMacTracker sees.
+*/
+
+#include <stdio.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+#include "histogram.h"
+#include "irqhandler.h"
+
+#define SOURCES   8
+#define VBL       1     // VIA CA1
+#define SCC       7
+
+#define FC_IACK     7
+
+// interrupt level of the sources, see dataController.sv
+#define VIA_LEVEL 1
+#define SCC_LEVEL 2
+
+static const char *source_name[SOURCES] = {
+  "VIA CA2 (one second)", "VIA CA1 (VBL)", "VIA SR (keyboard)", "VIA CB2",
+  "VIA CB1", "VIA timer 2", "VIA timer 1", "SCC" };
+
+static struct source {
+  double pending;             // time it became pending or -1
+  double acked;               // time of the acknowledge or -1
+  struct histogram latency;
+  struct histogram handler;
+  uint32_t unserviced;        // cleared without acknowledge
+} sources[SOURCES];
+
+static int bench_enabled = 0;
+
+// running handlers, tagged with the sources they acknowledged
+static struct irq_handlers handlers;
+
+// VBL period
+static double last_vbl = -1;
+static uint32_t vbl_periods;
+static double vbl_total, vbl_min, vbl_max;
+
+void irqbench_enable(void) {
+  bench_enabled = 1;
+  for(int s=0;s<SOURCES;s++) sources[s].pending = sources[s].acked = -1;
+}
+
+// returns the sources acknowledged
+static uint8_t acknowledge(int level, double time) {
+  uint8_t acked = 0;
+
+  for(int s=0;s<SOURCES;s++) {
+    struct source *src = &sources[s];
+    if(src->pending < 0 || src->acked >= 0) continue;
+    if(level != ((s == SCC)?SCC_LEVEL:VIA_LEVEL)) continue;
+
+    src->acked = time;
+    acked |= 1<<s;
+    hist_add(&src->latency, 1e6 * (time - src->pending));
+
+    if(s == VBL) {
+      if(last_vbl >= 0) {
+	double period = time - last_vbl;
+	if(!vbl_periods || period < vbl_min) vbl_min = period;
+	if(period > vbl_max) vbl_max = period;
+	vbl_total += period;
+	vbl_periods++;
+      }
+      last_vbl = time;
+    }
+  }
+  return acked;
+}
+
+// to be called once per clock
+void irqbench_tick(Vnanomac_tb *tb, double time) {
+  static int last_active = 0;
+  static int last_as_n = 1;
+
+  if(!bench_enabled) return;
+
+  int active = (tb->via_irq & 0x7f) | (tb->scc_irq?(1<<SCC):0);
+
+  // newly pending sources
+  for(int s=0;s<SOURCES;s++)
+    if(active & ~last_active & (1<<s)) {
+      sources[s].pending = time;
+      sources[s].acked = -1;
+    }
+
+  // start of a bus cycle, cpu_addr holds A23-A1
+  if(last_as_n && !tb->cpu_as_n) {
+    uint8_t acked = (tb->cpu_fc == FC_IACK)?acknowledge(tb->cpu_addr & 7, time):0;
+
+    struct irq_handler done;
+    if(irqh_bus_cycle(&handlers, tb->cpu_fc, tb->cpu_rw, tb->cpu_addr << 1, time, acked, &done))
+      for(int s=0;s<SOURCES;s++)
+	if(done.tag & (1<<s))
+	  hist_add(&sources[s].handler, 1e6 * (time - done.acked));
+  }
+  last_as_n = tb->cpu_as_n;
+
+  // sources released by their handler
+  for(int s=0;s<SOURCES;s++)
+    if(last_active & ~active & (1<<s)) {
+      struct source *src = &sources[s];
+      if(src->acked < 0) src->unserviced++;
+      src->pending = src->acked = -1;
+    }
+
+  last_active = active;
+}
+
+void irqbench_report(void) {
+  if(!bench_enabled) return;
+
+  int any = 0;
+  for(int s=0;s<SOURCES;s++) {
+    struct source *src = &sources[s];
+    if(!src->latency.count && !src->unserviced) continue;
+    any = 1;
+
+    printf("IRQ bench: %s, %u interrupts, %u cleared without interrupt\n",
+	   source_name[s], src->latency.count, src->unserviced);
+    if(!src->latency.count) continue;
+
+    printf("IRQ bench: %s latency avg %.1fus, min %.1fus, max %.1fus\n", source_name[s],
+	   src->latency.total / src->latency.count, src->latency.min, src->latency.max);
+    hist_print(&src->latency);
+
+    if(src->handler.count) {
+      printf("IRQ bench: %s handler avg %.1fus, min %.1fus, max %.1fus\n", source_name[s],
+	     src->handler.total / src->handler.count, src->handler.min, src->handler.max);
+      hist_print(&src->handler);
+    }
+  }
+
+  if(!any) {
+    printf("IRQ bench: no interrupts\n");
+    return;
+  }
+
+  if(handlers.no_frame)
+    printf("IRQ bench: %u handlers without exception frame, not timed\n", handlers.no_frame);
+
+  if(vbl_periods)
+    printf("IRQ bench: VBL period avg %.3fms, min %.3fms, max %.3fms, jitter %.1fus\n",
+	   1000 * vbl_total / vbl_periods, 1000 * vbl_min, 1000 * vbl_max,
+	   1e6 * (vbl_max - vbl_min));
+}
@@ -0,0 +1,83 @@
+/*
+  irqhandler.cpp
+
+  Interrupt handlers are timed from the interrupt acknowledge cycle of
+  the CPU until the RTE of the handler. The exception frame is found
+  among the last supervisor writes once the handler's first opcode is
+  fetched: the SR at the lowest address followed by both words of the
+  PC. The handler has returned when all three words have been read back
+  again. Handlers of a higher level running meanwhile are included in
+  its time and reported with a depth above 0.
+*/
+
+#include "irqhandler.h"
+
+#define FC_PROGRAM  6   // supervisor program
+#define FC_DATA     5   // supervisor data
+#define FC_IACK     7
+
+static int written(const struct irq_handlers *h, uint32_t addr) {
+  for(int i=0;i<IRQH_WRITES;i++)
+    if(h->writes[i] == addr) return 1;
+  return 0;
+}
+
+// first opcode fetch of the handler, find its exception frame
+static void handler_start(struct irq_handlers *h) {
+  h->entering = 0;
+
+  uint32_t frame = 0;
+  for(int i=0;i<IRQH_WRITES;i++) {
+    uint32_t a = h->writes[(h->write_idx - 1 - i) & (IRQH_WRITES-1)];
+    if(a && written(h, a+2) && written(h, a+4)) { frame = a; break; }
+  }
+
+  if(!frame || h->depth == IRQH_NESTING) {
+    h->no_frame++;
+    return;
+  }
+
+  struct irq_handler *r = &h->running[h->depth];
+  r->frame = frame;
+  r->tag = h->entering_tag;
+  r->restored = 0;
+  r->acked = h->entering_time;
+  r->depth = h->depth++;
+}
+
+// supervisor data read, possibly by the RTE of a handler
+static int frame_read(struct irq_handlers *h, uint32_t addr, struct irq_handler *done) {
+  for(int i=h->depth-1;i>=0;i--) {
+    struct irq_handler *r = &h->running[i];
+    if(addr < r->frame || addr > r->frame+4) continue;
+
+    r->restored |= 1 << ((addr - r->frame) / 2);
+    if(r->restored != 7) return 0;
+
+    // handlers above it can't be running anymore
+    *done = *r;
+    h->depth = i;
+    return 1;
+  }
+  return 0;
+}
+
+// to be called at the start of each bus cycle with the byte address.
+// tag is stored with an acknowledge cycle. Returns 1 and fills done
+// when a handler has returned
+int irqh_bus_cycle(struct irq_handlers *h, int fc, int rw, uint32_t addr,
+		   double time, uint32_t tag, struct irq_handler *done) {
+  if(fc == FC_IACK) {
+    h->entering = 1;
+    h->entering_tag = tag;
+    h->entering_time = time;
+  } else if(fc == FC_PROGRAM && h->entering)
+    handler_start(h);
+  else if(fc == FC_DATA && !rw) {
+    h->writes[h->write_idx] = addr;
+    h->write_idx = (h->write_idx + 1) & (IRQH_WRITES-1);
+  } else if(fc == FC_DATA && h->depth)
+    return frame_read(h, addr, done);
+
+  return 0;
+}
@@ -0,0 +1,41 @@
+/*
+  irqhandler.h
+
+  Tracking of 68000 interrupt handlers from their acknowledge cycle
+  until their RTE, used by the benchmarks.
+*/
+
+#ifndef IRQHANDLER_H
+#define IRQHANDLER_H
+
+#include <cstdint>
+
+#define IRQH_WRITES   4     // supervisor writes kept to find the frame
+#define IRQH_NESTING  8     // running handlers
+
+// a handler that has returned
+struct irq_handler {
+  uint32_t frame;           // address of the stacked SR
+  uint32_t tag;             // given with the acknowledge, e.g. the sources
+  uint8_t restored;         // words of the frame read back
+  double acked;             // time of the acknowledge cycle
+  int depth;                // 0 for a handler not interrupting another one
+};
+
+struct irq_handlers {
+  int entering;             // acknowledged, first opcode not yet fetched
+  uint32_t entering_tag;
+  double entering_time;
+
+  uint32_t writes[IRQH_WRITES];
+  int write_idx;
+
+  struct irq_handler running[IRQH_NESTING];  // innermost last
+  int depth;
+  uint32_t no_frame;        // handlers whose frame wasn't found
+};
+
+extern int irqh_bus_cycle(struct irq_handlers *h, int fc, int rw, uint32_t addr,
+			  double time, uint32_t tag, struct irq_handler *done);
+
+#endif // IRQHANDLER_H
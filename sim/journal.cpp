@@ -0,0 +1,208 @@
+/*
+  journal.cpp
+
+  Input journal of the main instance. All inputs the testbench drives
+  into the core are sampled once per clock: reset, the serial rxd, the
+  keyboard strobe and data, the size and mount signals of the disk
+  images and the command and data lines of the sd card.
+
+  --journal-record=FILE writes every change of them together with its
+  clock cycle into FILE. --journal-replay=FILE drives them from such a
+  journal instead, overriding whatever the uart, keyboard and sd card
+  models produce in the same cycle. A replayed run thus sees exactly
+  the same input as the recorded one, no matter what was typed into
+  the serial console or which disk images are present, which keeps
+  before/after benchmarks of RTL changes comparable. The mouse isn't
+  driven by the testbench and thus not part of the journal.
+
+  The file starts with the magic "NMJRNL1" and a zero byte, followed by
+  one record per change:
+
+    varint   clock cycles since the previous record
+    uint8_t  mask of the inputs that changed, see inputs[] below
+    varint   new value of each changed input, lowest bit first
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+
+#define JOURNAL_MAGIC  "NMJRNL1"
+#define INPUTS         8
+
+static const char *inputs[INPUTS] = {
+  "reset", "uart_rxd", "kbd_strobe", "kbd_data",
+  "image_size", "image_mounted", "sdcmd_in", "sddat_in" };
+
+static FILE *record_fd = NULL;
+static FILE *replay_fd = NULL;
+static const char *journal_name;
+
+static uint64_t cycle;
+static uint64_t last_cycle;        // of the previous record
+static uint32_t value[INPUTS];     // as recorded or replayed
+static uint32_t changes[INPUTS];
+static uint32_t records;
+
+// next record to be replayed
+static uint64_t next_cycle;
+static uint32_t next_value[INPUTS];
+static uint8_t next_mask;
+static int replay_end = 0;
+
+static void put_varint(uint64_t v) {
+  while(v >= 0x80) {
+    fputc((v & 0x7f) | 0x80, record_fd);
+    v >>= 7;
+  }
+  fputc(v, record_fd);
+}
+
+static int get_varint(uint64_t *v) {
+  int c, shift = 0;
+  *v = 0;
+  do {
+    if((c = fgetc(replay_fd)) == EOF) return -1;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while(c & 0x80);
+  return 0;
+}
+
+static FILE *journal_open(const char *name, const char *mode) {
+  if(record_fd || replay_fd) {
+    printf("Only one of --journal-record and --journal-replay can be given\n");
+    exit(-1);
+  }
+
+  FILE *fd = fopen(name, mode);
+  if(!fd) { perror(name); exit(-1); }
+  journal_name = name;
+  return fd;
+}
+
+void journal_record(const char *name) {
+  record_fd = journal_open(name, "wb");
+  fwrite(JOURNAL_MAGIC, 8, 1, record_fd);
+}
+
+// fetch the next record, sets replay_end at the end of the journal
+static void journal_next(void) {
+  uint64_t delta, v;
+  int mask;
+
+  if(get_varint(&delta) || (mask = fgetc(replay_fd)) == EOF) {
+    replay_end = 1;
+    return;
+  }
+
+  next_cycle += delta;
+  next_mask = mask;
+  for(int i=0;i<INPUTS;i++) {
+    if(!(mask & (1<<i))) continue;
+    if(get_varint(&v)) {
+      printf("Journal: %s is truncated\n", journal_name);
+      replay_end = 1;
+      return;
+    }
+    next_value[i] = v;
+  }
+}
+
+void journal_replay(const char *name) {
+  replay_fd = journal_open(name, "rb");
+
+  char magic[8];
+  if(fread(magic, 8, 1, replay_fd) != 1 || memcmp(magic, JOURNAL_MAGIC, 8)) {
+    printf("%s is not an input journal\n", name);
+    exit(-1);
+  }
+  journal_next();
+  printf("Journal: replaying inputs from %s\n", name);
+}
+
+static void sample(const Vnanomac_tb *tb, uint32_t *v) {
+  v[0] = tb->reset;
+  v[1] = tb->uart_rxd;
+  v[2] = tb->kbd_strobe;
+  v[3] = tb->kbd_data;
+  v[4] = tb->image_size;
+  v[5] = tb->image_mounted;
+  v[6] = tb->sdcmd_in;
+  v[7] = tb->sddat_in;
+}
+
+static void drive(Vnanomac_tb *tb, const uint32_t *v) {
+  tb->reset = v[0];
+  tb->uart_rxd = v[1];
+  tb->kbd_strobe = v[2];
+  tb->kbd_data = v[3];
+  tb->image_size = v[4];
+  tb->image_mounted = v[5];
+  tb->sdcmd_in = v[6];
+  tb->sddat_in = v[7];
+}
+
+// to be called once per clock after all inputs have been set
+void journal_tick(Vnanomac_tb *tb, double time) {
+  if(record_fd) {
+    uint32_t v[INPUTS];
+    sample(tb, v);
+
+    uint8_t mask = 0;
+    for(int i=0;i<INPUTS;i++)
+      if(!cycle || v[i] != value[i]) mask |= 1<<i;
+
+    if(mask) {
+      put_varint(cycle - last_cycle);
+      fputc(mask, record_fd);
+      for(int i=0;i<INPUTS;i++)
+	if(mask & (1<<i)) {
+	  put_varint(v[i]);
+	  value[i] = v[i];
+	  changes[i]++;
+	}
+      last_cycle = cycle;
+      records++;
+    }
+  }
+
+  if(replay_fd) {
+    if(!replay_end && cycle == next_cycle) {
+      for(int i=0;i<INPUTS;i++)
+	if(next_mask & (1<<i)) {
+	  value[i] = next_value[i];
+	  changes[i]++;
+	}
+      records++;
+      journal_next();
+      if(replay_end) printf("%.3fms Journal: end of journal, inputs stay unchanged\n", time*1000);
+    }
+    drive(tb, value);
+  }
+
+  cycle++;
+}
+
+void journal_report(void) {
+  if(!record_fd && !replay_fd) return;
+
+  printf("Journal: %s %u records over %llu cycles:", record_fd?"recorded":"replayed",
+	 records, (unsigned long long)cycle);
+  for(int i=0;i<INPUTS;i++)
+    if(changes[i]) printf(" %s %u", inputs[i], changes[i]);
+  printf("\n");
+
+  if(record_fd) {
+    printf("Journal: %ld bytes written to %s\n", ftell(record_fd), journal_name);
+    fclose(record_fd);
+  }
+  if(replay_fd) {
+    if(!replay_end) printf("Journal: run ended before the end of %s\n", journal_name);
+    fclose(replay_fd);
+  }
+  record_fd = replay_fd = NULL;
+}
@@ -0,0 +1,113 @@
+/*
+  live.cpp
+
+  Live view of headless runs. With --live[=NAME] the simulation
+  publishes each completed frame together with the simulated time,
+  the LEDs and its speed in the POSIX shared memory segment /NAME
+  (default /nanomac-PID). The status is also published every
+  LIVE_INTERVAL of simulated time, so it keeps moving while the video
+  is off or no frame completes. The layout is described in live.h.
+
+  Readers map the segment and read it in place, nothing is written
+  to disk:
+
+  $ ./nanomac_fast --live=mac1 &
+  $ ./live_monitor mac1
+  $ ./live_monitor mac1 frame.pbm
+
+  The segment is removed when the simulation ends.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "live.h"
+
+#define LIVE_INTERVAL  0.01      // status update without frame, in seconds
+
+static struct live_status *live = NULL;
+static char live_name[64];
+static struct timespec start;
+static double next_status;
+
+static uint64_t elapsed_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) * 1000ull + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+void live_open(const char *name) {
+  if(name) snprintf(live_name, sizeof(live_name), "/%s", name);
+  else     snprintf(live_name, sizeof(live_name), "/nanomac-%d", (int)getpid());
+
+  int fd = shm_open(live_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if(fd < 0) { perror("Live: shm_open"); exit(-1); }
+
+  if(ftruncate(fd, LIVE_SIZE) < 0) { perror("Live: ftruncate"); exit(-1); }
+
+  live = (struct live_status*)mmap(NULL, LIVE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(live == MAP_FAILED) { perror("Live: mmap"); exit(-1); }
+
+  live->pid = getpid();
+  live->version = LIVE_VERSION;
+  __atomic_store_n(&live->magic, LIVE_MAGIC, __ATOMIC_RELEASE);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  printf("Live: publishing frames in shared memory %s\n", live_name);
+}
+
+static void live_begin(void) {
+  __atomic_store_n(&live->seq, live->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void live_end(double time, int leds) {
+  live->time = time;
+  live->leds = leds;
+  live->real_ms = elapsed_ms();
+  live->speed = (time > 0)?live->real_ms/(1000*time):0;
+
+  __atomic_store_n(&live->seq, live->seq + 1, __ATOMIC_RELEASE);
+  next_status = time + LIVE_INTERVAL;
+}
+
+// to be called once per clock, publishes the status if no frame
+// has done so for LIVE_INTERVAL
+void live_tick(double time, int leds) {
+  if(!live || time < next_status) return;
+
+  live_begin();
+  live_end(time, leds);
+}
+
+// to be called for every completed frame
+void live_frame(const struct frame *f, int leds, double time) {
+  if(!live) return;
+
+  live_begin();
+  live->frames++;
+  live->number = f->number;
+  live->width = f->width;
+  live->height = f->height;
+  live->hash = f->hash;
+  memcpy(live->data, f->data, FRAME_STRIDE * f->height);
+  live_end(time, leds);
+}
+
+void live_close(double time, int leds) {
+  if(!live) return;
+
+  live_begin();
+  live->stopped = 1;
+  live_end(time, leds);
+
+  munmap(live, LIVE_SIZE);
+  shm_unlink(live_name);
+  live = NULL;
+}
@@ -0,0 +1,50 @@
+/*
+  live.h
+
+  Layout of the shared memory segment a running simulation publishes
+  its current frame and status in (--live). Other processes can map
+  it read only, see live_monitor.cpp.
+
+  The segment is protected by a sequence lock. The simulation makes
+  seq odd before and even again after updating it. A reader copies
+  what it needs and retries if seq was odd or changed meanwhile:
+
+    do {
+      s = __atomic_load_n(&l->seq, __ATOMIC_ACQUIRE);
+      ... copy ...
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while((s & 1) || s != __atomic_load_n(&l->seq, __ATOMIC_RELAXED));
+*/
+
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <cstdint>
+
+#include "frame.h"
+
+#define LIVE_MAGIC    0x4e4d4c56   // "NMLV"
+#define LIVE_VERSION  1
+
+struct live_status {
+  uint32_t magic, version;
+  uint32_t seq;             // sequence lock, odd while being updated
+  uint32_t pid;             // of the simulation
+
+  double time;              // simulated time in seconds
+  uint64_t real_ms;         // real time since start of the simulation
+  double speed;             // real time per simulated time
+  uint32_t leds;            // as in tb->leds
+  uint32_t stopped;         // the simulation has ended
+
+  // current frame, 1 bit per pixel as in struct frame
+  uint32_t frames;          // frames published so far
+  uint32_t number;          // frame counter of the simulation
+  int32_t width, height;
+  uint64_t hash;
+  uint8_t data[FRAME_STRIDE*FRAME_MAX_H];
+};
+
+#define LIVE_SIZE  sizeof(struct live_status)
+
+#endif // LIVE_H
@@ -0,0 +1,88 @@
+/*
+  live_monitor.cpp
+
+  Attaches to a simulation running with --live=NAME and prints its
+  status once per second until it ends. With a file name the current
+  frame is saved as PBM image instead.
+
+  $ ./live_monitor NAME [FRAME.pbm]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "live.h"
+
+static struct live_status copy;
+
+// take a consistent snapshot of the segment
+static void snapshot(const struct live_status *l) {
+  uint32_t s;
+  do {
+    s = __atomic_load_n(&l->seq, __ATOMIC_ACQUIRE);
+    memcpy(&copy, l, LIVE_SIZE);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while((s & 1) || s != __atomic_load_n(&l->seq, __ATOMIC_RELAXED));
+}
+
+static int save_pbm(const char *name) {
+  FILE *fd = fopen(name, "wb");
+  if(!fd) { perror(name); return -1; }
+
+  // PBM uses 1 for black, the Mac outputs 1 for white
+  fprintf(fd, "P4\n%d %d\n", copy.width, copy.height);
+  for(int y=0;y<copy.height;y++)
+    for(int x=0;x<(copy.width+7)/8;x++)
+      fputc(~copy.data[y*FRAME_STRIDE + x], fd);
+
+  fclose(fd);
+  printf("Frame %u saved as %s\n", copy.number, name);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if(argc < 2) {
+    printf("Usage: %s NAME [FRAME.pbm]\n", argv[0]);
+    return -1;
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "/%s", argv[1]);
+  int fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0) { perror(name); return -1; }
+
+  const struct live_status *l = (const struct live_status*)
+    mmap(NULL, LIVE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(l == MAP_FAILED) { perror("mmap"); return -1; }
+
+  if(__atomic_load_n(&l->magic, __ATOMIC_ACQUIRE) != LIVE_MAGIC || l->version != LIVE_VERSION) {
+    printf("%s is not a simulation status of this version\n", name);
+    return -1;
+  }
+
+  if(argc > 2) {
+    snapshot(l);
+    return save_pbm(argv[2])?-1:0;
+  }
+
+  do {
+    snapshot(l);
+    char leds[6];
+    for(int i=0;i<5;i++) leds[i] = (copy.leds&(0x10>>i))?'*':'-';
+    leds[5] = 0;
+
+    printf("pid %u: %.3fms, %llums real time, speed factor %.0f, LEDs %s, frame %u %dx%d hash %016llx\n",
+	   copy.pid, 1000*copy.time, (unsigned long long)copy.real_ms, copy.speed, leds,
+	   copy.number, copy.width, copy.height, (unsigned long long)copy.hash);
+    fflush(stdout);
+    if(!copy.stopped) sleep(1);
+  } while(!copy.stopped);
+
+  printf("Simulation has ended\n");
+  return 0;
+}
@@ -6,28 +6,137 @@
   
 #ifdef VIDEO
 #include <SDL.h>
-#include <SDL_image.h>
+#include "display.h"
 #endif
  
+#include <getopt.h>
+#include <sys/resource.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
 #include "Vnanomac_tb.h"
 #include "verilated.h"
+#ifdef TRACE
 #include "verilated_fst_c.h"
+#endif
+
+#include "frame.h"
+#include "stop.h"
+#include "sim.h"
 
-static Vnanomac_tb *tb;
+// the instance with video, audio, checks etc
+static struct sim *main_sim;
+#ifdef TRACE
 static VerilatedFstC *trace;
-static double simulation_time;
+#endif
+
+// number of additional headless instances
+static int instances = 0;
+
+extern void sd_open_images(void);
+extern void sd_init(struct sd_card *sd, int quiet);
+extern void sd_free(struct sd_card *sd);
+extern void sd_handle(struct sd_card *sd, float ms, Vnanomac_tb *tb);
+extern void sd_set_image(int drive, const char *name);
+extern const char *sd_get_image(int drive);
+
+extern void audio_open(const char *name, int resample_rate);
+extern int16_t audio_sample(uint16_t value);
+extern void audio_close(void);
+
+extern void golden_record(const char *name);
+extern void golden_timeline(const char *name);
+extern void golden_target(const char *spec);
+extern void golden_audio(const char *spec);
+extern void golden_audio_sample(int16_t sample, double time);
+extern int golden_frame(const struct frame *f);
+extern int golden_report(void);
+
+extern void uart_tx(int txd, double time);
+extern int uart_rx(double time);
+extern void uart_set_baud(const char *arg);
+extern void uart_set_log(const char *name);
+extern void uart_set_input(const char *src);
+extern void uart_open_pty(void);
+extern void uart_close(void);
+
+extern void rompatch_select(const char *names);
+extern void rompatch_apply(uint16_t *rom, size_t words);
+extern void rompatch_ref(const char *name, int ram_size);
+
+extern void sndbench_enable(const char *arg, int ram_size);
+extern void sndbench_tick(Vnanomac_tb *tb, double time);
+extern int sndbench_report(void);
+
+extern void floppy_check_enable(void);
+extern void floppy_check_tick(Vnanomac_tb *tb, double time);
+extern int floppy_check_report(void);
+extern int floppy_dump(const char *image, const char *spec);
+static const char *floppy_dump_track = NULL;
+
+extern void floppybench_enable(void);
+extern void floppybench_tick(struct sim *s);
+extern void floppybench_report(double time);
+
+extern void scsibench_enable(void);
+extern void scsibench_tick(Vnanomac_tb *tb, double time);
+extern void scsibench_report(double time);
+
+extern void storagebench_enable(void);
+extern void storagebench_tick(Vnanomac_tb *tb, double time);
+extern void storagebench_report(double time);
+
+extern void irqbench_enable(void);
+extern void irqbench_tick(Vnanomac_tb *tb, double time);
+extern void irqbench_report(void);
+
+extern void state_record(const char *spec, int ram_size);
+extern void state_compare(const char *name, int ram_size);
+extern void state_audio_sample(int16_t sample);
+extern void state_tick(struct sim *s);
+extern int state_report(void);
+extern int state_diff(const char *spec);
+static const char *state_diff_files = NULL;
+
+extern void snapshot_add(const char *spec, int ram_size);
+extern void snapshot_tick(const struct sim *s);
+extern void snapshot_frame(const struct sim *s, const struct frame *f);
+extern void snapshot_end(const struct sim *s);
+extern int snapshot_diff(const char *spec);
+static const char *snapshot_diff_files = NULL;
+
+extern void journal_record(const char *name);
+extern void journal_replay(const char *name);
+extern void journal_tick(Vnanomac_tb *tb, double time);
+extern void journal_report(void);
+
+extern void live_open(const char *name);
+extern void live_frame(const struct frame *f, int leds, double time);
+extern void live_tick(double time, int leds);
+extern void live_close(double time, int leds);
+
+#ifdef HYBRID
+extern void hybrid68k_report(void);
+#endif
 
-extern void sd_handle(float ms, Vnanomac_tb *tb);
+// save a single frame as pbm, e.g. to create a golden target image
+static long save_frame = -1;
+static const char *save_frame_name = NULL;
 
-#define ROM "plusrom.bin"
+static const char *rom_file = "plusrom.bin";
 
 #define RAM_SIZE 0    // 0=128k, 1=512k, 2=1MB, 3=4MB
 
+static int mem_mode = MEM_CHECK;
+
 #define TICKLEN   (0.5/16000000)
 
 // #define DEBUG_MEM
 
+// traces are only written by the debug build (make trace), see Makefile
 // times with 128k ram, 512k delays everything by 2.7 seconds
+#ifdef TRACE
 // #define TRACESTART 0.0
 // #define TRACESTART 1.9   // kbd model cmd and first iwm access
 // #define TRACESTART 2.2   // checkerboard, kbd  inquiry cmd, first SCSI
@@ -43,127 +152,19 @@ extern void sd_handle(float ms, Vnanomac_tb *tb);
 #ifdef TRACESTART
 #define TRACEEND     (TRACESTART + 0.2)
 #endif
-
-// floppy disk lba to side/track/sector translation table
-int fdc_map[2][1600][3];
-
-char *sector_string(int drive, uint32_t lba) {
-  static char str[32];
-
-  if(drive < 2) {  
-    if(lba >= 1600)
-      sprintf(str, "<out of range %u>", lba);
-    else
-      sprintf(str, "CHS %d/%d/%d",
-	      fdc_map[1][lba][1],fdc_map[1][lba][0],fdc_map[1][lba][2]);
-    
-    return str;
-  }
-
-  strcpy(str, "");
-  return str;
-}
+#endif // TRACE
 
 /* =============================== video =================================== */
 
 #ifdef VIDEO
-FILE *ad = NULL;
-
-#define MAX_H_RES   2048
-#define MAX_V_RES   1024
+#define MAX_H_RES   DISPLAY_MAX_W
+#define MAX_V_RES   DISPLAY_MAX_H
 
-SDL_Window*   sdl_window   = NULL;
-SDL_Renderer* sdl_renderer = NULL;
-SDL_Texture*  sdl_texture  = NULL;
 int sdl_cancelled = 0;
 
-typedef struct Pixel {  // for SDL texture
-    uint8_t a;  // transparency
-    uint8_t b;  // blue
-    uint8_t g;  // green
-    uint8_t r;  // red
-} Pixel;
-
-#define SCALE 1
 Pixel screenbuffer[MAX_H_RES*MAX_V_RES];
 
-/*
-  Mac video = 512x342, physical 704x370€60Hz -> 15.664 MHz pixel clock 
- */
-
-void init_video(void) {
-  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-    printf("SDL init failed.\n");
-    return;
-  }
-
-  sdl_window = SDL_CreateWindow("NanoMac", SDL_WINDOWPOS_CENTERED,
-        SDL_WINDOWPOS_CENTERED, SCALE*704, SCALE*370, SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
-  if (!sdl_window) {
-    printf("Window creation failed: %s\n", SDL_GetError());
-    return;
-  }
-  
-  sdl_renderer = SDL_CreateRenderer(sdl_window, -1,
-            SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-  if (!sdl_renderer) {
-    printf("Renderer creation failed: %s\n", SDL_GetError());
-    return;
-  }
-}
-
-// https://stackoverflow.com/questions/34255820/save-sdl-texture-to-file
-void save_texture(SDL_Renderer *ren, SDL_Texture *tex, const char *filename) {
-    SDL_Texture *ren_tex = NULL;
-    SDL_Surface *surf = NULL;
-    int w, h;
-    int format = SDL_PIXELFORMAT_RGBA32;;
-    void *pixels = NULL;
-
-    /* Get information about texture we want to save */
-    int st = SDL_QueryTexture(tex, NULL, NULL, &w, &h);
-    if (st != 0) { SDL_Log("Failed querying texture: %s\n", SDL_GetError()); goto cleanup; }
-
-    // adjust aspect ratio
-    while(w > 2*h) w/=2;
-    
-    ren_tex = SDL_CreateTexture(ren, format, SDL_TEXTUREACCESS_TARGET, w, h);
-    if (!ren_tex) { SDL_Log("Failed creating render texture: %s\n", SDL_GetError()); goto cleanup; }
-
-    /* Initialize our canvas, then copy texture to a target whose pixel data we can access */
-    st = SDL_SetRenderTarget(ren, ren_tex);
-    if (st != 0) { SDL_Log("Failed setting render target: %s\n", SDL_GetError()); goto cleanup; }
-
-    SDL_SetRenderDrawColor(ren, 0x00, 0x00, 0x00, 0x00);
-    SDL_RenderClear(ren);
-
-    st = SDL_RenderCopy(ren, tex, NULL, NULL);
-    if (st != 0) { SDL_Log("Failed copying texture data: %s\n", SDL_GetError()); goto cleanup; }
-
-    /* Create buffer to hold texture data and load it */
-    pixels = malloc(w * h * SDL_BYTESPERPIXEL(format));
-    if (!pixels) { SDL_Log("Failed allocating memory\n"); goto cleanup; }
-
-    st = SDL_RenderReadPixels(ren, NULL, format, pixels, w * SDL_BYTESPERPIXEL(format));
-    if (st != 0) { SDL_Log("Failed reading pixel data: %s\n", SDL_GetError()); goto cleanup; }
-
-    /* Copy pixel data over to surface */
-    surf = SDL_CreateRGBSurfaceWithFormatFrom(pixels, w, h, SDL_BITSPERPIXEL(format), w * SDL_BYTESPERPIXEL(format), format);
-    if (!surf) { SDL_Log("Failed creating new surface: %s\n", SDL_GetError()); goto cleanup; }
-
-    /* Save result to an image */
-    st = IMG_SavePNG(surf, filename);
-    if (st != 0) { SDL_Log("Failed saving image: %s\n", SDL_GetError()); goto cleanup; }
-    
-    // SDL_Log("Saved texture as PNG to \"%s\" sized %dx%d\n", filename, w, h);
-
-cleanup:
-    SDL_FreeSurface(surf);
-    free(pixels);
-    SDL_DestroyTexture(ren_tex);
-}
-
-void capture_video(void) {
+void capture_video(Vnanomac_tb *tb, double time) {
   static int last_hs_n = -1;
   static int last_vs_n = -1;
   static int sx = 0;
@@ -186,10 +187,6 @@ void capture_video(void) {
 
     // trigger on rising hs edge
     if(tb->hs_n) {
-      // write audio
-      int16_t audio = tb->audio << 5;
-      if(ad) fwrite(&audio, 1, 2, ad);
-      
       // no line in this frame detected, yet
       if(frame_line_len >= 0) {
 	if(frame_line_len == 0)
@@ -212,53 +209,22 @@ void capture_video(void) {
 
     // trigger on rising vs edge
     if(tb->vs_n) {
-      // draw frame if valid
-      if(frame_line_len > 0) {
-	
-	// check if current texture matches the frame size
-	if(sdl_texture) {
-	  int w=-1, h=-1;
-	  SDL_QueryTexture(sdl_texture, NULL, NULL, &w, &h);
-	  if(w != frame_line_len || h != sy) {
-	    SDL_DestroyTexture(sdl_texture);
-	    sdl_texture = NULL;
-	  }
-	}
-	  
-	if(!sdl_texture) {
-	  sdl_texture = SDL_CreateTexture(sdl_renderer, SDL_PIXELFORMAT_RGBA8888,
-					  SDL_TEXTUREACCESS_TARGET, frame_line_len, sy);
-	  if (!sdl_texture) {
-	    printf("Texture creation failed: %s\n", SDL_GetError());
-	    sdl_cancelled = 1;
-	  }
-	}
-	
-	if(sdl_texture) {	
-	  SDL_UpdateTexture(sdl_texture, NULL, screenbuffer, MAX_H_RES*sizeof(Pixel));
-	  
-	  SDL_RenderClear(sdl_renderer);
-	  SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL);
-	  SDL_RenderPresent(sdl_renderer);
-
-	  char name[32];
-	  sprintf(name, "screenshots/frame%04d.png", frame);
-	  save_texture(sdl_renderer, sdl_texture, name);
-	}
-      }
-	
-      // process SDL events
-      SDL_Event event;
-      while( SDL_PollEvent( &event ) ){
-	if(event.type == SDL_QUIT)
+      // pass frame to display if valid
+      if(frame_line_len > 0)
+	display_frame(screenbuffer, MAX_H_RES, frame_line_len, sy, frame);
+
+      // process window events
+      struct display_event event;
+      while(display_event(&event)) {
+	if(event.type == DISPLAY_QUIT)
+	  sdl_cancelled = 1;
+
+	if(event.type == DISPLAY_KEY_DOWN && event.key == SDLK_ESCAPE)
 	  sdl_cancelled = 1;
-	
-	if(event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)
-	    sdl_cancelled = 1;
       }
       
 #ifndef UART_ONLY
-      printf("%.3fms frame %d is %dx%d\n", simulation_time*1000, frame, frame_line_len, sy);
+      printf("%.3fms frame %d is %dx%d\n", time*1000, frame, frame_line_len, sy);
 #endif
 
       frame++;
@@ -336,124 +302,162 @@ static uint64_t GetTickCountMs() {
 #define SWAP16(a)  (((a & 0x00ff)<<8)|((a & 0xff00)>>8))
 unsigned short rom[128*1024];  // 128k
 
+// the rom is shared by all instances
 void load_rom(void) {
-  printf("Loading rom\n");
-  FILE *fd = fopen(ROM, "rb");
+  printf("Loading rom %s\n", rom_file);
+  FILE *fd = fopen(rom_file, "rb");
   if(!fd) { perror("load rom"); exit(-1); }
   
   int len = fread(rom, 1024, 128, fd);
   if(len != 128) { printf("read failed\n"); exit(-1); }
   fclose(fd);
 
-#if 0
-  // we may actually patch some stuff for faster booting
-  rom[0xd7a/2] = SWAP16(0x6022);  // 7000, disable rom checksum test
-  rom[0xea8/2] = SWAP16(0x4e71);  // 6EEC, shorten ram test read
-  rom[0xe90/2] = SWAP16(0x4e71);  // 6AF0, shorten ram test write
-#endif
+  // we may actually patch some stuff for faster booting (see rompatch.cpp)
+  rompatch_apply(rom, 128*1024/2);
+}
+
+/* ========================== memory consistency check ====================== */
+
+// In check mode any difference between sram and sdram is recorded in a small
+// log instead of being printed each time. Each address is only logged once
+// together with the context of its first occurrence. Later hits on the same
+// address just increase the counter.
+#define MEMCHECK_WRITE  0   // sdram doesn't contain the data written to sram
+#define MEMCHECK_READ   1   // sram and sdram returned different data
+#define MEMCHECK_NOREAD 2   // sdram returned data without sram being read
+
+static const char *memcheck_kind_str[] = { "write", "read", "sdram-only read" };
+
+static void memcheck_record(struct sim *s, int kind, uint32_t addr, uint16_t sram_data, uint16_t sdram_data) {
+  if(s->is_main && !s->memcheck_total[0] && !s->memcheck_total[1] && !s->memcheck_total[2])
+    printf("%.3fms first RAM %s mismatch @%08x: %04x != %04x, logging further mismatches silently\n",
+	   s->time*1000, memcheck_kind_str[kind], addr, sram_data, sdram_data);
+  
+  s->memcheck_total[kind]++;
+
+  for(int i=0;i<s->memcheck_entries;i++) {
+    if(s->memcheck_log[i].kind == kind && s->memcheck_log[i].addr == addr) {
+      s->memcheck_log[i].count++;
+      return;
+    }
+  }
+
+  if(s->memcheck_entries == MEMCHECK_LOG_SIZE) {
+    s->memcheck_dropped++;
+    return;
+  }
+  
+  struct memcheck_entry *e = &s->memcheck_log[s->memcheck_entries++];
+  e->kind = kind;
+  e->addr = addr;
+  e->time = s->time;
+  e->sram = sram_data;
+  e->sdram = sdram_data;
+  e->count = 1;
 }
 
-// "normal" ram, basically sram like
-unsigned short ram[4*512*1024];  // 4 Megabytes
+static void memcheck_report(struct sim *s) {
+  if(s->mem_mode != MEM_CHECK) return;
 
-// the sdram
-uint32_t sdram[2*1024*1024];  // 2M 32 bit words
+  if(!s->memcheck_entries) {
+    printf("RAM check: no sram/sdram mismatches\n");
+    return;
+  }
+
+  printf("RAM check: %lu write, %lu read and %lu sdram-only read mismatches\n",
+	 s->memcheck_total[MEMCHECK_WRITE], s->memcheck_total[MEMCHECK_READ], s->memcheck_total[MEMCHECK_NOREAD]);
+  for(int i=0;i<s->memcheck_entries;i++)
+    printf("  %.3fms %-15s @%08x: sram %04x, sdram %04x (%lu times)\n", s->memcheck_log[i].time*1000,
+	   memcheck_kind_str[s->memcheck_log[i].kind], s->memcheck_log[i].addr,
+	   s->memcheck_log[i].sram, s->memcheck_log[i].sdram, s->memcheck_log[i].count);
+  if(s->memcheck_dropped)
+    printf("  %lu mismatches at further addresses not logged\n", s->memcheck_dropped);
+}
+
+// read a 16 bit word from whichever ram the main instance is currently using
+uint16_t mem_read16(uint32_t addr) {
+  struct sim *s = main_sim;
+  addr >>= 1;
+  if(s->mem_mode == MEM_SRAM) return SWAP16(s->ram[addr]);
+  return (addr & 1)?(s->sdram[addr>>1] & 0xffff):(s->sdram[addr>>1] >> 16);
+}
 
-// proceed simulation by one tick
-void tick(int c) {
-  static uint64_t ticks = 0;
-  static int uart_state = -1;
+// proceed simulation of an instance by one tick
+void tick(struct sim *s, int c) {
+  Vnanomac_tb *tb = s->tb;
 
   tb->eval();
 
   tb->clk = c;
 
-  static  int leds = 0;
-  if(leds != tb->leds) {
-    printf("%.3fms LEDs ", simulation_time*1000);
-    for(int i=0;i<5;i++) printf("%c", (tb->leds&(0x10>>i))?'*':'-');
-    printf("\n");
-
-    leds = tb->leds;
+  if(s->leds != tb->leds) {
+    if(s->is_main) {
+      printf("%.3fms LEDs ", s->time*1000);
+      for(int i=0;i<5;i++) printf("%c", (tb->leds&(0x10>>i))?'*':'-');
+      printf("\n");
+      stop_leds(tb->leds, s->time);
+    }
+    s->leds = tb->leds;
   }
   
   if(c /* && !tb->reset */ ) {
     // leave reset after 2 ms of simulation time
-    if ( tb->reset && simulation_time > 0.002) {
-      printf("%.3fms Out of reset\n", simulation_time*1000);
+    if ( tb->reset && s->time > 0.002) {
+      if(s->is_main) printf("%.3fms Out of reset\n", s->time*1000);
       tb->reset = 0;
     }
     
-    if( uart_state == -1) {
-      if(simulation_time > .05) {
-	printf("%.3fms UART start\n", simulation_time*1000);
-	uart_state = 0;
-      }
-    } else if(uart_state != -2) {
-      char *data = (char*)"Hello World";
-      int bit = uart_state / (16000000/9600);   // bit rate = 9k6
-
-      int stop_bits = 2;
-      int byte = bit / (9+stop_bits);         //
-      int bit_in_byte = bit % (9+stop_bits);
-
-      if(bit_in_byte == 0)
-	tb->uart_rxd = 0;                                  // start bit
-      else if(bit_in_byte <= 8)
-	tb->uart_rxd = (data[byte] & (1<<(bit_in_byte-1)))?1:0;    // data bit
-      else
-	tb->uart_rxd = 1;                                  // stop bit(s)
-
-      uart_state++;
-
-      if((byte == strlen(data)-1) && (bit_in_byte > 8))
-	uart_state = -2;
+    // serial console
+    if(s->is_main) {
+      tb->uart_rxd = uart_rx(s->time);
+      uart_tx(tb->uart_txd, s->time);
     }
       
     // send a keycode
-    if( !tb->kbd_strobe && simulation_time > 2.3) {
-      printf("%.3fms KBD send code #1\n", simulation_time*1000);
+    if( !tb->kbd_strobe && s->time > 2.3) {
+      if(s->is_main) printf("%.3fms KBD send code #1\n", s->time*1000);
       tb->kbd_strobe = !tb->kbd_strobe;
       tb->kbd_data = 0x01;   // should be 'a'      
     }
 
     // process sd card signals
-    sd_handle(simulation_time*1000, tb);
+    sd_handle(&s->sd, s->time*1000, tb);
+
+    // record all inputs set above or replace them by recorded ones
+    if(s->is_main) journal_tick(tb, s->time);
     
     // ------------------------------------ simulate sdram -------------------------------------
     int sdram_has_returned_data = 0;
-    if(!tb->sd_cs) {
-      static int addrL, baL;
-      
+    if(s->mem_mode != MEM_SRAM && !tb->sd_cs) {
       // RAS phase
       if(!tb->sd_ras && tb->sd_cas && tb->sd_we) {
 #ifdef DEBUG_MEM
-	printf("%.3fms SDRAM ACTIVE %06x %d\n", simulation_time*1000, tb->sd_addr, tb->sd_ba);
+	printf("%.3fms SDRAM ACTIVE %06x %d\n", s->time*1000, tb->sd_addr, tb->sd_ba);
 #endif
-	baL = tb->sd_ba;      // 2 bits
-	addrL = tb->sd_addr;  // 11 bits
+	s->sdram_ba = tb->sd_ba;      // 2 bits
+	s->sdram_addr = tb->sd_addr;  // 11 bits
       }
 
       // CAS read/write
       if(tb->sd_ras && !tb->sd_cas) {
 	// calculate full address, sd_addr now has the lowest 8 bits
-	int addr = (baL << (8+11)) + (addrL << 8) + (tb->sd_addr & 0xff);
+	int addr = (s->sdram_ba << (8+11)) + (s->sdram_addr << 8) + (tb->sd_addr & 0xff);
 	
 	if(tb->sd_we) {	  
 	  sdram_has_returned_data = 1;
-	  tb->sd_data_in = sdram[addr];
+	  tb->sd_data_in = s->sdram[addr];
 #ifdef DEBUG_MEM
-	  printf("%.3fms SDRAM READ %06x -> %08x = %04x (%08x)\n", simulation_time*1000, tb->sd_addr, addr<<2, tb->sd_data_in, sdram[addr]);
+	  printf("%.3fms SDRAM READ %06x -> %08x = %04x (%08x)\n", s->time*1000, tb->sd_addr, addr<<2, tb->sd_data_in, s->sdram[addr]);
 #endif
 	} else {
 #ifdef DEBUG_MEM
-	  printf("%.3fms SDRAM WRITE %06x -> %08x = %04x/%x\n", simulation_time*1000, tb->sd_addr, addr<<2, tb->sd_data_out, tb->sd_dqm);
+	  printf("%.3fms SDRAM WRITE %06x -> %08x = %04x/%x\n", s->time*1000, tb->sd_addr, addr<<2, tb->sd_data_out, tb->sd_dqm);
 #endif
 	  // which bytes are being being written depends on the dqm bits
-	  if(!(tb->sd_dqm & 1)) sdram[addr] = (sdram[addr] & 0xffffff00)|(tb->sd_data_out & 0x000000ff);
-	  if(!(tb->sd_dqm & 2)) sdram[addr] = (sdram[addr] & 0xffff00ff)|(tb->sd_data_out & 0x0000ff00);
-	  if(!(tb->sd_dqm & 4)) sdram[addr] = (sdram[addr] & 0xff00ffff)|(tb->sd_data_out & 0x00ff0000);
-	  if(!(tb->sd_dqm & 8)) sdram[addr] = (sdram[addr] & 0x00ffffff)|(tb->sd_data_out & 0xff000000);	  
+	  if(!(tb->sd_dqm & 1)) s->sdram[addr] = (s->sdram[addr] & 0xffffff00)|(tb->sd_data_out & 0x000000ff);
+	  if(!(tb->sd_dqm & 2)) s->sdram[addr] = (s->sdram[addr] & 0xffff00ff)|(tb->sd_data_out & 0x0000ff00);
+	  if(!(tb->sd_dqm & 4)) s->sdram[addr] = (s->sdram[addr] & 0xff00ffff)|(tb->sd_data_out & 0x00ff0000);
+	  if(!(tb->sd_dqm & 8)) s->sdram[addr] = (s->sdram[addr] & 0x00ffffff)|(tb->sd_data_out & 0xff000000);	  
 	}
       }
     }
@@ -466,28 +470,27 @@ void tick(int c) {
 	tb->romData = SWAP16(rom[tb->romAddr]);
 
       // skip rom test
-      if((simulation_time>1000000) && !tb->_romOE && ((tb->romAddr<<1)==0x18f44))
-	printf("%.3fms Sony Write trigger <------------------------- \n", simulation_time*1000);
+      if((s->time>1000000) && !tb->_romOE && ((tb->romAddr<<1)==0x18f44))
+	if(s->is_main) printf("%.3fms Sony Write trigger <------------------------- \n", s->time*1000);
     }
       
     // only run sram cycle if ram was already selected in phase 2
     // /AS should always be active from phased 2 to 6	
-    static int ram_cycle_selected;
     if(tb->phase == 2)
-      ram_cycle_selected = tb->sdram_oe || tb->sdram_we;
+      s->ram_cycle_selected = tb->sdram_oe || tb->sdram_we;
     
-    if(tb->phase == 6 && ram_cycle_selected) {
+    if(s->mem_mode != MEM_SDRAM && tb->phase == 6 && s->ram_cycle_selected) {
       // --------------------- RAM --------------------
       // Simulate a simple sram like memory, bypassing/ignoring the sdram controller completely
       // This may be used against the sdram controller to verify its correct operation.
       // Simulate memory working in state 6, so data is ready to be latched in cycle 7
       if(tb->sdram_we) {
 #ifdef DEBUG_MEM
-	printf("%.3fms RAM WR %08x/%d = %04x\n", simulation_time*1000, tb->ram_addr<<1, tb->sdram_ds, tb->sdram_din);
+	printf("%.3fms RAM WR %08x/%d = %04x\n", s->time*1000, tb->ram_addr<<1, tb->sdram_ds, tb->sdram_din);
 #endif
 	
 	// honour byte select
-	unsigned char *ptr = (unsigned char*)&(ram[tb->ram_addr]);
+	unsigned char *ptr = (unsigned char*)&(s->ram[tb->ram_addr]);
 	if(tb->sdram_ds & 2) ptr[0] = (tb->sdram_din >> 8) & 0xff;
 	if(tb->sdram_ds & 1) ptr[1] = (tb->sdram_din) & 0xff;
 
@@ -495,124 +498,220 @@ void tick(int c) {
 	// be the case since the sdram runs a little earlier than the
 	// simple sram like variant. In general, the SDRAM should have
 	// done the same thing already
-	uint16_t sdram_data = (tb->ram_addr & 1)?(sdram[tb->ram_addr>>1]&0xffff):
-	  ((sdram[tb->ram_addr>>1]>>16)&0xffff);
+	if(s->mem_mode == MEM_CHECK) {
+	  uint16_t sdram_data = (tb->ram_addr & 1)?(s->sdram[tb->ram_addr>>1]&0xffff):
+	    ((s->sdram[tb->ram_addr>>1]>>16)&0xffff);
 
-	if(ram[tb->ram_addr] != SWAP16(sdram_data))
-	  printf("%.3fms RAM write mismatch: @%08x: %04x != %04x\n", simulation_time*1000, tb->ram_addr<<1, ram[tb->ram_addr], SWAP16(sdram_data));
+	  if(s->ram[tb->ram_addr] != SWAP16(sdram_data))
+	    memcheck_record(s, MEMCHECK_WRITE, tb->ram_addr<<1, SWAP16(s->ram[tb->ram_addr]), sdram_data);
+	}
       }      
       
       if(tb->sdram_oe) {
-	unsigned char *ptr = (unsigned char*)&(ram[tb->ram_addr]);
+	unsigned char *ptr = (unsigned char*)&(s->ram[tb->ram_addr]);
 	tb->sdram_do = ptr[0] * 256 + ptr[1];
 
 #ifdef DEBUG_MEM
-	printf("%.3fms RAM RD %08x = %04x\n", simulation_time*1000, tb->ram_addr<<1,tb->sdram_do );
+	printf("%.3fms RAM RD %08x = %04x\n", s->time*1000, tb->ram_addr<<1,tb->sdram_do );
 #endif	
 	// verify both ram implementations. These should always return the same data
-	if(tb->sdram_do != ((tb->sd_data_in>>((tb->ram_addr & 1)?0:16)) & 0xffff))	
-	  printf("%.3fms RAM read mismatch @%08x: %04x != %04x\n", simulation_time*1000, tb->ram_addr<<1, tb->sdram_do, (tb->sd_data_in>>((tb->ram_addr & 1)?0:16)) & 0xffff);
-      } else if(sdram_has_returned_data) {
+	if(s->mem_mode == MEM_CHECK) {
+	  uint16_t sdram_data = (tb->sd_data_in>>((tb->ram_addr & 1)?0:16)) & 0xffff;
+	  if(tb->sdram_do != sdram_data)
+	    memcheck_record(s, MEMCHECK_READ, tb->ram_addr<<1, tb->sdram_do, sdram_data);
+	}
+      } else if(sdram_has_returned_data && s->mem_mode == MEM_CHECK) {
 	// It should never happen that the sdram has returned data but the sram is not	
-	printf("%.3fms SDRAM has read, bit sram didn't!\n", simulation_time*1000);
+	memcheck_record(s, MEMCHECK_NOREAD, tb->ram_addr<<1, 0, 0);
       }
     }
   }
     
+  // headless capture of complete frames, for regression checks and
+  // to compare instances
+  int frame_done = c && frame_capture(&s->grabber, &s->frame, tb, s->time);
+
+  // everything else is only attached to the main instance
+  if(!s->is_main) {
+    s->time += TICKLEN;
+    return;
+  }
+
+  // the mac fetches one audio sample per line
+  if(c && tb->hs_n != s->last_hs_n) {
+    if(tb->hs_n) {
+      int16_t sample = audio_sample(tb->audio);
+      golden_audio_sample(sample, s->time);
+      state_audio_sample(sample);
+    }
+    s->last_hs_n = tb->hs_n;
+  }
+
+  if(frame_done) {
+    if(s->frame.number == save_frame) frame_save_pbm(&s->frame, save_frame_name);
+    if(golden_frame(&s->frame)) stop_target(s->time);
+    stop_frame(&s->frame);
+    live_frame(&s->frame, s->leds, s->time);
+    snapshot_frame(s, &s->frame);
+  }
+
+  if(c) sndbench_tick(tb, s->time);
+  if(c) floppy_check_tick(tb, s->time);
+  if(c) floppybench_tick(s);
+  if(c) scsibench_tick(tb, s->time);
+  if(c) storagebench_tick(tb, s->time);
+  if(c) irqbench_tick(tb, s->time);
+  if(c) state_tick(s);
+  if(c) snapshot_tick(s);
+  if(c) live_tick(s->time, s->leds);
+
+  // check time budgets once per simulated 1/8 ms
+  if(c && !(++s->budget_ticks & 0x7ff)) stop_budget(s->time);
+
 #ifdef VIDEO
-  if(c) capture_video();
+  if(c) capture_video(tb, s->time);
 #endif
 
-  if(simulation_time == 0)
-    ticks = GetTickCountMs();
+  if(s->time == 0)
+    s->speed_start_ms = GetTickCountMs();
   
   // after one simulated millisecond calculate real time */
-  if(simulation_time >= 0.001 && ticks) {
-    ticks = GetTickCountMs() - ticks;
-    printf("Speed factor = %lu\n", ticks);
-    ticks = 0;
+  if(s->time >= 0.001 && s->speed_start_ms) {
+    printf("Speed factor = %lu\n", (unsigned long)(GetTickCountMs() - s->speed_start_ms));
+    s->speed_start_ms = 0;
   }
   
   // trace after
 #ifdef TRACESTART
-  if(simulation_time > TRACESTART) trace->dump(1000000000000 * simulation_time);
+  if(s->time > TRACESTART) trace->dump(1000000000000 * s->time);
 #endif
-  simulation_time += TICKLEN;
+  s->time += TICKLEN;
 }
 
-void fexit(void) {
-  if(ad) {
-    fclose(ad);
-    ad = NULL;
+// create an instance, the rom and the images have to be loaded before
+static struct sim *sim_create(int id, int is_main) {
+  struct sim *s = (struct sim*)calloc(1, sizeof(struct sim));
+  if(!s) { printf("Instance %d: out of memory\n", id); exit(-1); }
+
+  s->id = id;
+  s->is_main = is_main;
+  s->mem_mode = mem_mode;
+  s->last_hs_n = 1;
+  s->state_last_as_n = 1;
+
+  s->context = new VerilatedContext;
+#ifdef TRACE
+  if(is_main) s->context->traceEverOn(true);
+#endif
+  s->tb = new Vnanomac_tb(s->context);
+
+  s->ram = (uint16_t*)calloc(2*1024*1024, sizeof(uint16_t));
+  s->sdram = (uint32_t*)calloc(2*1024*1024, sizeof(uint32_t));
+  if(!s->ram || !s->sdram) { printf("Instance %d: out of memory\n", id); exit(-1); }
+
+  sd_init(&s->sd, !is_main);
+  frame_grabber_init(&s->grabber);
+
+  s->tb->reset = 1;
+  s->tb->uart_rxd = 1;
+  s->tb->ram_size = RAM_SIZE;
+  s->tb->sram_mode = (s->mem_mode == MEM_SRAM);
+  return s;
+}
+
+static void sim_destroy(struct sim *s) {
+  s->tb->final();
+  delete s->tb;
+  delete s->context;
+  sd_free(&s->sd);
+  free(s->ram);
+  free(s->sdram);
+  free(s);
+}
+
+// the additional instances follow the main one and stop at the
+// same simulated time. The main instance publishes its time every
+// FOLLOW_STEP clocks, the others sleep until it has moved on
+#define FOLLOW_STEP  1024
+
+static std::mutex follow_mutex;
+static std::condition_variable follow_cond;
+static double main_time = 0;
+static int main_stopped = 0;
+
+static void sim_publish(double time, int stopped) {
+  {
+    std::lock_guard<std::mutex> lock(follow_mutex);
+    main_time = time;
+    main_stopped = stopped;
   }
+  follow_cond.notify_all();
 }
 
-int main(int argc, char **argv) {
-  // Initialize Verilators variables
-  Verilated::commandArgs(argc, argv);
-  // Verilated::debug(1);
-  Verilated::traceEverOn(true);
-  trace = new VerilatedFstC;
-  trace->spTrace()->set_time_unit("1ns");
-  trace->spTrace()->set_time_resolution("1ps");
-  simulation_time = 0;
+static void sim_follow(struct sim *s) {
+  for(;;) {
+    double target;
+    {
+      std::unique_lock<std::mutex> lock(follow_mutex);
+      follow_cond.wait(lock, [s]{ return s->time < main_time || main_stopped; });
+      target = main_time;
+    }
+    if(s->time >= target) return;
 
-  atexit(fexit);
- 
-  // create fdc lba map
-  int lba_ds = 0;
-  int lba_ss = 0;
-  for(int track=0;track<80;track++) {
-    int spt;
-    if(track >= 64) spt = 8;
-    else if(track >= 48) spt = 9;
-    else if(track >= 32) spt = 10;
-    else if(track >= 16) spt = 11;
-    else                 spt = 12;
-    
-    for(int side=0;side<2;side++) {
-      for(int sector=0;sector<spt;sector++) {
-	if(side == 0) {
-	  fdc_map[0][lba_ss][0] = side;
-	  fdc_map[0][lba_ss][1] = track;
-	  fdc_map[0][lba_ss++][2] = sector;
-	}
-	
-	fdc_map[1][lba_ds][0] = side;
-	fdc_map[1][lba_ds][1] = track;
-	fdc_map[1][lba_ds++][2] = sector;
-      }
+    while(s->time < target) {
+      tick(s, 1);
+      tick(s, 0);
     }
   }
-  
+}
+
+// compare the last frame of all instances, returns the number of
+// instances differing from the main one
+static int sim_report(struct sim **sims, int n) {
+  int differ = 0;
+  uint64_t ref = frame_hash(&sims[0]->frame);
+
+  for(int i=0;i<n;i++) {
+    uint64_t hash = frame_hash(&sims[i]->frame);
+    printf("Instance %d: %.3fms, frame %u hash %016llx%s\n", i, 1000*sims[i]->time,
+	   sims[i]->frame.number, (unsigned long long)hash,
+	   i?((hash == ref && sims[i]->frame.number == sims[0]->frame.number)?", matches instance 0":", DIFFERS from instance 0"):"");
+    if(i && (hash != ref || sims[i]->frame.number != sims[0]->frame.number)) differ++;
+  }
+  return differ;
+}
+
+// closes everything once, either at the end of main() or from atexit
+// when the simulation ends with exit()
+void fexit(void) {
+  static int closed = 0;
+  if(closed) return;
+  closed = 1;
+
+  if(main_sim) live_close(main_sim->time, main_sim->leds);
 #ifdef VIDEO
-  init_video();
-  ad = fopen("audio.s16", "wb");
+  display_close();
 #endif
+  audio_close();
+  uart_close();
+}
 
-  load_rom();
+// the simulation loop of the main instance. With VIDEO it runs in a
+// thread of its own as SDL has to stay on the main thread
+static int run(void) {
+  uint32_t clocks = 0;
 
-  // Create an instance of our module under test
-  tb = new Vnanomac_tb;
-  tb->trace(trace, 99);
-  trace->open("nanomac.fst");
-  
-  tb->reset = 1;
-  tb->uart_rxd = 1;
-  tb->ram_size = RAM_SIZE;
-  
-  /* run for a while */
   while(
 #ifdef TRACEEND
-	simulation_time<TRACEEND &&
+	main_sim->time<TRACEEND &&
 #endif
 #ifdef VIDEO 
 	!sdl_cancelled &&
 #endif
-	1) {
+	!sim_stopped()) {
 #ifdef TRACEEND
     // do some progress outout
-    int percentage = 100 * simulation_time / TRACEEND;
+    int percentage = 100 * main_sim->time / TRACEEND;
     static int last_perc = -1;
     if(percentage != last_perc) {
 #ifndef UART_ONLY
@@ -621,14 +720,296 @@ int main(int argc, char **argv) {
       last_perc = percentage;
     }
 #endif
-    tick(1);
-    tick(0);
+    tick(main_sim, 1);
+    tick(main_sim, 0);
+    if(instances && !(++clocks % FOLLOW_STEP)) sim_publish(main_sim->time, 0);
+  }
+  return 0;
+}
+
+static const char *audio_file = "audio.wav";
+static int audio_rate = 0;
+
+static void usage(const char *name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  -m, --mem=MODE      RAM simulation: sram (fast), sdram or check (default)\n");
+  printf("  -a, --audio=FILE    audio capture file, .wav or raw .s16 (default audio.wav, none to disable)\n");
+  printf("  -r, --audio-rate=HZ additionally resample audio to e.g. 44100 or 48000 Hz\n");
+  printf("  --golden-record=FILE     record the hash of every frame into FILE\n");
+  printf("  --golden=FILE            compare frame hashes against a recorded FILE\n");
+  printf("  --golden-target=PBM[:TOL][:block]\n");
+  printf("                           stop once a frame matches the image within TOL pixels\n");
+  printf("                           (or TOL white pixels per 8x8 block with :block)\n");
+  printf("  --golden-audio=FILE[:TOL] compare audio against a .wav or .s16 reference\n");
+  printf("  --state-record=FILE[:SECONDS]\n");
+  printf("                           record hashes of RAM, frame, audio and CPU bus cycles\n");
+  printf("                           every 10ms or the given simulated time into FILE\n");
+  printf("  --state-compare=FILE     compare state hashes against a recorded FILE\n");
+  printf("  --state-diff=FILE1,FILE2 report the first divergent intervals of two state\n");
+  printf("                           recordings and exit\n");
+  printf("  --snapshot=WHEN:FILE     save the RAM at WHEN seconds, at frame:N or at the end\n");
+  printf("                           of the run (end), may be given several times\n");
+  printf("  --snapshot-diff=FILE1,FILE2 summarize the changed ranges of two snapshots and exit\n");
+  printf("  --journal-record=FILE    record all inputs of the core per clock cycle into FILE\n");
+  printf("  --journal-replay=FILE    drive the inputs of the core from a recorded FILE\n");
+  printf("  --save-frame=N:PBM       save frame N as PBM image\n");
+  printf("  --uart-baud=BAUD         serial baud rate (default 9600)\n");
+  printf("  --uart-log=FILE          log serial output to FILE\n");
+  printf("  --uart-in=SRC            serial input from stdin, text:STRING, a file or none\n");
+  printf("                           (default sends \"Hello World\" once)\n");
+  printf("  --uart-pty               connect serial port to a pseudo terminal\n");
+  printf("  --rom=FILE               ROM image (default plusrom.bin)\n");
+  printf("  --rom-patch=SET[,SET]    patch the ROM for faster booting: nochecksum, ramtest\n");
+  printf("                           or fastboot for all of them\n");
+  printf("  --rom-patch-ref=FILE     record the first disk access of an unpatched boot in\n");
+  printf("                           FILE or report the time saved by the patches against it\n");
+  printf("  --floppy=FILE            internal floppy image (none for an empty drive)\n");
+  printf("  --floppy2=FILE           external floppy image\n");
+  printf("  --scsi=FILE              SCSI disk image (--scsi2 for the second one)\n");
+  printf("  --floppy-check           compare the floppy track encoder against its C++ model\n");
+  printf("  --floppy-dump=TRACK[/SIDE] print the encoded track of the internal floppy and exit\n");
+  printf("  --floppy-bench           report stalls while waiting for floppy tracks to load\n");
+  printf("  --scsi-bench             report the throughput of the SCSI disks\n");
+  printf("  --storage-bench          report sector latencies of all drives at the SD card\n");
+  printf("  --irq-bench              report interrupt latencies and handler times\n");
+  printf("  --sound-bench[=SECONDS]  measure VBL handler load and check for repeated or\n");
+  printf("                           dropped samples, starting when the sound buffer is\n");
+  printf("                           being written or at the given time\n");
+  printf("  -s, --stop=KIND:ARG[:ok|fail]\n");
+  printf("                           stop on hash:HASH, frame:N, target:PBM[:TOL], uart:TEXT,\n");
+  printf("                           leds:*----, mem:ADDR=VALUE, static:FRAMES, time:SECONDS\n");
+  printf("                           or wall:SECONDS\n");
+  printf("  --live[=NAME]            publish frames and status in shared memory /NAME\n");
+  printf("                           (default nanomac-PID), see live_monitor\n");
+  printf("  --instances=N            run N-1 additional headless instances alongside,\n");
+  printf("                           each in a thread of its own\n");
+  printf("  -h, --help          show this help\n");
+}
+
+static void parse_options(int argc, char **argv) {
+  static const struct option long_options[] = {
+    { "mem",        required_argument, NULL, 'm' },
+    { "audio",      required_argument, NULL, 'a' },
+    { "audio-rate", required_argument, NULL, 'r' },
+    { "golden-record", required_argument, NULL, 1 },
+    { "golden",        required_argument, NULL, 2 },
+    { "golden-target", required_argument, NULL, 3 },
+    { "golden-audio",  required_argument, NULL, 4 },
+    { "save-frame",    required_argument, NULL, 5 },
+    { "stop",          required_argument, NULL, 's' },
+    { "uart-baud",     required_argument, NULL, 6 },
+    { "uart-log",      required_argument, NULL, 7 },
+    { "uart-in",       required_argument, NULL, 8 },
+    { "uart-pty",      no_argument,       NULL, 9 },
+    { "floppy",        required_argument, NULL, 10 },
+    { "floppy2",       required_argument, NULL, 11 },
+    { "scsi",          required_argument, NULL, 12 },
+    { "scsi2",         required_argument, NULL, 13 },
+    { "sound-bench",   optional_argument, NULL, 14 },
+    { "rom",           required_argument, NULL, 15 },
+    { "rom-patch",     required_argument, NULL, 16 },
+    { "floppy-check",  no_argument,       NULL, 17 },
+    { "floppy-dump",   required_argument, NULL, 18 },
+    { "floppy-bench",  no_argument,       NULL, 19 },
+    { "scsi-bench",    no_argument,       NULL, 20 },
+    { "instances",     required_argument, NULL, 21 },
+    { "live",          optional_argument, NULL, 22 },
+    { "storage-bench", no_argument,       NULL, 23 },
+    { "irq-bench",     no_argument,       NULL, 24 },
+    { "state-record",  required_argument, NULL, 25 },
+    { "state-compare", required_argument, NULL, 26 },
+    { "state-diff",    required_argument, NULL, 27 },
+    { "snapshot",      required_argument, NULL, 28 },
+    { "snapshot-diff", required_argument, NULL, 29 },
+    { "journal-record", required_argument, NULL, 30 },
+    { "journal-replay", required_argument, NULL, 31 },
+    { "rom-patch-ref", required_argument, NULL, 32 },
+    { "help",       no_argument,       NULL, 'h' },
+    { NULL,         0,                 NULL,  0  }
+  };
+
+  int c;
+  while((c = getopt_long(argc, argv, "m:a:r:s:h", long_options, NULL)) != -1) {
+    switch(c) {
+    case 'm':
+      if(!strcmp(optarg, "sram"))       mem_mode = MEM_SRAM;
+      else if(!strcmp(optarg, "sdram")) mem_mode = MEM_SDRAM;
+      else if(!strcmp(optarg, "check")) mem_mode = MEM_CHECK;
+      else { printf("Unknown memory mode '%s'\n", optarg); exit(-1); }
+      break;
+
+    case 'a':
+      audio_file = optarg;
+      break;
+      
+    case 'r':
+      audio_rate = atoi(optarg);
+      break;
+      
+    case 1: golden_record(optarg);   break;
+    case 2: golden_timeline(optarg); break;
+    case 3: golden_target(optarg);   break;
+    case 4: golden_audio(optarg);    break;
+      
+    case 5:
+      save_frame = strtol(optarg, (char**)&save_frame_name, 10);
+      if(*save_frame_name != ':') { printf("Expecting frame:name\n"); exit(-1); }
+      save_frame_name++;
+      break;
+      
+    case 6: uart_set_baud(optarg);       break;
+    case 7: uart_set_log(optarg);        break;
+    case 8: uart_set_input(optarg);      break;
+    case 9: uart_open_pty();             break;
+
+    case 10: case 11: case 12: case 13:
+      sd_set_image(c - 10, optarg);
+      break;
+
+    case 14: sndbench_enable(optarg, RAM_SIZE); break;
+    case 15: rom_file = optarg;                 break;
+    case 16: rompatch_select(optarg);           break;
+    case 17: floppy_check_enable();             break;
+    case 18: floppy_dump_track = optarg;        break;
+    case 19: floppybench_enable();              break;
+    case 20: scsibench_enable();                break;
+    case 21: instances = atoi(optarg) - 1;      break;
+    case 22: live_open(optarg);                 break;
+    case 23: storagebench_enable();             break;
+    case 24: irqbench_enable();                 break;
+    case 25: state_record(optarg, RAM_SIZE);    break;
+    case 26: state_compare(optarg, RAM_SIZE);   break;
+    case 27: state_diff_files = optarg;         break;
+    case 28: snapshot_add(optarg, RAM_SIZE);    break;
+    case 29: snapshot_diff_files = optarg;      break;
+    case 30: journal_record(optarg);            break;
+    case 31: journal_replay(optarg);            break;
+    case 32: rompatch_ref(optarg, RAM_SIZE);    break;
+      
+    case 's':
+      stop_add(optarg);
+      break;
+      
+    case 'h':
+      usage(argv[0]);
+      exit(0);
+
+    default:
+      usage(argv[0]);
+      exit(-1);
+    }
   }
+}
+
+int main(int argc, char **argv) {
+  // Initialize Verilators variables
+  Verilated::commandArgs(argc, argv);
+  parse_options(argc, argv);
+  if(floppy_dump_track)
+    exit(floppy_dump(sd_get_image(0), floppy_dump_track)?EXIT_FAIL:EXIT_OK);
+  if(state_diff_files)
+    exit(state_diff(state_diff_files)?EXIT_FAIL:EXIT_OK);
+  if(snapshot_diff_files)
+    exit(snapshot_diff(snapshot_diff_files)?EXIT_FAIL:EXIT_OK);
+  // Verilated::debug(1);
+#ifdef TRACE
+  trace = new VerilatedFstC;
+  trace->spTrace()->set_time_unit("1ns");
+  trace->spTrace()->set_time_resolution("1ps");
+#endif
+
+  atexit(fexit);
+ 
+#ifdef VIDEO
+  display_open();
+#endif
+  audio_open(audio_file, audio_rate);
+
+  // rom and disk images are shared by all instances
+  load_rom();
+  sd_open_images();
+
+  // Create the instances of our module under test
+  if(instances < 0) instances = 0;
+#ifdef HYBRID
+  // there's only one Musashi 68000
+  if(instances) { printf("The hybrid simulation supports only a single instance\n"); exit(-1); }
+#endif
+  struct sim **sims = (struct sim**)calloc(instances+1, sizeof(struct sim*));
+  for(int i=0;i<=instances;i++) sims[i] = sim_create(i, i == 0);
+  main_sim = sims[0];
+#ifdef TRACE
+  main_sim->tb->trace(trace, 99);
+  trace->open("nanomac.fst");
+#endif
+
+  std::thread *threads = instances?new std::thread[instances]:NULL;
+  for(int i=0;i<instances;i++) threads[i] = std::thread(sim_follow, sims[i+1]);
+  if(instances) printf("Running %d additional instances\n", instances);
   
-  printf("stopped after %.3fms\n", 1000*simulation_time);
+  /* run for a while */
+  uint64_t start_ms = GetTickCountMs();
+#ifdef VIDEO
+  display_run(run);
+#else
+  run();
+#endif
+  
+  // real time per simulated time for the whole run, to compare build profiles
+  uint64_t real_ms = GetTickCountMs() - start_ms;
+  double simulation_time = main_sim->time;
+  printf("stopped after %.3fms, %llums real time, speed factor %.0f\n", 1000*simulation_time,
+	 (unsigned long long)real_ms, (simulation_time > 0)?real_ms/(1000*simulation_time):0);
+
+  // memory and i/o of the whole process, e.g. for make bench
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  unsigned long long rchar = 0, wchar = 0;
+  FILE *io = fopen("/proc/self/io", "r");
+  if(io) {
+    char line[64];
+    while(fgets(line, sizeof(line), io)) {
+      sscanf(line, "rchar: %llu", &rchar);
+      sscanf(line, "wchar: %llu", &wchar);
+    }
+    fclose(io);
+  }
+  printf("resources: peak RSS %ldkB, %u sectors read, %u sectors written, %llu bytes read, %llu bytes written\n",
+	 usage.ru_maxrss, main_sim->sd.reads, main_sim->sd.writes, rchar, wchar);
+
+  // let the other instances catch up
+  sim_publish(main_sim->time, 1);
+  for(int i=0;i<instances;i++) threads[i].join();
+  delete[] threads;
   
+#ifdef TRACE
   trace->close();
+#endif
 
-  //  hexdump(ram, 128*1024);
+  snapshot_end(main_sim);
+  memcheck_report(main_sim);
+  int failed = golden_report();
+  if(sndbench_report()) failed = 1;
+  if(floppy_check_report()) failed = 1;
+  floppybench_report(simulation_time);
+  scsibench_report(simulation_time);
+  storagebench_report(simulation_time);
+  irqbench_report();
+  if(state_report()) failed = 1;
+  journal_report();
+  if(instances && sim_report(sims, instances+1)) failed = 1;
+#ifdef HYBRID
+  hybrid68k_report();
+#endif
+  
   fexit();
+
+  for(int i=0;i<=instances;i++) sim_destroy(sims[i]);
+  free(sims);
+  main_sim = NULL;
+
+  int status = stop_status();
+  if(failed && status == EXIT_OK) status = EXIT_FAIL;
+  printf("exit status %d\n", status);
+  return status;
 }
@@ -7,6 +7,7 @@ module nanomac_tb
    output reg [2:0] phase, 
 
    input [1:0]	    ram_size,
+   input	    sram_mode, // 1 = core uses sram model data, 0 = sdram
 
    output [4:0]	    leds,
    
@@ -54,6 +55,48 @@ module nanomac_tb
    // serial interface
    output	    uart_txd,
    input	    uart_rxd,
+
+   // cpu bus state for the benchmarks, taken from inside the core
+   output [2:0]	    cpu_ipl_n,
+   output [2:0]	    cpu_fc,
+   output	    cpu_as_n,
+   output [23:1]    cpu_addr,
+   output	    cpu_rw,
+   output [15:0]    cpu_dout,
+   output [15:0]    cpu_din,
+
+   // pending and enabled interrupt sources for the interrupt benchmark
+   output [6:0]	    via_irq,
+   output	    scc_irq,
+
+   // track encoder of the internal floppy drive for the codec check
+   output	    fdc_rst,
+   output	    fdc_ready,
+   output	    fdc_side,
+   output	    fdc_sides,
+   output [6:0]	    fdc_track,
+   output [3:0]	    fdc_spt,
+   output [13:0]    fdc_addr,
+   output [7:0]	    fdc_data,
+   output [7:0]	    fdc_odata,
+
+   // track buffer state for the floppy benchmark
+   output	    fdc_stall,
+   output	    fdc_sd_rd,
+   output	    fdc_sd_wr,
+
+   // scsi bus and sd requests for the scsi benchmark
+   output	    scsi_bsy,
+   output	    scsi_rd_ack,
+   output	    scsi_wr_ack,
+   output	    scsi_sd_rd,
+
+   // sd card requests of the drives and sd_rw state for the storage benchmark
+   output [3:0]	    sdc_req_rd,
+   output [3:0]	    sdc_req_wr,
+   output	    sdc_req_busy,
+   output [3:0]	    sdc_cmd_state,
+   output [3:0]	    sdc_dat_state,
    
    // interface to sdram controller
    output	    sdram_oe,
@@ -140,6 +183,47 @@ sd_rw #(
     .outbyte(sdc_data_in)   // a byte of sector content
 );
 
+assign cpu_ipl_n = macplus._cpuIPL;
+assign cpu_fc = macplus.cpuFC;
+assign cpu_as_n = macplus._cpuAS;
+assign cpu_addr = macplus.cpuAddr;
+assign cpu_rw = macplus._cpuRW;
+assign cpu_dout = macplus.cpuDataOut;
+assign cpu_din = macplus.dataControllerDataOut;
+
+assign via_irq = macplus.dc0.via.irq_flags & macplus.dc0.via.irq_mask;
+assign scc_irq = !macplus.dc0._sccIrq;
+
+assign fdc_rst = macplus.dc0.i.floppyInt.codec.rst;
+assign fdc_ready = macplus.dc0.i.floppyInt.codec.ready;
+assign fdc_side = macplus.dc0.i.floppyInt.codec.side;
+assign fdc_sides = macplus.dc0.i.floppyInt.codec.sides;
+assign fdc_track = macplus.dc0.i.floppyInt.codec.track;
+assign fdc_spt = macplus.dc0.i.floppyInt.codec.spt;
+assign fdc_addr = macplus.dc0.i.floppyInt.codec.addr;
+assign fdc_data = macplus.dc0.i.floppyInt.codec.data;
+assign fdc_odata = macplus.dc0.i.floppyInt.codec.odata;
+
+// the motor of the selected drive runs but the track isn't in the buffer
+assign fdc_stall = !macplus.dc0.i.ready &&
+       |(macplus.dc0.i.driveMask & macplus.dc0.i.insertDisk & macplus.dc0.i.diskMotor);
+assign fdc_sd_rd = |macplus.dc0.i.fb.sd_rd;
+assign fdc_sd_wr = |macplus.dc0.i.fb.sd_wr;
+
+// data phase handshakes of the target, reading is io asserted
+assign scsi_bsy = |macplus.dc0.scsi.target_bsy;
+assign scsi_rd_ack = macplus.dc0.scsi.scsi_ack && scsi_bsy && macplus.dc0.scsi.scsi_io &&
+		     !macplus.dc0.scsi.scsi_cd && !macplus.dc0.scsi.scsi_msg;
+assign scsi_wr_ack = macplus.dc0.scsi.scsi_ack && scsi_bsy && !macplus.dc0.scsi.scsi_io &&
+		     !macplus.dc0.scsi.scsi_cd && !macplus.dc0.scsi.scsi_msg;
+assign scsi_sd_rd = |macplus.dc0.scsi_rd;
+
+assign sdc_req_rd = sdc_rd[3:0];
+assign sdc_req_wr = sdc_wr[3:0];
+assign sdc_req_busy = sdc_busy;
+assign sdc_cmd_state = sd_card.sdcmd_stat;
+assign sdc_dat_state = sd_card.sddat_stat;
+
 macplus macplus (
         //Master input clock
         .CLKIN(clk),
@@ -193,7 +277,7 @@ macplus macplus (
 	.sdram_ds(sdram_ds),
 	.sdram_we(sdram_we),
 	.sdram_oe(sdram_oe),
-	.sdram_do(sdram_dout), // sdram_do (sim sram), sdram_dout = (sim sdram)
+	.sdram_do(sram_mode?sdram_do:sdram_dout), // sdram_do (sim sram), sdram_dout = (sim sdram)
  
         .UART_TXD(uart_txd),
         .UART_RXD(uart_rxd),
@@ -0,0 +1,208 @@
+/*
+  rompatch.cpp
+
+  Boot acceleration patches for the simulation. The ROM is identified
+  by the checksum stored in its first long word, which is also verified
+  against the checksum calculated over the image. Patch sets are given
+  by name with --rom-patch=SET[,SET...]:
+
+    nochecksum   skip the ROM checksum test
+    ramtest      shorten the RAM test
+    fastboot     all of the above
+
+  Each patch belongs to the ROM revision it was made for. A ROM that is
+  unknown or whose contents don't match its checksum gets no patches at
+  all. Each patch also checks the original instruction at its address
+  and if any of them doesn't match, the ROM is left unpatched.
+
+  To judge the effect the time of the first disk access is reported as
+  boot milestone, with and without patches. --rom-patch-ref=FILE keeps
+  that time of an unpatched run per ROM and RAM size in FILE: a run
+  without patches records it, a run with patches reports the simulated
+  time saved against it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstdint>
+
+#define SWAP16(a)  (((a & 0x00ff)<<8)|((a & 0xff00)>>8))
+
+static const struct rom_info {
+  uint32_t checksum;
+  const char *name;
+} known_roms[] = {
+  { 0x4D1EEEE1, "Mac Plus v1 (Lonely Hearts)" },
+  { 0x4D1EEAE1, "Mac Plus v2 (Lonely Heifers)" },
+  { 0x4D1F8172, "Mac Plus v3 (Loud Harmonicas)" },
+  { 0, NULL }
+};
+
+static const struct rom_patch {
+  uint32_t rom;             // checksum of the ROM revision
+  const char *set;
+  uint32_t addr;            // byte address in the ROM
+  uint16_t orig, patch;
+  const char *what;
+} patches[] = {
+  { 0x4D1F8172, "nochecksum", 0xd7a, 0x7000, 0x6022, "skip ROM checksum test" },
+  { 0x4D1F8172, "ramtest",    0xea8, 0x6EEC, 0x4e71, "shorten RAM test read" },
+  { 0x4D1F8172, "ramtest",    0xe90, 0x6AF0, 0x4e71, "shorten RAM test write" },
+  { 0, NULL, 0, 0, 0, NULL }
+};
+
+static const char *patch_sets[] = { "nochecksum", "ramtest", NULL };
+
+static int selected[sizeof(patch_sets)/sizeof(patch_sets[0])];
+static int patched = 0;
+
+// reference of an unpatched boot
+static const char *ref_file = NULL;
+static int ref_ram_size;
+static uint32_t rom_checksum = 0;   // of a known ROM
+static double ref_time = -1;
+
+static int set_index(const char *name, size_t len) {
+  for(int i=0;patch_sets[i];i++)
+    if(strlen(patch_sets[i]) == len && !strncmp(patch_sets[i], name, len))
+      return i;
+  return -1;
+}
+
+void rompatch_select(const char *names) {
+  while(*names) {
+    size_t len = strcspn(names, ",");
+
+    if(len == 8 && !strncmp(names, "fastboot", 8)) {
+      for(int i=0;patch_sets[i];i++) selected[i] = 1;
+    } else {
+      int i = set_index(names, len);
+      if(i < 0) { printf("Unknown ROM patch set '%.*s'\n", (int)len, names); exit(-1); }
+      selected[i] = 1;
+    }
+
+    names += len;
+    if(*names == ',') names++;
+  }
+}
+
+void rompatch_ref(const char *name, int ram_size) {
+  ref_file = name;
+  ref_ram_size = ram_size;
+}
+
+static int any_selected(void) {
+  for(int s=0;patch_sets[s];s++)
+    if(selected[s]) return 1;
+  return 0;
+}
+
+// the reference file has a line "CHECKSUM RAM_SIZE MS" per ROM and RAM size
+static void ref_load(void) {
+  FILE *fd = fopen(ref_file, "r");
+  if(!fd) return;
+
+  unsigned checksum;
+  int ram_size;
+  double ms;
+  while(fscanf(fd, "%x %d %lf", &checksum, &ram_size, &ms) == 3)
+    if(checksum == rom_checksum && ram_size == ref_ram_size)
+      ref_time = ms/1000;
+  fclose(fd);
+}
+
+// replace the line of this ROM and RAM size or append it
+static void ref_store(double time) {
+  char lines[64][64];
+  int n = 0;
+
+  FILE *fd = fopen(ref_file, "r");
+  if(fd) {
+    unsigned checksum;
+    int ram_size;
+    double ms;
+    while(n < 63 && fscanf(fd, "%x %d %lf", &checksum, &ram_size, &ms) == 3)
+      if(checksum != rom_checksum || ram_size != ref_ram_size)
+	snprintf(lines[n++], sizeof(lines[0]), "%08x %d %.3f\n", checksum, ram_size, ms);
+    fclose(fd);
+  }
+  snprintf(lines[n++], sizeof(lines[0]), "%08x %d %.3f\n", rom_checksum, ref_ram_size, time*1000);
+
+  fd = fopen(ref_file, "w");
+  if(!fd) { perror("rom patch reference"); return; }
+  for(int i=0;i<n;i++) fputs(lines[i], fd);
+  fclose(fd);
+  printf("ROM patch: unpatched reference stored in %s\n", ref_file);
+}
+
+// identify the rom (words in file byte order) and apply the selected patches
+void rompatch_apply(uint16_t *rom, size_t words) {
+  uint32_t stored = (SWAP16(rom[0]) << 16) | SWAP16(rom[1]);
+  uint32_t sum = 0;
+  for(size_t i=2;i<words;i++) sum += SWAP16(rom[i]);
+
+  const char *name = NULL;
+  for(int i=0;known_roms[i].name;i++)
+    if(known_roms[i].checksum == stored) name = known_roms[i].name;
+
+  printf("ROM: %s, checksum %08x%s\n", name?name:"unknown ROM", stored, (sum == stored)?"":" (doesn't match contents)");
+
+  // only an intact ROM of a known revision is patched or used as reference
+  if(name && sum == stored) rom_checksum = stored;
+  if(ref_file && rom_checksum) ref_load();
+
+  if(!any_selected()) return;
+
+  if(!rom_checksum) {
+    printf("ROM patch: no patches for this ROM, not patched\n");
+    return;
+  }
+
+  // check all patches first, a ROM is either patched completely or not at all
+  for(int s=0;patch_sets[s];s++) {
+    if(!selected[s]) continue;
+
+    int found = 0;
+    for(const struct rom_patch *p = patches; p->set; p++) {
+      if(p->rom != rom_checksum || strcmp(p->set, patch_sets[s])) continue;
+
+      if(p->addr/2 >= words || SWAP16(rom[p->addr/2]) != p->orig) {
+	printf("ROM patch %s: expected %04x at %05x, not patched\n", p->set, p->orig, p->addr);
+	return;
+      }
+      found = 1;
+    }
+    if(!found) printf("ROM patch %s: no patches for this ROM\n", patch_sets[s]);
+  }
+
+  for(int s=0;patch_sets[s];s++) {
+    if(!selected[s]) continue;
+
+    for(const struct rom_patch *p = patches; p->set; p++) {
+      if(p->rom != rom_checksum || strcmp(p->set, patch_sets[s])) continue;
+
+      rom[p->addr/2] = SWAP16(p->patch);
+      printf("ROM patch %s: %s at %05x\n", p->set, p->what, p->addr);
+      patched++;
+    }
+  }
+}
+
+// called with the first disk access
+void rompatch_milestone(double time) {
+  static int reported = 0;
+  if(reported) return;
+  reported = 1;
+
+  printf("%.3fms Boot: first disk access%s\n", time*1000, patched?" with patched ROM":"");
+
+  if(!ref_file || !rom_checksum) return;
+
+  if(!patched) ref_store(time);
+  else if(ref_time < 0)
+    printf("ROM patch: no unpatched reference in %s, run once without --rom-patch\n", ref_file);
+  else
+    printf("ROM patch: %.3fms simulated time saved against unpatched %.3fms\n",
+	   (ref_time - time)*1000, ref_time*1000);
+}
@@ -0,0 +1,85 @@
+/*
+  scsibench.cpp
+
+  Benchmark of the SCSI hard disk path. Enabled with --scsi-bench it
+  counts the bytes the Mac transfers in the data phases of the SCSI
+  targets. The throughput is reported relative to the time the targets
+  were busy, which includes the command, status and message phases as
+  well as waiting for the SD card, and relative to the whole time
+  since the first command.
+
+  The number of sectors requested from the SD card is reported as
+  well. Without read ahead it equals the number of sectors read by the
+  Mac. Comparing a run with a simulation built with SCSI_NO_READAHEAD
+  shows the effect of the read ahead, e.g. when booting from a SCSI
+  image:
+
+    ./nanomac --floppy=none --scsi=boot_work.vhd --scsi-bench
+*/
+
+#include <stdio.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+
+static int bench_enabled = 0;
+
+static uint32_t commands, sd_reads;
+static uint64_t bytes_read, bytes_written;
+static double first_cmd = -1;
+static double busy_start = -1, busy_total;
+
+void scsibench_enable(void) {
+  bench_enabled = 1;
+}
+
+// to be called once per clock
+void scsibench_tick(Vnanomac_tb *tb, double time) {
+  static int last_bsy = 0, last_rd_ack = 0, last_wr_ack = 0, last_sd_rd = 0;
+
+  if(!bench_enabled) return;
+
+  if(tb->scsi_bsy && !last_bsy) {
+    if(first_cmd < 0) first_cmd = time;
+    busy_start = time;
+    commands++;
+  }
+  if(!tb->scsi_bsy && last_bsy) {
+    busy_total += time - busy_start;
+    busy_start = -1;
+  }
+
+  if(tb->scsi_rd_ack && !last_rd_ack) bytes_read++;
+  if(tb->scsi_wr_ack && !last_wr_ack) bytes_written++;
+  if(tb->scsi_sd_rd && !last_sd_rd) sd_reads++;
+
+  last_bsy = tb->scsi_bsy;
+  last_rd_ack = tb->scsi_rd_ack;
+  last_wr_ack = tb->scsi_wr_ack;
+  last_sd_rd = tb->scsi_sd_rd;
+}
+
+static double kbps(uint64_t bytes, double time) {
+  return (time > 0)?bytes/1024.0/time:0;
+}
+
+void scsibench_report(double time) {
+  if(!bench_enabled) return;
+
+  if(first_cmd < 0) {
+    printf("SCSI bench: no SCSI commands\n");
+    return;
+  }
+
+  // a command still in progress counts up to now
+  double busy = busy_total;
+  if(busy_start >= 0) busy += time - busy_start;
+
+  printf("SCSI bench: %u commands, %llu bytes read, %llu bytes written\n",
+	 commands, (unsigned long long)bytes_read, (unsigned long long)bytes_written);
+  printf("SCSI bench: %.3fms busy, %.1f KB/s while busy, %.1f KB/s since first command\n",
+	 1000*busy, kbps(bytes_read + bytes_written, busy),
+	 kbps(bytes_read + bytes_written, time - first_cmd));
+  printf("SCSI bench: %u sector reads from SD card for %llu sectors read\n",
+	 sd_reads, (unsigned long long)(bytes_read/512));
+}
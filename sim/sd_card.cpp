@@ -6,15 +6,30 @@
   SD card. The simulation thus includes the target device into the
   upper 8 bits of the LBA and this sd card simulation maps the
   request onto the four images files based on that.
+
+  The image files are mapped into memory once and shared by all
+  simulation instances. Sectors written by the Mac are kept per
+  instance, so the images themselves aren't modified unless
+  WRITE_BACK is defined.
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <ctype.h>
+#include <string.h>
 #include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "Vnanomac_tb.h"
+#include "floppy.h"
+#include "sim.h"
 
-const char *file_image[] = {
+// defaults, may be replaced with --floppy, --floppy2, --scsi and --scsi2
+static const char *file_image[] = {
   "./MacSTBlast.dsk", // internal floppy
   // "./FloppyWrite.dsk", // internal floppy
   // NULL, // "../disks/system30_minimal_work.dsk", // internal floppy
@@ -22,6 +37,15 @@ const char *file_image[] = {
   NULL, // "./boot_work.vhd",                  // SCSI HDD #1
   NULL
 };
+
+// "none" leaves the drive empty
+void sd_set_image(int drive, const char *name) {
+  file_image[drive] = strcmp(name, "none")?name:NULL;
+}
+
+const char *sd_get_image(int drive) {
+  return file_image[drive];
+}
   
 // #define WRITE_BACK
 
@@ -44,7 +68,7 @@ const char *file_image[] = {
 // in between fails sometimes/later
 #define READ_BUSY_COUNT 1000
 
-extern char *sector_string(int drive, uint32_t lba);
+extern void rompatch_milestone(double time);
 
 static void hexdump(void *data, int size) {
   int i, b2c;
@@ -189,186 +213,242 @@ static void update_crc(uint8_t *sector_data) {
 // total cid respose is 136 bits / 17 bytes
 unsigned char cid[17] = "\x3f" "\x02TMS" "A08G" "\x14\x39\x4a\x67" "\xc7\x00\xe4";
 
-static FILE *fd[4] = { NULL, NULL, NULL, NULL };
+// images shared by all instances
+static const uint8_t *image_data[4] = { NULL, NULL, NULL, NULL };
+static long image_size[4];
+
+// floppy disk lba to side/track/sector translation
+static char *sector_string(int drive, uint32_t lba, char *str) {
+  int side, track, sector;
 
-void fdclose(void) {
-  for(int i=0;i<4;i++) {  
-    if(fd[i]) {
+  if(drive < 2) {  
+    if(floppy_chs(floppy_sides(image_size[drive]), lba, &side, &track, &sector))
+      sprintf(str, "<out of range %u>", lba);
+    else
+      sprintf(str, "CHS %d/%d/%d", track, side, sector);
+    
+    return str;
+  }
+
+  strcpy(str, "");
+  return str;
+}
+
+static void sd_close_images(void) {
+  for(int i=0;i<4;i++) {
+    if(image_data[i]) {
       printf("closing file image %d\n", i);
-      fclose(fd[i]);
-      fd[i] = NULL;
+      munmap((void*)image_data[i], image_size[i]);
+      image_data[i] = NULL;
     }
   }
 }
 
-void sd_handle(float ms, Vnanomac_tb *tb)  {
-  static int last_sdclk = -1;
-  static unsigned long sector = 0xffffffff;
-  static unsigned long long flen;
-  static uint8_t sector_data[520];   // 512 bytes + four 16 bit crcs
-  static long long cmd_in = -1;
-  static long long cmd_out = -1;
-  static unsigned char *cmd_ptr = 0;
-  static int cmd_bits = 0;
-  static unsigned char *dat_ptr = 0;
-  static int dat_write = 0;
-  static int dat_bits = 0;
-  static unsigned long dat_arg;
-  static int last_was_acmd = 0;
-  static int write_busy = 0;
-  static int read_busy = 0;
-  
-  // ----------------- simulate disk image insertion --------------------------
-  static int insert_counter = 0;
-  static int size;
-  
-  if(insert_counter < 4000) {
-    int drive = insert_counter/1000;
-    int cnt = insert_counter%1000;
+// map all images into memory, to be called once before any instance runs
+void sd_open_images(void) {
+  for(int i=0;i<4;i++) {
+    if(!file_image[i]) continue;
+
+    int fd = open(file_image[i], O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0 || !st.st_size) {
+      printf("DRV %d: unable to open %s\n", i, file_image[i]);
+      if(fd >= 0) close(fd);
+      continue;
+    }
 
-    if(insert_counter == 10)
-      atexit(fdclose);
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+      perror("mmap()");
+      continue;
+    }
 
-    if(cnt == 300) {
-      if(file_image[drive])
-	fd[drive] = fopen(file_image[drive], "r+b");
-      
-      if(fd[drive]) {	
-	fseek(fd[drive], 0, SEEK_END);
-	size = ftello(fd[drive]);
-	printf("%.3fms DRV %d mounting %s, size = %d\n", ms, drive, file_image[drive], size);
-	fseek(fd[drive], 0, SEEK_SET);
-	tb->image_size = size;
-	tb->sddat_in = 15;	    
-      }
+    image_data[i] = (const uint8_t*)data;
+    image_size[i] = st.st_size;
+  }
+
+  atexit(sd_close_images);
+}
+
+void sd_init(struct sd_card *sd, int quiet) {
+  memset(sd, 0, sizeof(struct sd_card));
+  sd->quiet = quiet;
+  sd->last_sdclk = -1;
+  sd->cmd_in = -1;
+  sd->cmd_out = -1;
+}
+
+void sd_free(struct sd_card *sd) {
+  for(int i=0;i<4;i++) {
+    if(!sd->written[i]) continue;
+    for(long s=0;s<image_size[i]/512;s++) free(sd->written[i][s]);
+    free(sd->written[i]);
+    sd->written[i] = NULL;
+  }
+}
+
+// sector as seen by this instance, NULL if there's no such sector
+static const uint8_t *sd_sector(struct sd_card *sd, int drive, uint32_t lba) {
+  if(!image_data[drive] || lba >= image_size[drive]/512) return NULL;
+  if(sd->written[drive] && sd->written[drive][lba]) return sd->written[drive][lba];
+  return image_data[drive] + 512l*lba;
+}
+
+static void sd_store(struct sd_card *sd, int drive, uint32_t lba, const uint8_t *data) {
+  long sectors = image_size[drive]/512;
+  if(!image_data[drive] || lba >= sectors) return;
+
+  if(!sd->written[drive]) sd->written[drive] = (uint8_t**)calloc(sectors, sizeof(uint8_t*));
+  if(!sd->written[drive][lba]) sd->written[drive][lba] = (uint8_t*)malloc(512);
+  memcpy(sd->written[drive][lba], data, 512);
+
+#ifdef WRITE_BACK
+  FILE *fd = fopen(file_image[drive], "r+b");
+  if(!fd || fseek(fd, 512l * lba, SEEK_SET) || fwrite(data, 2, 256, fd) != 256) {
+    printf("SDC WRITE ERROR\n");
+    exit(-1);
+  }
+  fclose(fd);
+#endif
+}
+
+static void sd_log(struct sd_card *sd, const char *fmt, ...) {
+  if(sd->quiet) return;
+
+  va_list args;
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+}
+
+void sd_handle(struct sd_card *sd, float ms, Vnanomac_tb *tb)  {
+  // ----------------- simulate disk image insertion --------------------------
+  if(sd->insert_counter < 4000) {
+    int drive = sd->insert_counter/1000;
+    int cnt = sd->insert_counter%1000;
+
+    if(cnt == 300 && image_data[drive]) {
+      sd_log(sd, "%.3fms DRV %d mounting %s, size = %ld\n", ms, drive, file_image[drive], image_size[drive]);
+      tb->image_size = image_size[drive];
+      tb->sddat_in = 15;
     }
     
-    if(fd[drive]) {
+    if(image_data[drive]) {
       if( cnt == 350 ) tb->image_mounted = 1<<drive;
       if( cnt == 351 ) tb->image_mounted = 0;
     }
     
-    insert_counter++;
+    sd->insert_counter++;
   }
       
   // ----------------- simulate sd card itself --------------------------
-  if(tb->sdclk != last_sdclk) {
+  if(tb->sdclk != sd->last_sdclk) {
     // rising sd card clock edge
     if(tb->sdclk) {
-      cmd_in = ((cmd_in << 1) | tb->sdcmd) & 0xffffffffffffll;
+      sd->cmd_in = ((sd->cmd_in << 1) | tb->sdcmd) & 0xffffffffffffll;
 
-      if(dat_write) {
+      if(sd->dat_write) {
 	// core writes to sd card
-	if(dat_ptr && dat_bits) {
+	if(sd->dat_ptr && sd->dat_bits) {
 	  // 128*8 + 16 + 1 + 1
-	  // printf("%.3fms SDC: WRITE %d %x\n", ms, dat_bits, tb->sddat);
-	  if(dat_bits == 128*8 + 16 + 1 + 1 + 4) {
+	  // sd_log(sd, "%.3fms SDC: WRITE %d %x\n", ms, sd->dat_bits, tb->sddat);
+	  if(sd->dat_bits == 128*8 + 16 + 1 + 1 + 4) {
 	    // wait for start bit(s)
 	    if(tb->sddat != 0xf) {	    
-	      // printf("%.3fms SDC: WRITE-4 START %x\n", ms, tb->sddat);	    
-	      dat_bits--;
+	      // sd_log(sd, "%.3fms SDC: WRITE-4 START %x\n", ms, tb->sddat);	    
+	      sd->dat_bits--;
 	    }
-	  } else if(dat_bits > 1) {
-	    if(dat_bits > 1+4) { 
-	      int nibble = dat_bits&1;   // 1: high nibble, 0: low nibble
-	      if(nibble) *dat_ptr   = (*dat_ptr & 0x0f) | (tb->sddat<<4);
-	      else       *dat_ptr++ = (*dat_ptr & 0xf0) |  tb->sddat;
+	  } else if(sd->dat_bits > 1) {
+	    if(sd->dat_bits > 1+4) { 
+	      int nibble = sd->dat_bits&1;   // 1: high nibble, 0: low nibble
+	      if(nibble) *sd->dat_ptr   = (*sd->dat_ptr & 0x0f) | (tb->sddat<<4);
+	      else       *sd->dat_ptr++ = (*sd->dat_ptr & 0xf0) |  tb->sddat;
 	    } else tb->sddat_in = 0;  // send 4 wack bits
 	    
-	    dat_bits--;
+	    sd->dat_bits--;
 	  } else {
-	    write_busy = 100;
+	    sd->write_busy = 100;
 	    // tb->sddat_in = 1;
 	    
 	    // save received crc
 	    uint8_t crc_rx[8];
-	    memcpy(crc_rx, sector_data+512, 8);    // copy supplied crc
-	    update_crc(sector_data);               // recalc it
+	    memcpy(crc_rx, sd->sector_data+512, 8);    // copy supplied crc
+	    update_crc(sd->sector_data);               // recalc it
 
 	    // and compare it
-	    // printf("%.3fms SDC: WRITE DATA CRC is %s\n", ms, memcmp(sector_data+512, crc_rx, 8)?"INVALID!!!":"ok");
-	    if(memcmp(sector_data+512, crc_rx, 8)) {
+	    // printf("%.3fms SDC: WRITE DATA CRC is %s\n", ms, memcmp(sd->sector_data+512, crc_rx, 8)?"INVALID!!!":"ok");
+	    if(memcmp(sd->sector_data+512, crc_rx, 8)) {
 	      printf(RED "CRC received: "); hexdump(crc_rx, 8);
-	      printf("CRC expected: "); hexdump(sector_data+512, 8);
+	      printf("CRC expected: "); hexdump(sd->sector_data+512, 8);
 	      printf("" END);
-	    } else {
+	    } else if(!sd->quiet) {
 	      printf(GREEN "CRC ok: "); hexdump(crc_rx, 8);
 	      printf("" END);
 	    }
 
-	    int i = dat_arg >> 24;
+	    int i = sd->dat_arg >> 24;
 	    int drive = 0;
 	    while(!(i&1)) { drive++; i>>=1; }
-	    int lba = dat_arg & 0xffffff;
-
-	    if(fd[drive]) {
-	      uint8_t ref[512];
+	    int lba = sd->dat_arg & 0xffffff;
 
-	      // read original sector for comparison
-	      fseek(fd[drive], 512 * lba, SEEK_SET);
-	      int items = fread(ref, 2, 256, fd[drive]);
-	      if(items != 256) perror("fread()");
-
-	      hexdiff(sector_data, ref, 512);
-	    } else 	    
-	      hexdump(sector_data, 520);
+	    // compare against the sector as it was before
+	    const uint8_t *ref = sd_sector(sd, drive, lba);
+	    if(!sd->quiet) {
+	      if(ref) hexdiff(sd->sector_data, (void*)ref, 512);
+	      else    hexdump(sd->sector_data, 520);
+	    }
 
-#ifdef WRITE_BACK
-	    fseek(fd[drive], 512 * lba, SEEK_SET);
-	    if(fwrite(sector_data, 2, 256, fd[drive]) != 256) {
-	      printf("SDC WRITE ERROR\n");
-	      exit(-1);
-	    }	    
-	    fflush(fd[drive]);
-#endif
-	    dat_bits--;
+	    sd_store(sd, drive, lba, sd->sector_data);
+	    sd->writes++;
+	    sd->dat_bits--;
 	  }
 	}
-	else if(write_busy) {
-	  write_busy--;	  
-	  tb->sddat_in = write_busy?0:15;
+	else if(sd->write_busy) {
+	  sd->write_busy--;	  
+	  tb->sddat_in = sd->write_busy?0:15;
 	}
       } else {      
 	// core reads from sd card
 	
 	// sending 4 data bits
-	if(dat_ptr && dat_bits) {
-	  if(read_busy) {
+	if(sd->dat_ptr && sd->dat_bits) {
+	  if(sd->read_busy) {
 	    tb->sddat_in = 15;	    
-	    read_busy--;
+	    sd->read_busy--;
 	  } else {
-	    if(dat_bits == 128*8 + 16 + 1 + 1) {
+	    if(sd->dat_bits == 128*8 + 16 + 1 + 1) {
 	      // card sends start bit
 	      tb->sddat_in = 0;
-	      // printf("%.3fms SDC: READ-4 START\n", ms);
-	    } else if(dat_bits > 1) {
-	      // if(dat_bits == 128*8 + 16 + 1) printf("%.3fms SDC: READ DATA START\n", ms);
-	      int nibble = dat_bits&1;   // 1: high nibble, 0: low nibble
-	      if(nibble) tb->sddat_in = (*dat_ptr >> 4)&15;
-	      else       tb->sddat_in = *dat_ptr++ & 15;
+	      // sd_log(sd, "%.3fms SDC: READ-4 START\n", ms);
+	    } else if(sd->dat_bits > 1) {
+	      // if(sd->dat_bits == 128*8 + 16 + 1) sd_log(sd, "%.3fms SDC: READ DATA START\n", ms);
+	      int nibble = sd->dat_bits&1;   // 1: high nibble, 0: low nibble
+	      if(nibble) tb->sddat_in = (*sd->dat_ptr >> 4)&15;
+	      else       tb->sddat_in = *sd->dat_ptr++ & 15;
 	    } else
 	      tb->sddat_in = 15;
 	    
-	    dat_bits--;
+	    sd->dat_bits--;
 	  }
 	}
       }
       
-      if(cmd_ptr && cmd_bits) {
-        int bit = 7-((cmd_bits-1) & 7);
-        tb->sdcmd_in = (*cmd_ptr & (0x80>>bit))?1:0;
-        if(bit == 7) cmd_ptr++;
-        cmd_bits--;
+      if(sd->cmd_ptr && sd->cmd_bits) {
+        int bit = 7-((sd->cmd_bits-1) & 7);
+        tb->sdcmd_in = (*sd->cmd_ptr & (0x80>>bit))?1:0;
+        if(bit == 7) sd->cmd_ptr++;
+        sd->cmd_bits--;
       } else {      
-        tb->sdcmd_in = (cmd_out & (1ll<<47))?1:0;
-        cmd_out = (cmd_out << 1)|1;
+        tb->sdcmd_in = (sd->cmd_out & (1ll<<47))?1:0;
+        sd->cmd_out = (sd->cmd_out << 1)|1;
       }
       
       // check if bit 47 is 0, 46 is 1 and 0 is 1
-      if( !(cmd_in & (1ll<<47)) && (cmd_in & (1ll<<46)) && (cmd_in & (1ll<<0))) {
-        unsigned char cmd  = (cmd_in >> 40) & 0x7f;
-        unsigned long arg  = (cmd_in >>  8) & 0xffffffff;
-        unsigned char crc7 = cmd_in & 0xfe;
+      if( !(sd->cmd_in & (1ll<<47)) && (sd->cmd_in & (1ll<<46)) && (sd->cmd_in & (1ll<<0))) {
+        unsigned char cmd  = (sd->cmd_in >> 40) & 0x7f;
+        unsigned long arg  = (sd->cmd_in >>  8) & 0xffffffff;
+        unsigned char crc7 = sd->cmd_in & 0xfe;
 	
         // r1 reply:
         // bit 7 - 0
@@ -381,37 +461,38 @@ void sd_handle(float ms, Vnanomac_tb *tb)  {
         // bit 0 - in idle state
 
         if(crc7 == getCRC(cmd, arg)) {
-          printf("%.3fms SDC: %sCMD %2d, ARG %08lx\n", ms, last_was_acmd?"A":"", cmd & 0x3f, arg);
+	  char str[32];
+          sd_log(sd, "%.3fms SDC: %sCMD %2d, ARG %08lx\n", ms, sd->last_was_acmd?"A":"", cmd & 0x3f, arg);
           switch(cmd & 0x3f) {
           case 0:  // Go Idle State
             break;
           case 8:  // Send Interface Condition Command
-            cmd_out = reply(8, arg);
+            sd->cmd_out = reply(8, arg);
             break;
           case 55: // Application Specific Command
-            cmd_out = reply(55, 0);
+            sd->cmd_out = reply(55, 0);
             break;
           case 41: // Send Host Capacity Support
-            cmd_out = reply(63, OCR);
+            sd->cmd_out = reply(63, OCR);
             break;
           case 2:  // Send CID
             cid[16] = getCRC_bytes(cid, 16) | 1;  // Adjust CRC
-            cmd_ptr = cid;
-            cmd_bits = 136;
+            sd->cmd_ptr = cid;
+            sd->cmd_bits = 136;
             break;
            case 3:  // Send Relative Address
-            cmd_out = reply(3, (RCA<<16) | 0);  // status = 0
+            sd->cmd_out = reply(3, (RCA<<16) | 0);  // status = 0
             break;
           case 7:  // select card
-            cmd_out = reply(7, 0);    // may indicate busy          
+            sd->cmd_out = reply(7, 0);    // may indicate busy          
             break;
           case 6:  // set bus width
-            printf("%.3fms SDC: Set bus width to %ld\n", ms, arg);
-            cmd_out = reply(6, 0);
+            sd_log(sd, "%.3fms SDC: Set bus width to %ld\n", ms, arg);
+            sd->cmd_out = reply(6, 0);
             break;
           case 16: // set block len (should be 512)
-            printf("%.3fms SDC: Set block len to %ld\n", ms, arg);
-            cmd_out = reply(16, 0);    // ok
+            sd_log(sd, "%.3fms SDC: Set block len to %ld\n", ms, arg);
+            sd->cmd_out = reply(16, 0);    // ok
             break;
           case 17: { // read block
 	    int i = arg >> 24;
@@ -419,28 +500,31 @@ void sd_handle(float ms, Vnanomac_tb *tb)  {
 	    while(!(i&1)) { drive++; i>>=1; }
 	    int lba = arg & 0xffffff;
 
-            printf("%.3fms SDC: Request #%d to read single block %d (%s)\n", ms,
-		   drive, lba, sector_string(drive, lba));
-            cmd_out = reply(17, 0);    // ok
+            sd_log(sd, "%.3fms SDC: Request #%d to read single block %d (%s)\n", ms,
+		   drive, lba, sector_string(drive, lba, str));
+            sd->cmd_out = reply(17, 0);    // ok
+	    if(!sd->quiet) rompatch_milestone(ms/1000);
 
-	    if(fd[drive]) {
+	    const uint8_t *data = sd_sector(sd, drive, lba);
+	    sd->reads++;
+	    if(data) {
 	      // load sector
-	      fseek(fd[drive], 512 * lba, SEEK_SET);
-	      int items = fread(sector_data, 2, 256, fd[drive]);
-	      if(items != 256) perror("fread()");
-
-	      hexdump(sector_data, 32);
+	      memcpy(sd->sector_data, data, 512);
+	      if(!sd->quiet) hexdump(sd->sector_data, 32);
+	    } else if(image_data[drive]) {
+	      sd_log(sd, "%.3fms SDC: Sector beyond end of image, sending empty data\n", ms);
+	      memset(sd->sector_data, 0, 512);
 	    } else {
-	      printf("%.3fms SDC: No image loaded, sending empty data\n", ms);
-	      memset(sector_data, 0, 512);
+	      sd_log(sd, "%.3fms SDC: No image loaded, sending empty data\n", ms);
+	      memset(sd->sector_data, 0, 512);
 	    }
 
-	    update_crc(sector_data);
-            dat_ptr = sector_data;
-            dat_write = 0;
-            dat_bits = 128*8 + 16 + 1 + 1;
+	    update_crc(sd->sector_data);
+            sd->dat_ptr = sd->sector_data;
+            sd->dat_write = 0;
+            sd->dat_bits = 128*8 + 16 + 1 + 1;
 
-	    read_busy = READ_BUSY_COUNT;  // some delay to simulate card actually doing some read
+	    sd->read_busy = READ_BUSY_COUNT;  // some delay to simulate card actually doing some read
 	  } break;
             
           case 24: {  // write block
@@ -448,29 +532,29 @@ void sd_handle(float ms, Vnanomac_tb *tb)  {
 	    int drive = 0;
 	    while(!(i&1)) { drive++; i>>=1; }
 
-            printf("%.3fms SDC: Request #%d to write single block %ld (%s)\n", ms,
-		   drive, arg&0xffffff, sector_string(drive, arg&0xffffff));
-            cmd_out = reply(24, 0);    // ok
+            sd_log(sd, "%.3fms SDC: Request #%d to write single block %ld (%s)\n", ms,
+		   drive, arg&0xffffff, sector_string(drive, arg&0xffffff, str));
+            sd->cmd_out = reply(24, 0);    // ok
 	    
 	    // prepare to receive data
-	    dat_arg = arg;
-            dat_ptr = sector_data;
-            dat_write = 1;
-            dat_bits = 128*8 + 16 + 1 + 1 + 4;
+	    sd->dat_arg = arg;
+            sd->dat_ptr = sd->sector_data;
+            sd->dat_write = 1;
+            sd->dat_bits = 128*8 + 16 + 1 + 1 + 4;
 
 	  } break;
 
           default:
-            printf("%.3fms SDC: unexpected command\n", ms);
+            sd_log(sd, "%.3fms SDC: unexpected command\n", ms);
           }
 
-          last_was_acmd = (cmd & 0x3f) == 55;
+          sd->last_was_acmd = (cmd & 0x3f) == 55;
           
-          cmd_in = -1;
+          sd->cmd_in = -1;
         } else
-          printf("%.3fms SDC: CMD %02x, ARG %08lx, CRC7 %02x != %02x!!\n", ms, cmd, arg, crc7, getCRC(cmd, arg));         
+          sd_log(sd, "%.3fms SDC: CMD %02x, ARG %08lx, CRC7 %02x != %02x!!\n", ms, cmd, arg, crc7, getCRC(cmd, arg));         
       }      
     }      
-    last_sdclk = tb->sdclk;     
+    sd->last_sdclk = tb->sdclk;     
   }
 }      
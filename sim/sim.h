@@ -0,0 +1,99 @@
+/*
+  sim.h
+
+  State of a single simulated Mac. Several of them may run in one
+  process, each in a thread of its own. Everything that changes while
+  a Mac is being simulated is kept here. The ROM and the disk images
+  are only read and are shared by all instances.
+
+  Only the main instance has video, audio, the serial port, the stop
+  conditions, the checks and the benchmarks attached.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <cstdint>
+
+#include "frame.h"
+
+class Vnanomac_tb;
+class VerilatedContext;
+
+// sd card as seen by a single instance
+struct sd_card {
+  int quiet;                  // don't log commands and sectors
+
+  int last_sdclk;
+  uint8_t sector_data[520];   // 512 bytes + four 16 bit crcs
+  long long cmd_in, cmd_out;
+  unsigned char *cmd_ptr;
+  int cmd_bits;
+  unsigned char *dat_ptr;
+  int dat_write, dat_bits;
+  unsigned long dat_arg;
+  int last_was_acmd;
+  int write_busy, read_busy;
+  int insert_counter;
+  uint32_t reads, writes;     // sectors transferred
+
+  // sectors written by this instance, the shared images stay untouched
+  uint8_t **written[4];
+};
+
+// The RAM can be simulated in three ways. The "sram" mode uses a
+// simple sram like model and bypasses the sdram controller. This
+// is the fastest. The "sdram" mode simulates the sdram chip at pin
+// level and thus also tests the sdram controller. The "check" mode
+// runs both and compares them against each other.
+#define MEM_SRAM   0
+#define MEM_SDRAM  1
+#define MEM_CHECK  2
+
+#define MEMCHECK_LOG_SIZE 32
+
+struct memcheck_entry {
+  int kind;
+  uint32_t addr;              // byte address
+  double time;                // first occurrence
+  uint16_t sram, sdram;       // data at first occurrence
+  unsigned long count;
+};
+
+struct sim {
+  int id;
+  int is_main;                // the instance everything else is attached to
+
+  VerilatedContext *context;
+  Vnanomac_tb *tb;
+  double time;                // simulated time in seconds
+
+  int mem_mode;
+  uint16_t *ram;              // sram like model, 4 Megabytes
+  uint32_t *sdram;            // the sdram, 2M 32 bit words
+
+  // state kept by tick() between clocks
+  int leds;
+  int sdram_addr, sdram_ba;
+  int ram_cycle_selected;
+  int last_hs_n;
+  uint32_t budget_ticks;
+  uint64_t speed_start_ms;    // real time the speed factor is measured from
+
+  // state kept by state_tick() and floppybench_tick() between clocks
+  int state_last_as_n;
+  uint64_t state_cycle;       // last state of the current cpu bus cycle
+  int floppy_last_rd, floppy_last_wr;
+
+  // log of sram/sdram mismatches
+  struct memcheck_entry memcheck_log[MEMCHECK_LOG_SIZE];
+  int memcheck_entries;
+  unsigned long memcheck_total[3];
+  unsigned long memcheck_dropped;
+
+  struct sd_card sd;
+  struct frame_grabber grabber;
+  struct frame frame;         // last completed frame
+};
+
+#endif // SIM_H
@@ -0,0 +1,252 @@
+/*
+  snapshot.cpp
+
+  Memory snapshots of the main instance. --snapshot=WHEN:FILE saves
+  the memory when the simulated time reaches WHEN seconds, when frame
+  N has been completed (frame:N:FILE) or when the run ends
+  (end:FILE). The option may be given several times.
+
+  A snapshot file is a small header followed by the raw contents of
+  the sram model (configured RAM size) and/or the sdram (8MB),
+  whichever the memory simulation mode uses:
+
+    char     magic[8]      "NMSNAP1"
+    double   time          simulated time in seconds
+    uint32_t ram_bytes     size of the sram block, 0 if not simulated
+    uint32_t sdram_bytes   size of the sdram block, 0 if not simulated
+
+  --snapshot-diff=FILE1,FILE2 compares two snapshots without running
+  the simulation. Both blocks are compared in 64 byte chunks of 64 bit
+  words, which the compiler vectorizes, and only the changed chunks are
+  examined further. Changes less than SNAP_GAP bytes apart are merged
+  into ranges, and a summary of the ranges is printed instead of a
+  hexdump. The ranges are 8 byte aligned, so both blocks can be taken
+  as the CPU's address space despite their different byte order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstdint>
+#include <vector>
+
+#include "sim.h"
+
+#define SNAP_MAGIC   "NMSNAP1"
+#define SNAP_GAP     64     // merge changes closer than this
+#define SNAP_RANGES  32     // ranges listed per block
+
+#define SDRAM_BYTES  (8*1024*1024)
+
+struct snapshot_header {
+  char magic[8];
+  double time;
+  uint32_t ram_bytes;
+  uint32_t sdram_bytes;
+};
+
+#define AT_TIME   0
+#define AT_FRAME  1
+#define AT_END    2
+
+struct snapshot_req {
+  int kind;
+  double time;
+  uint32_t frame;
+  const char *name;
+  int done;
+};
+
+static std::vector<struct snapshot_req> reqs;
+static uint32_t ram_bytes;
+static double next_time = -1;     // earliest pending time trigger
+
+static void update_next_time(void) {
+  next_time = -1;
+  for(auto &r : reqs)
+    if(r.kind == AT_TIME && !r.done && (next_time < 0 || r.time < next_time))
+      next_time = r.time;
+}
+
+void snapshot_add(const char *spec, int ram_size) {
+  static const uint32_t sizes[] = { 128*1024, 512*1024, 1024*1024, 4096*1024 };
+  ram_bytes = sizes[ram_size & 3];
+
+  struct snapshot_req r = { AT_TIME, 0, 0, NULL, 0 };
+  const char *arg = spec;
+
+  if(!strncmp(arg, "end:", 4)) {
+    r.kind = AT_END;
+    arg += 4;
+  } else if(!strncmp(arg, "frame:", 6)) {
+    r.kind = AT_FRAME;
+    r.frame = strtoul(arg+6, (char**)&arg, 0);
+    if(*arg++ != ':') { printf("Expecting --snapshot=frame:N:FILE\n"); exit(-1); }
+  } else {
+    r.time = strtod(arg, (char**)&arg);
+    if(*arg++ != ':') { printf("Expecting --snapshot=SECONDS:FILE\n"); exit(-1); }
+  }
+
+  if(!*arg) { printf("Snapshot '%s' needs a file name\n", spec); exit(-1); }
+  r.name = arg;
+  reqs.push_back(r);
+  update_next_time();
+}
+
+static void snapshot_save(const struct sim *s, const char *name) {
+  struct snapshot_header h;
+  memset(&h, 0, sizeof(h));
+  strcpy(h.magic, SNAP_MAGIC);
+  h.time = s->time;
+  h.ram_bytes = (s->mem_mode != MEM_SDRAM)?ram_bytes:0;
+  h.sdram_bytes = (s->mem_mode != MEM_SRAM)?SDRAM_BYTES:0;
+
+  FILE *fd = fopen(name, "wb");
+  if(!fd) { perror(name); return; }
+  if(fwrite(&h, sizeof(h), 1, fd) != 1 ||
+     (h.ram_bytes && fwrite(s->ram, h.ram_bytes, 1, fd) != 1) ||
+     (h.sdram_bytes && fwrite(s->sdram, h.sdram_bytes, 1, fd) != 1))
+    perror(name);
+  fclose(fd);
+
+  printf("%.3fms Snapshot: %s saved\n", s->time*1000, name);
+}
+
+// to be called once per clock
+void snapshot_tick(const struct sim *s) {
+  if(next_time < 0 || s->time < next_time) return;
+
+  for(auto &r : reqs)
+    if(r.kind == AT_TIME && !r.done && s->time >= r.time) {
+      snapshot_save(s, r.name);
+      r.done = 1;
+    }
+  update_next_time();
+}
+
+// to be called for every completed frame
+void snapshot_frame(const struct sim *s, const struct frame *f) {
+  for(auto &r : reqs)
+    if(r.kind == AT_FRAME && !r.done && f->number >= r.frame) {
+      snapshot_save(s, r.name);
+      r.done = 1;
+    }
+}
+
+void snapshot_end(const struct sim *s) {
+  for(auto &r : reqs)
+    if(r.kind == AT_END && !r.done) {
+      snapshot_save(s, r.name);
+      r.done = 1;
+    }
+}
+
+static uint8_t *snapshot_load(const char *name, struct snapshot_header *h) {
+  FILE *fd = fopen(name, "rb");
+  if(!fd) { perror(name); return NULL; }
+
+  if(fread(h, sizeof(*h), 1, fd) != 1 || memcmp(h->magic, SNAP_MAGIC, 8) ||
+     (h->ram_bytes & 63) || (h->sdram_bytes & 63)) {
+    printf("%s is not a snapshot\n", name);
+    fclose(fd);
+    return NULL;
+  }
+
+  size_t size = (size_t)h->ram_bytes + h->sdram_bytes;
+  uint8_t *data = (uint8_t*)malloc(size?size:1);
+  if(size && fread(data, size, 1, fd) != 1) {
+    printf("%s is truncated\n", name);
+    free(data);
+    data = NULL;
+  }
+  fclose(fd);
+  return data;
+}
+
+// number of differing bytes in two 64 bit words
+static inline int bytes_changed(uint64_t x) {
+  int n = 0;
+  for(;x;x>>=8) if(x & 0xff) n++;
+  return n;
+}
+
+static uint32_t diff_block(const char *name, const uint8_t *a, const uint8_t *b, uint32_t size) {
+  const uint64_t *wa = (const uint64_t*)a, *wb = (const uint64_t*)b;
+  uint32_t words = size / 8;
+  uint32_t changed = 0, ranges = 0;
+  uint32_t start = 0, end = 0, count = 0;    // current range in bytes
+
+  printf("Snapshot diff: %s, %u bytes\n", name, size);
+
+  for(uint32_t c=0;c<words;c+=8) {
+    // a whole chunk at once, vectorized
+    uint64_t any = 0;
+    for(int i=0;i<8;i++) any |= wa[c+i] ^ wb[c+i];
+    if(!any) continue;
+
+    for(int i=0;i<8;i++) {
+      uint64_t x = wa[c+i] ^ wb[c+i];
+      if(!x) continue;
+
+      uint32_t addr = 8*(c+i);
+      int n = bytes_changed(x);
+      changed += n;
+
+      if(count && addr - end < SNAP_GAP) {
+	end = addr + 8;
+	count += n;
+	continue;
+      }
+
+      if(count && ranges++ < SNAP_RANGES)
+	printf("  %06x-%06x %8u bytes\n", start, end-1, count);
+      start = addr;
+      end = addr + 8;
+      count = n;
+    }
+  }
+  if(count && ranges++ < SNAP_RANGES)
+    printf("  %06x-%06x %8u bytes\n", start, end-1, count);
+  if(ranges > SNAP_RANGES)
+    printf("  ... %u more ranges\n", ranges - SNAP_RANGES);
+
+  printf("Snapshot diff: %s, %u bytes changed in %u ranges\n", name, changed, ranges);
+  return changed;
+}
+
+// compare two snapshot files, returns 1 if they differ
+int snapshot_diff(const char *spec) {
+  char name[256];
+  strncpy(name, spec, sizeof(name)-1);
+  name[sizeof(name)-1] = 0;
+
+  char *comma = strchr(name, ',');
+  if(!comma) { printf("Expecting --snapshot-diff=FILE1,FILE2\n"); return -1; }
+  *comma = 0;
+
+  struct snapshot_header ha, hb;
+  uint8_t *a = snapshot_load(name, &ha);
+  uint8_t *b = snapshot_load(comma+1, &hb);
+  if(!a || !b) { free(a); free(b); return -1; }
+
+  printf("Snapshot diff: %s at %.3fms, %s at %.3fms\n", name, ha.time*1000, comma+1, hb.time*1000);
+
+  int differ = 0;
+  if(ha.ram_bytes && ha.ram_bytes == hb.ram_bytes) {
+    if(diff_block("ram", a, b, ha.ram_bytes)) differ = 1;
+  } else if(ha.ram_bytes || hb.ram_bytes) {
+    printf("Snapshot diff: ram sizes differ, %u and %u bytes\n", ha.ram_bytes, hb.ram_bytes);
+    differ = 1;
+  }
+
+  if(ha.sdram_bytes && ha.sdram_bytes == hb.sdram_bytes) {
+    if(diff_block("sdram", a + ha.ram_bytes, b + hb.ram_bytes, ha.sdram_bytes)) differ = 1;
+  } else if(ha.sdram_bytes || hb.sdram_bytes) {
+    printf("Snapshot diff: sdram sizes differ, %u and %u bytes\n", ha.sdram_bytes, hb.sdram_bytes);
+    differ = 1;
+  }
+
+  free(a);
+  free(b);
+  return differ;
+}
@@ -0,0 +1,183 @@
+/*
+  sndbench.cpp
+
+  Benchmark for audio replay routines like NanoMacTracker which do all
+  their work in the VBL interrupt. Enabled with --sound-bench it
+  reports:
+
+  - The CPU time spent in interrupt handlers per frame. A handler is
+    timed from its interrupt acknowledge cycle until its RTE, the same
+    way as --irq-bench does it (see irqhandler.cpp). Handlers
+    interrupting another one are part of its time and not counted
+    again. The remaining time of the frame is what's left to the main
+    task.
+
+  - Whether samples have been repeated or dropped. Every CPU write into
+    the sound buffer and every sound fetch of the video circuit is
+    tracked per buffer slot. Fetching a slot that hasn't been written
+    since its last fetch plays a sample twice, writing a slot twice
+    before it's fetched drops a sample.
+
+  Measurement starts once the sound buffer has been rewritten completely
+  for BENCH_START_FRAMES frames in a row, so the boot phase doesn't
+  count. With --sound-bench=SECONDS it starts at a fixed time instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+#include "irqhandler.h"
+
+#define BENCH_START_FRAMES  3
+#define CPU_CLOCK           8000000   // clk8_en of the 16MHz clock, see clocks.v
+#define SOUND_SLOTS         370       // one word per video line
+#define FC_IACK             7
+
+// word addresses of the main and alternate sound buffer (4MB), see addrController.v
+#define SOUND_MAIN          0x1FFE80
+#define SOUND_ALT           0x1FD080
+
+static int bench_enabled = 0;
+static double bench_start = -1;       // < 0 = start automatically
+static int bench_running = 0;
+static uint32_t ram_mask;             // word address mask for the RAM size
+
+static uint8_t slot_writes[2][SOUND_SLOTS];  // writes since last fetch
+static int frame_fresh;               // fetches of freshly written slots this frame
+static int frames_fresh_in_row;
+
+// totals while running
+static uint32_t frames;
+static double first_frame, last_frame;
+static uint64_t fetches, repeated, dropped;
+static uint32_t irqs;
+static double busy_frame, busy_total;
+static double load_min = 1, load_max = 0;
+
+// running interrupt handlers
+static struct irq_handlers handlers;
+
+void sndbench_enable(const char *arg, int ram_size) {
+  static const uint32_t masks[] = { 0x0FFFF, 0x3FFFF, 0x7FFFF, 0x1FFFFF };
+
+  bench_enabled = 1;
+  if(arg) bench_start = atof(arg);
+  ram_mask = masks[ram_size & 3];
+}
+
+static int sound_slot(uint32_t addr, int *buffer) {
+  for(*buffer=0;*buffer<2;(*buffer)++) {
+    uint32_t base = ((*buffer)?SOUND_ALT:SOUND_MAIN) & ram_mask;
+    if(addr >= base && addr < base + SOUND_SLOTS)
+      return addr - base;
+  }
+  return -1;
+}
+
+static void ram_access(uint32_t addr, int we, int ds) {
+  int buffer, slot = sound_slot(addr, &buffer);
+  if(slot < 0) return;
+
+  // the sample is in the upper byte
+  if(we) {
+    if((ds & 2) && slot_writes[buffer][slot] < 255)
+      slot_writes[buffer][slot]++;
+    return;
+  }
+
+  // everything else is a sound fetch, the CPU doesn't read the buffer
+  int w = slot_writes[buffer][slot];
+  slot_writes[buffer][slot] = 0;
+  if(w) frame_fresh++;
+
+  if(bench_running) {
+    fetches++;
+    if(w == 0) repeated++;
+    if(w > 1)  dropped += w-1;
+  }
+}
+
+static void frame_end(double time) {
+  if(!bench_running) {
+    // wait until the replay runs or the given start time
+    if(frame_fresh == SOUND_SLOTS) frames_fresh_in_row++;
+    else                           frames_fresh_in_row = 0;
+    frame_fresh = 0;
+
+    if((bench_start < 0 && frames_fresh_in_row >= BENCH_START_FRAMES) ||
+       (bench_start >= 0 && time >= bench_start)) {
+      printf("%.3fms Sound bench: starting measurement\n", time*1000);
+      bench_running = 1;
+      first_frame = last_frame = time;
+      busy_frame = 0;
+    }
+    return;
+  }
+  frame_fresh = 0;
+
+  double load = busy_frame / (time - last_frame);
+  if(load < load_min) load_min = load;
+  if(load > load_max) load_max = load;
+  busy_total += busy_frame;
+  busy_frame = 0;
+  last_frame = time;
+  frames++;
+}
+
+// to be called once per clock
+void sndbench_tick(Vnanomac_tb *tb, double time) {
+  static int ram_cycle_selected = 0;
+  static int last_vs_n = 1;
+  static int last_as_n = 1;
+
+  if(!bench_enabled) return;
+
+  // ram accesses are evaluated like the sram model in nanomac_tb.cpp does
+  if(tb->phase == 2)
+    ram_cycle_selected = tb->sdram_oe || tb->sdram_we;
+  if(tb->phase == 6 && ram_cycle_selected)
+    ram_access(tb->ram_addr, tb->sdram_we, tb->sdram_ds);
+
+  // handlers run from their acknowledge cycle until their RTE
+  if(last_as_n && !tb->cpu_as_n) {
+    if(tb->cpu_fc == FC_IACK && bench_running) irqs++;
+
+    struct irq_handler done;
+    if(irqh_bus_cycle(&handlers, tb->cpu_fc, tb->cpu_rw, tb->cpu_addr << 1, time, 0, &done) &&
+       !done.depth && bench_running)
+      busy_frame += time - done.acked;
+  }
+  last_as_n = tb->cpu_as_n;
+
+  // rising vsync edge ends a frame
+  if(tb->vs_n && !last_vs_n) frame_end(time);
+  last_vs_n = tb->vs_n;
+}
+
+// returns 1 if samples have been repeated or dropped
+int sndbench_report(void) {
+  if(!bench_enabled) return 0;
+
+  if(!frames) {
+    printf("Sound bench: no frames measured, sound buffer wasn't being written\n");
+    return 1;
+  }
+
+  double duration = last_frame - first_frame;
+  double load = busy_total / duration;
+  printf("Sound bench: %u frames (%.3fs) measured from %.3fms\n", frames, duration, first_frame*1000);
+  printf("Sound bench: %u interrupts, %.3fms handler time per frame (%.0f CPU cycles)\n", irqs,
+	 1000*busy_total/frames, CPU_CLOCK*busy_total/frames);
+  if(handlers.no_frame)
+    printf("Sound bench: %u handlers without exception frame, not timed\n", handlers.no_frame);
+  printf("Sound bench: CPU load %.1f%% (min %.1f%%, max %.1f%%), %.1f%% free\n",
+	 100*load, 100*load_min, 100*load_max, 100*(1-load));
+  printf("Sound bench: %llu sound fetches (%.1f per frame), %llu repeated, %llu dropped samples\n",
+	 (unsigned long long)fetches, (double)fetches/frames,
+	 (unsigned long long)repeated, (unsigned long long)dropped);
+
+  return (repeated || dropped)?1:0;
+}
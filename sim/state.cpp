@@ -0,0 +1,234 @@
+/*
+  state.cpp
+
+  Periodic state hashes to check that a change of build flags, of the
+  simulation or of the RTL doesn't change the behaviour of the Mac.
+  The simulated time is split into intervals (default 10ms). At the
+  end of each interval four hashes are taken:
+
+  - ram      the whole RAM as seen by the CPU, the same for all memory
+             simulation modes
+  - frame    the last completed video frame
+  - audio    the audio samples of this interval
+  - cpu bus  address, function code, direction and data of all CPU bus
+             cycles of this interval
+
+  --state-record=FILE[:SECONDS] writes them into a timeline file,
+  --state-compare=FILE compares them against such a file while the
+  simulation runs and --state-diff=FILE1,FILE2 compares two recorded
+  files without running the simulation. Each reports the first
+  interval in which each of the parts diverges. Since the hybrid
+  simulation orders bus cycles differently, only ram, frame and audio
+  can be compared against a run with the fx68k.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstdint>
+#include <vector>
+
+#include "Vnanomac_tb.h"
+#include "frame.h"
+#include "sim.h"
+
+#define PARTS  4
+#define RAM    0
+#define FRAME  1
+#define AUDIO  2
+#define CPU    3
+
+static const char *part_name[PARTS] = { "ram", "frame", "audio", "cpu bus" };
+
+struct state_entry {
+  uint32_t interval;
+  double time;
+  uint64_t hash[PARTS];
+};
+
+static int enabled = 0;
+static double interval_len = 0.01;
+static uint32_t ram_words;
+
+static FILE *record_fd = NULL;
+static std::vector<struct state_entry> reference;
+static long diverged[PARTS] = { -1, -1, -1, -1 };
+static uint32_t checked;
+
+// current interval
+static uint32_t interval = 0;
+static uint64_t audio_hash = FNV_OFFSET, cpu_hash = FNV_OFFSET;
+
+extern uint16_t mem_read16(uint32_t addr);
+
+static inline uint64_t hash_word(uint64_t hash, uint64_t w) {
+  return (hash ^ w) * 0x100000001b3ull;
+}
+
+static void state_enable(int ram_size) {
+  static const uint32_t sizes[] = { 128*1024, 512*1024, 1024*1024, 4096*1024 };
+  enabled = 1;
+  ram_words = sizes[ram_size & 3] / 2;
+}
+
+static int state_load(const char *name, std::vector<struct state_entry> &v, double *len) {
+  FILE *fd = fopen(name, "r");
+  if(!fd) { perror(name); return -1; }
+
+  char line[256];
+  while(fgets(line, sizeof(line), fd)) {
+    struct state_entry e;
+    unsigned long long h[PARTS];
+
+    if(line[0] == '#') {
+      sscanf(line, "# state interval %lf", len);
+      continue;
+    }
+    if(sscanf(line, "%u %lf %llx %llx %llx %llx", &e.interval, &e.time,
+	      &h[0], &h[1], &h[2], &h[3]) != 2+PARTS) continue;
+    for(int p=0;p<PARTS;p++) e.hash[p] = h[p];
+    v.push_back(e);
+  }
+  fclose(fd);
+  return 0;
+}
+
+void state_record(const char *spec, int ram_size) {
+  char name[256];
+  strncpy(name, spec, sizeof(name)-1);
+  name[sizeof(name)-1] = 0;
+
+  char *colon = strrchr(name, ':');
+  if(colon) {
+    *colon = 0;
+    interval_len = atof(colon+1);
+    if(interval_len <= 0) { printf("Invalid state interval '%s'\n", colon+1); exit(-1); }
+  }
+
+  record_fd = fopen(name, "w");
+  if(!record_fd) { perror(name); exit(-1); }
+  fprintf(record_fd, "# state interval %.6f\n", interval_len);
+  fprintf(record_fd, "# interval time ram frame audio cpu\n");
+  state_enable(ram_size);
+}
+
+void state_compare(const char *name, int ram_size) {
+  if(state_load(name, reference, &interval_len)) exit(-1);
+  printf("State: loaded %zu intervals of %.3fms from %s\n", reference.size(), 1000*interval_len, name);
+  state_enable(ram_size);
+}
+
+void state_audio_sample(int16_t sample) {
+  if(enabled) audio_hash = hash_word(audio_hash, (uint16_t)sample);
+}
+
+static void interval_end(double time, const struct frame *f) {
+  struct state_entry e;
+  e.interval = interval;
+  e.time = time;
+
+  uint64_t ram_hash = FNV_OFFSET;
+  for(uint32_t a=0;a<ram_words;a++) ram_hash = hash_word(ram_hash, mem_read16(2*a));
+
+  e.hash[RAM] = ram_hash;
+  e.hash[FRAME] = f->hash;
+  e.hash[AUDIO] = audio_hash;
+  e.hash[CPU] = cpu_hash;
+
+  if(record_fd)
+    fprintf(record_fd, "%u %.6f %016llx %016llx %016llx %016llx\n", e.interval, e.time,
+	    (unsigned long long)e.hash[RAM], (unsigned long long)e.hash[FRAME],
+	    (unsigned long long)e.hash[AUDIO], (unsigned long long)e.hash[CPU]);
+
+  if(interval < reference.size()) {
+    checked++;
+    for(int p=0;p<PARTS;p++) {
+      if(diverged[p] < 0 && e.hash[p] != reference[interval].hash[p]) {
+	diverged[p] = interval;
+	printf("%.3fms State: %s diverges from reference in interval %u\n", time*1000, part_name[p], interval);
+      }
+    }
+  }
+
+  audio_hash = cpu_hash = FNV_OFFSET;
+  interval++;
+}
+
+// to be called once per clock
+void state_tick(struct sim *s) {
+  if(!enabled) return;
+
+  Vnanomac_tb *tb = s->tb;
+
+  // the last state of a bus cycle is hashed once it ends
+  if(!tb->cpu_as_n)
+    s->state_cycle = ((uint64_t)tb->cpu_addr << 24) | (tb->cpu_fc << 20) | (tb->cpu_rw << 16) |
+      (tb->cpu_rw?tb->cpu_din:tb->cpu_dout);
+  else if(!s->state_last_as_n)
+    cpu_hash = hash_word(cpu_hash, s->state_cycle);
+  s->state_last_as_n = tb->cpu_as_n;
+
+  if(s->time >= (interval+1) * interval_len)
+    interval_end(s->time, &s->frame);
+}
+
+// returns 1 if the comparison failed
+int state_report(void) {
+  if(!enabled) return 0;
+
+  if(record_fd) {
+    fclose(record_fd);
+    record_fd = NULL;
+  }
+
+  if(reference.empty()) return 0;
+
+  int failed = 0;
+  for(int p=0;p<PARTS;p++) {
+    if(diverged[p] >= 0) {
+      printf("State: %s FAILED, first divergence in interval %ld\n", part_name[p], diverged[p]);
+      failed = 1;
+    }
+  }
+  if(!failed) printf("State: ok, %u intervals compared\n", checked);
+  return failed;
+}
+
+// compare two recorded files, returns 1 if they differ
+int state_diff(const char *spec) {
+  char name[256];
+  strncpy(name, spec, sizeof(name)-1);
+  name[sizeof(name)-1] = 0;
+
+  char *comma = strchr(name, ',');
+  if(!comma) { printf("Expecting --state-diff=FILE1,FILE2\n"); return -1; }
+  *comma = 0;
+
+  std::vector<struct state_entry> a, b;
+  double len_a = 0, len_b = 0;
+  if(state_load(name, a, &len_a) || state_load(comma+1, b, &len_b)) return -1;
+
+  if(len_a != len_b) {
+    printf("State diff: intervals differ, %.3fms and %.3fms\n", 1000*len_a, 1000*len_b);
+    return -1;
+  }
+
+  size_t n = (a.size() < b.size())?a.size():b.size();
+  int differ = 0;
+  for(int p=0;p<PARTS;p++) {
+    size_t i;
+    for(i=0;i<n && a[i].hash[p] == b[i].hash[p];i++);
+
+    if(i < n) {
+      printf("State diff: %s first differs in interval %u (%.3fms)\n", part_name[p], a[i].interval, 1000*a[i].time);
+      differ = 1;
+    } else
+      printf("State diff: %s identical\n", part_name[p]);
+  }
+
+  printf("State diff: %zu intervals of %.3fms compared\n", n, 1000*len_a);
+  if(a.size() != b.size())
+    printf("State diff: %s has %zu intervals, %s has %zu\n", name, a.size(), comma+1, b.size());
+
+  return differ;
+}
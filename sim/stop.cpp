@@ -0,0 +1,230 @@
+/*
+  stop.cpp
+
+  Stop conditions for unattended simulation runs. Any number of
+  conditions can be given as --stop=KIND:ARG[:RESULT]. The run ends as
+  soon as one of them triggers and the simulation exits with a status
+  telling batch runners why it ended:
+
+    hash:HASH         a frame with the given hash has been displayed
+    frame:N           frame number N has been completed
+    target:PBM[:TOL]  a frame matches the image, see --golden-target
+    uart:TEXT         the serial output contains TEXT
+    leds:PATTERN      the LEDs show PATTERN (e.g. "*----" or 0x10)
+    mem:ADDR=VALUE    the 16 bit word at ADDR contains VALUE
+    static:N          the screen didn't change for N frames (hang)
+    time:SECONDS      simulated time budget exhausted (timeout)
+    wall:SECONDS      wall clock budget exhausted (timeout)
+
+  RESULT may be "ok" or "fail" to override the default result of a
+  condition. E.g. --stop=uart:FAILED:fail ends a diagnostic run with
+  an error as soon as the text FAILED is being printed. If a goal was
+  given but the run ends without any condition triggering, the status
+  is EXIT_NOGOAL.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cstdint>
+#include <vector>
+#include <string>
+
+#include "frame.h"
+#include "stop.h"
+
+extern uint16_t mem_read16(uint32_t addr);
+extern void golden_target(const char *spec);
+
+enum { COND_HASH, COND_UART, COND_LEDS, COND_MEM, COND_STATIC, COND_TIME, COND_WALL, COND_FRAME, COND_TARGET };
+
+static const char *cond_names[] = { "hash", "uart", "leds", "mem", "static", "time", "wall", "frame", "target" };
+static const int cond_default_status[] = { EXIT_GOAL, EXIT_GOAL, EXIT_GOAL, EXIT_GOAL,
+					   EXIT_HANG, EXIT_TIMEOUT, EXIT_WALLTIME, EXIT_GOAL, EXIT_GOAL };
+
+struct stop_cond {
+  int kind;
+  int status;             // exit status if triggered
+  std::string text;       // uart pattern
+  uint64_t value;         // hash, led pattern, sim time in ns, wall time in ms, frames
+  uint32_t addr;          // memory address
+  const char *spec;
+};
+
+static std::vector<stop_cond> conds;
+
+static int stopped = 0;
+static int stop_status_code = EXIT_OK;
+static double stop_time = 0;
+static std::string stop_reason;
+
+static std::string uart_history;          // tail of the uart output
+static size_t uart_history_max = 0;       // longest uart pattern
+
+static uint64_t static_last_hash = 0;
+static uint32_t static_frames = 0;
+
+static uint64_t wall_start;
+
+static uint64_t wall_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int parse_leds(const char *s) {
+  // "*----" style as printed by the testbench
+  if(strlen(s) == 5 && strspn(s, "*-") == 5) {
+    int v = 0;
+    for(int i=0;i<5;i++) if(s[i] == '*') v |= 0x10 >> i;
+    return v;
+  }
+  return strtol(s, NULL, 0);
+}
+
+void stop_add(const char *spec) {
+  stop_cond c;
+  char *str = strdup(spec);
+  char *arg = strchr(str, ':');
+  if(!arg) { printf("Stop condition '%s' needs an argument\n", spec); exit(-1); }
+  *arg++ = 0;
+
+  c.kind = -1;
+  for(unsigned i=0;i<sizeof(cond_names)/sizeof(cond_names[0]);i++)
+    if(!strcmp(str, cond_names[i])) c.kind = i;
+  if(c.kind < 0) { printf("Unknown stop condition '%s'\n", str); exit(-1); }
+  c.status = cond_default_status[c.kind];
+  c.spec = spec;
+  c.value = 0;
+  c.addr = 0;
+
+  // optional result override at the end
+  char *res = strrchr(arg, ':');
+  if(res && (!strcmp(res, ":ok") || !strcmp(res, ":fail"))) {
+    c.status = strcmp(res, ":ok")?EXIT_FAIL:EXIT_GOAL;
+    *res = 0;
+  }
+
+  switch(c.kind) {
+  case COND_HASH:   c.value = strtoull(arg, NULL, 16); break;
+  case COND_UART:
+    c.text = arg;
+    if(c.text.size() > uart_history_max) uart_history_max = c.text.size();
+    break;
+  case COND_LEDS:   c.value = parse_leds(arg); break;
+  case COND_MEM: {
+    char *eq = strchr(arg, '=');
+    if(!eq) { printf("Expecting mem:ADDR=VALUE\n"); exit(-1); }
+    c.addr = strtoul(arg, NULL, 0) & ~1;
+    c.value = strtoul(eq+1, NULL, 0) & 0xffff;
+  } break;
+  case COND_STATIC: c.value = strtoul(arg, NULL, 0); break;
+  case COND_TIME:   c.value = (uint64_t)(atof(arg) * 1e9); break;
+  case COND_WALL:   c.value = (uint64_t)(atof(arg) * 1e3); break;
+  case COND_FRAME:  c.value = strtoul(arg, NULL, 0); break;
+  case COND_TARGET: golden_target(arg); break;
+  }
+
+  conds.push_back(c);
+  wall_start = wall_ms();
+}
+
+void sim_stop(int status, double time, const char *reason) {
+  if(stopped) return;
+
+  stopped = 1;
+  stop_status_code = status;
+  stop_time = time;
+  stop_reason = reason;
+  printf("%.3fms Stopping: %s\n", time*1000, reason);
+}
+
+int sim_stopped(void) {
+  return stopped;
+}
+
+static void trigger(const stop_cond &c, double time) {
+  char reason[256];
+  snprintf(reason, sizeof(reason), "condition '%s' met", c.spec);
+  sim_stop(c.status, time, reason);
+}
+
+void stop_frame(const struct frame *f) {
+  if(conds.empty()) return;
+
+  if(f->hash == static_last_hash) static_frames++;
+  else                            static_frames = 0;
+  static_last_hash = f->hash;
+
+  for(auto &c : conds) {
+    switch(c.kind) {
+    case COND_HASH:
+      if(f->hash == c.value) trigger(c, f->time);
+      break;
+    case COND_MEM:
+      if(mem_read16(c.addr) == c.value) trigger(c, f->time);
+      break;
+    case COND_STATIC:
+      if(static_frames >= c.value) trigger(c, f->time);
+      break;
+    case COND_FRAME:
+      if(f->number >= c.value) trigger(c, f->time);
+      break;
+    }
+  }
+}
+
+// called by the simulation when golden.cpp reports the target reached
+void stop_target(double time) {
+  for(auto &c : conds)
+    if(c.kind == COND_TARGET) {
+      trigger(c, time);
+      return;
+    }
+
+  sim_stop(EXIT_GOAL, time, "golden target reached");
+}
+
+void stop_leds(int leds, double time) {
+  for(auto &c : conds)
+    if(c.kind == COND_LEDS && (uint64_t)leds == c.value)
+      trigger(c, time);
+}
+
+void stop_uart(char chr, double time) {
+  if(!uart_history_max) return;
+
+  uart_history += chr;
+  if(uart_history.size() > uart_history_max)
+    uart_history.erase(0, uart_history.size() - uart_history_max);
+
+  for(auto &c : conds)
+    if(c.kind == COND_UART && uart_history.size() >= c.text.size() &&
+       !uart_history.compare(uart_history.size() - c.text.size(), c.text.size(), c.text))
+      trigger(c, time);
+}
+
+// check the time budgets. This is cheap enough to be called every few
+// thousand ticks
+void stop_budget(double time) {
+  for(auto &c : conds) {
+    if(c.kind == COND_TIME && time*1e9 >= c.value)
+      trigger(c, time);
+    if(c.kind == COND_WALL && wall_ms() - wall_start >= c.value)
+      trigger(c, time);
+  }
+}
+
+// a run that ends for any other reason, e.g. at TRACEEND or by closing
+// the window, didn't reach its goal if one was given
+int stop_status(void) {
+  if(!stopped)
+    for(auto &c : conds)
+      if(c.status == EXIT_GOAL) {
+	printf("Stopping: ended without reaching the goal '%s'\n", c.spec);
+	return EXIT_NOGOAL;
+      }
+
+  return stop_status_code;
+}
@@ -0,0 +1,31 @@
+/*
+  stop.h
+
+  Stop conditions and exit status of the simulation.
+*/
+
+#ifndef STOP_H
+#define STOP_H
+
+struct frame;
+
+// exit status of the simulation as seen by batch runners
+#define EXIT_OK        0   // simulation ran until its end
+#define EXIT_GOAL      0   // a goal condition was met
+#define EXIT_FAIL      1   // a check failed or a failure condition was met
+#define EXIT_TIMEOUT   2   // simulated time budget exhausted
+#define EXIT_WALLTIME  3   // wall clock budget exhausted
+#define EXIT_HANG      4   // screen didn't change anymore
+#define EXIT_NOGOAL    5   // ended otherwise although a goal condition was given
+
+extern void stop_add(const char *spec);
+extern void sim_stop(int status, double time, const char *reason);
+extern int sim_stopped(void);
+extern void stop_frame(const struct frame *f);
+extern void stop_target(double time);
+extern void stop_leds(int leds, double time);
+extern void stop_uart(char chr, double time);
+extern void stop_budget(double time);
+extern int stop_status(void);
+
+#endif // STOP_H
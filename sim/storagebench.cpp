@@ -0,0 +1,172 @@
+/*
+  storagebench.cpp
+
+  Latency of the storage as seen by the Mac. Enabled with
+  --storage-bench it watches the sector requests of the four drives
+  (two floppies, two SCSI disks) at the sd_rw interface of macplus in
+  nanomac_tb.v. A request lasts from the rising edge of sdc_rd/sdc_wr
+  of a drive until sd_rw isn't busy anymore. If several drives request
+  sectors at the same time, they are served in the order they asked.
+
+  Per drive and direction a histogram of the latencies in simulated
+  microseconds is reported, together with the time requests had to
+  wait for another drive and the share of the SD command, card busy
+  and data transfer phases of sd_rw. The queue depth is the number of
+  drives with a request pending, idle periods are the times without
+  any.
+*/
+
+#include <stdio.h>
+#include <cstdint>
+
+#include "Vnanomac_tb.h"
+#include "histogram.h"
+
+#define DRIVES    4
+
+// sd_rw states, see src/misc/sd_rw.v
+#define CMD17     11
+#define READING   12
+#define CMD24     13
+#define WRITING   14
+
+#define RDATA      1
+#define RCRC       2
+#define RTAIL      3
+#define WDATA      6
+#define WCRC       7
+
+#define PHASE_CMD   0
+#define PHASE_BUSY  1
+#define PHASE_DATA  2
+
+static const char *drive_name[DRIVES] = { "floppy 1", "floppy 2", "SCSI 0", "SCSI 1" };
+static const char *phase_name[] = { "command", "card busy", "data" };
+
+static struct drive {
+  double req;                 // time of the pending request or -1
+  double start;               // time the sd card started serving it or -1
+  int write;
+  struct histogram latency[2];
+  double waited[2];
+  double phase[3];
+} drives[DRIVES];
+
+static int bench_enabled = 0;
+static int active = -1;       // drive being served
+static double last_time;
+static double depth_time[DRIVES+1];
+static int max_depth;
+static double idle_start = 0;
+static struct histogram idle;
+
+void storagebench_enable(void) {
+  bench_enabled = 1;
+  for(int d=0;d<DRIVES;d++) drives[d].req = drives[d].start = -1;
+}
+
+static int phase_of(int cmd, int dat) {
+  if(cmd == CMD17 || cmd == CMD24) return PHASE_CMD;
+  if(dat == RDATA || dat == RCRC || dat == RTAIL || dat == WDATA || dat == WCRC) return PHASE_DATA;
+  return PHASE_BUSY;
+}
+
+// to be called once per clock
+void storagebench_tick(Vnanomac_tb *tb, double time) {
+  static int last_req = 0, last_busy = 0;
+
+  if(!bench_enabled) return;
+
+  double dt = time - last_time;
+  last_time = time;
+
+  // queue depth and idle time since the last clock
+  int depth = 0;
+  for(int d=0;d<DRIVES;d++) if(drives[d].req >= 0) depth++;
+  depth_time[depth] += dt;
+
+  // new requests
+  int req = (tb->sdc_req_rd | tb->sdc_req_wr) & 15;
+  for(int d=0;d<DRIVES;d++) {
+    if((req & ~last_req & (1<<d)) && drives[d].req < 0) {
+      drives[d].req = time;
+      drives[d].write = (tb->sdc_req_wr >> d) & 1;
+    }
+  }
+  last_req = req;
+
+  // the sd card starts serving the oldest request
+  if(tb->sdc_req_busy && !last_busy) {
+    for(int d=0;d<DRIVES;d++)
+      if(drives[d].req >= 0 && drives[d].start < 0 &&
+	 (active < 0 || drives[d].req < drives[active].req))
+	active = d;
+
+    if(active >= 0) drives[active].start = time;
+  }
+
+  if(tb->sdc_req_busy && active >= 0)
+    drives[active].phase[phase_of(tb->sdc_cmd_state, tb->sdc_dat_state)] += dt;
+
+  if(!tb->sdc_req_busy && last_busy && active >= 0) {
+    struct drive *d = &drives[active];
+    hist_add(&d->latency[d->write], 1e6 * (time - d->req));
+    d->waited[d->write] += 1e6 * (d->start - d->req);
+    d->req = d->start = -1;
+    active = -1;
+  }
+  last_busy = tb->sdc_req_busy;
+
+  // idle periods between requests
+  int new_depth = 0;
+  for(int d=0;d<DRIVES;d++) if(drives[d].req >= 0) new_depth++;
+  if(new_depth > max_depth) max_depth = new_depth;
+  if(!depth && new_depth) hist_add(&idle, 1e6 * (time - idle_start));
+  if(depth && !new_depth) idle_start = time;
+}
+
+void storagebench_report(double time) {
+  if(!bench_enabled) return;
+
+  uint32_t requests = 0;
+  for(int d=0;d<DRIVES;d++) {
+    struct drive *dr = &drives[d];
+    if(!dr->latency[0].count && !dr->latency[1].count) continue;
+
+    for(int w=0;w<2;w++) {
+      const struct histogram *h = &dr->latency[w];
+      if(!h->count) continue;
+      requests += h->count;
+
+      printf("Storage bench: %s, %u sector %s, latency avg %.1fus, min %.1fus, max %.1fus, waited for other drives %.1fus avg\n",
+	     drive_name[d], h->count, w?"writes":"reads", h->total / h->count, h->min, h->max,
+	     dr->waited[w] / h->count);
+      hist_print(h);
+    }
+
+    double total = dr->phase[PHASE_CMD] + dr->phase[PHASE_BUSY] + dr->phase[PHASE_DATA];
+    if(total > 0) {
+      printf("Storage bench: %s,", drive_name[d]);
+      for(int p=0;p<3;p++)
+	printf(" %s %.3fms (%.1f%%)%s", phase_name[p], 1000 * dr->phase[p],
+	       100 * dr->phase[p] / total, (p < 2)?",":"\n");
+    }
+  }
+
+  if(!requests) {
+    printf("Storage bench: no sector requests\n");
+    return;
+  }
+
+  double busy = 0, weighted = 0;
+  for(int n=1;n<=DRIVES;n++) {
+    busy += depth_time[n];
+    weighted += n * depth_time[n];
+  }
+
+  printf("Storage bench: queue depth %.2f avg while requests are pending, max %d\n",
+	 (busy > 0)?weighted / busy:0, max_depth);
+  printf("Storage bench: idle %.1f%% of %.3fms, %u idle periods, avg %.1fus, max %.1fus\n",
+	 (time > 0)?100 * depth_time[0] / time:0, 1000 * time, idle.count,
+	 idle.count?idle.total / idle.count:0, idle.max);
+}
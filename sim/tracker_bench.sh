@@ -0,0 +1,53 @@
+#!/bin/bash
+#
+# tracker_bench.sh
+#
+# Sound benchmark of the NanoMacTracker, see "Sound benchmark" in
+# README.md. The tracker is built with AUTOPLAY, copied onto a copy of
+# a bootable system floppy and set as its startup application. The
+# simulation then boots that floppy with --sound-bench:
+#
+#   $ ./tracker_bench.sh SYSTEM_DISK [BINARY]
+#
+# SYSTEM_DISK is a raw HFS floppy image with a system on it and room
+# for the tracker, e.g. an 800k System 3.x disk. It isn't modified, the
+# result is written to tracker.dsk and tracker.wav. BINARY defaults to
+# ./nanomac_fast.
+#
+# Needs the Retro68 toolchain (RETRO68_TOOLCHAIN, see the README.md of
+# the NanoMacTracker), the MOD prepared as described there and hfsutils.
+# CACHED_MIX=ON builds the tracker with the mixer caching its parameters.
+
+SYSTEM=$1
+BIN=${2:-./nanomac_fast}
+RETRO68_TOOLCHAIN=${RETRO68_TOOLCHAIN:-/opt/Retro68/Retro68-build/toolchain/m68k-apple-macos/cmake/retro68.toolchain.cmake}
+TRACKER=../NanoMacTracker
+BUILD=build-tracker
+DISK=tracker.dsk
+APP=NanoMacTracker
+
+if [ -z "$SYSTEM" ]; then
+    echo "Usage: $0 SYSTEM_DISK [BINARY]"
+    exit 1
+fi
+
+# a bootable disk starts with the boot blocks, signature "LK"
+if [ "$(head -c 2 "$SYSTEM")" != "LK" ]; then
+    echo "$SYSTEM is not a bootable raw floppy image"
+    exit 1
+fi
+
+cmake -S $TRACKER -B $BUILD -DCMAKE_TOOLCHAIN_FILE=$RETRO68_TOOLCHAIN -DAUTOPLAY=ON -DCACHED_MIX=${CACHED_MIX:-OFF} || exit 1
+cmake --build $BUILD || exit 1
+
+cp "$SYSTEM" $DISK || exit 1
+hmount $DISK || exit 1
+hcopy -m $BUILD/$APP.bin ":$APP" || { humount; exit 1; }
+humount
+
+# The system launches the application named in the boot blocks instead
+# of the Finder. The name is a pascal string of up to 15 characters at
+# offset 26 (bbShellName).
+printf "\\x$(printf %02x ${#APP})%-15s" $APP | tr ' ' '\0' | dd of=$DISK bs=1 seek=26 count=16 conv=notrunc 2>/dev/null
+
+$BIN --mem=sram --floppy=$DISK --audio=tracker.wav --sound-bench --stop=time:40:ok
@@ -0,0 +1,222 @@
+/*
+  uart.cpp
+
+  Serial console bridge for the simulation. The uart_txd line of the
+  Mac is sampled once per clock and decoded as 8N1. Received characters
+  are printed line by line, passed to the stop conditions and can be
+  logged to a file or forwarded to a pseudo terminal.
+
+  The uart_rxd line is driven from a FIFO which is filled from a pty,
+  stdin, a file or a fixed string. Without any of them "Hello World"
+  is sent once, as the testbench always did. Bits are sent at line
+  rate using a precomputed bit time, so there's no division per tick.
+
+  Using a pty a terminal program can be attached to the simulated Mac:
+
+  $ ./nanomac --uart-pty
+  ...
+  UART: pty is /dev/pts/5
+  $ screen /dev/pts/5
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cstdint>
+#include <string>
+#include <deque>
+
+#include "stop.h"
+
+#define UART_CLOCK    16000000   // tick rate at which uart_tx()/uart_rx() are called
+#define UART_RX_START 0.05       // don't send before the Mac had a chance to init the SCC
+#define UART_RX_STOP  2          // number of stop bits sent
+
+// the input is polled every 1/16 ms simulated time while the fifo is empty
+#define UART_POLL_TICKS (UART_CLOCK/16000)
+
+// sent if no other input is given
+#define UART_DEFAULT_INPUT "Hello World"
+
+static int uart_baud = 9600;
+
+// bit time in 1/65536 clocks so the sampling point doesn't drift
+static uint64_t uart_bit_time = ((uint64_t)UART_CLOCK << 16) / 9600;
+
+static std::string uart_line;
+
+static FILE *uart_log = NULL;     // raw log of received characters
+static int uart_out_fd = -1;      // tx is forwarded here (pty)
+static int uart_in_fd = -1;       // rx is read from here (pty, stdin or file)
+static std::deque<uint8_t> uart_fifo;
+static int uart_input_given = 0;
+
+void uart_set_baud(const char *arg) {
+  char *end;
+  long baud = strtol(arg, &end, 10);
+
+  // at least a few clocks per bit
+  if(*end || baud <= 0 || baud > UART_CLOCK/4) {
+    printf("Invalid baud rate '%s'\n", arg);
+    exit(-1);
+  }
+
+  uart_baud = baud;
+  uart_bit_time = ((uint64_t)UART_CLOCK << 16) / baud;
+}
+
+void uart_set_log(const char *name) {
+  uart_log = fopen(name, "wb");
+  if(!uart_log) { perror(name); exit(-1); }
+}
+
+// create a pseudo terminal which is used for both directions
+void uart_open_pty(void) {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(fd < 0 || grantpt(fd) || unlockpt(fd)) { perror("pty"); exit(-1); }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  printf("UART: pty is %s\n", ptsname(fd));
+  uart_in_fd = uart_out_fd = fd;
+  uart_input_given = 1;
+}
+
+// input may be "stdin", "text:STRING", "none" or a file name. The
+// input is polled, as making stdin non-blocking would also affect the
+// shell after the simulation has ended
+void uart_set_input(const char *src) {
+  uart_input_given = 1;
+
+  if(!strcmp(src, "none"))
+    return;
+  else if(!strcmp(src, "stdin"))
+    uart_in_fd = dup(0);
+  else if(!strncmp(src, "text:", 5)) {
+    // allow \n and \r in strings given on the command line
+    for(const char *p = src+5; *p; p++) {
+      if(p[0] == '\\' && p[1] == 'n')      { uart_fifo.push_back('\n'); p++; }
+      else if(p[0] == '\\' && p[1] == 'r') { uart_fifo.push_back('\r'); p++; }
+      else uart_fifo.push_back(*p);
+    }
+    return;
+  } else
+    uart_in_fd = open(src, O_RDONLY);
+
+  if(uart_in_fd < 0) { perror(src); exit(-1); }
+}
+
+static void uart_char(uint8_t c, double time) {
+  stop_uart(c, time);
+
+  if(uart_log) fputc(c, uart_log);
+  if(uart_out_fd >= 0 && write(uart_out_fd, &c, 1) != 1) { /* nobody listening */ }
+
+  if(c == '\n' || c == '\r') {
+    if(!uart_line.empty()) printf("%.3fms UART: %s\n", time*1000, uart_line.c_str());
+    uart_line.clear();
+  } else
+    uart_line += (c >= 32 && c < 127)?c:'.';
+}
+
+// to be called once per clock
+void uart_tx(int txd, double time) {
+  static int last_txd = 1;
+  static int bit = -1;          // -1 = idle, 0 = start bit, 1..8 data, 9 stop
+  static uint64_t next;         // time of next sample in 1/65536 clocks
+  static uint64_t now;          // current time in 1/65536 clocks
+  static uint8_t data;
+
+  now += 1<<16;
+
+  if(bit < 0) {
+    // falling edge starts a byte, sample in the middle of the start bit
+    if(last_txd && !txd) {
+      bit = 0;
+      next = now + uart_bit_time/2;
+    }
+  } else if(now >= next) {
+    if(bit == 0) {
+      // false start bit
+      if(txd) bit = -2;
+    } else if(bit <= 8)
+      data = (data >> 1) | (txd?0x80:0);
+    else {
+      if(txd) uart_char(data, time);
+      else    printf("%.3fms UART: framing error\n", time*1000);
+      bit = -2;
+    }
+    bit++;
+    next += uart_bit_time;
+  }
+
+  last_txd = txd;
+}
+
+// to be called once per clock, returns the state of the rxd line
+int uart_rx(double time) {
+  static int rxd = 1;
+  static int bit = -1;          // -1 = idle, 0 = start bit, 1..8 data, 9.. stop
+  static uint64_t next;         // time of next bit in 1/65536 clocks
+  static uint64_t now;          // current time in 1/65536 clocks
+  static uint32_t poll_ticks = 0;
+  static uint8_t data;
+
+  now += 1<<16;
+
+  // last stop bit has been sent completely
+  if(bit > 8 + UART_RX_STOP && now >= next) bit = -1;
+
+  if(bit < 0) {
+    if(time < UART_RX_START) return rxd;
+
+    if(!uart_input_given) {
+      printf("%.3fms UART: sending \"%s\"\n", time*1000, UART_DEFAULT_INPUT);
+      for(const char *p = UART_DEFAULT_INPUT; *p; p++) uart_fifo.push_back(*p);
+      uart_input_given = 1;
+    }
+
+    // refill fifo from input
+    if(uart_fifo.empty() && uart_in_fd >= 0 && ++poll_ticks >= UART_POLL_TICKS) {
+      struct pollfd pfd = { uart_in_fd, POLLIN, 0 };
+      if(poll(&pfd, 1, 0) > 0) {
+	uint8_t buffer[64];
+	int len = read(uart_in_fd, buffer, sizeof(buffer));
+	for(int i=0;i<len;i++) uart_fifo.push_back(buffer[i]);
+      }
+      poll_ticks = 0;
+    }
+
+    if(uart_fifo.empty()) return rxd;
+
+    data = uart_fifo.front();
+    uart_fifo.pop_front();
+    bit = 0;
+    next = now;
+  }
+
+  if(now >= next && bit <= 8 + UART_RX_STOP) {
+    if(bit == 0)       rxd = 0;                     // start bit
+    else if(bit <= 8)  rxd = (data >> (bit-1)) & 1; // data bits, lsb first
+    else               rxd = 1;                     // stop bit(s)
+
+    bit++;
+    next += uart_bit_time;
+  }
+
+  return rxd;
+}
+
+void uart_close(void) {
+  if(!uart_line.empty()) printf("UART: %s\n", uart_line.c_str());
+  uart_line.clear();
+  if(uart_log) fclose(uart_log);
+  uart_log = NULL;
+
+  // the pty is used for both directions
+  if(uart_out_fd >= 0 && uart_out_fd != uart_in_fd) close(uart_out_fd);
+  if(uart_in_fd >= 0) close(uart_in_fd);
+  uart_in_fd = uart_out_fd = -1;
+}
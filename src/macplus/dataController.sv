@@ -99,6 +99,18 @@ module dataController (
 
         wire [1:0] iwm_rd, iwm_wr;
         wire [1:0] scsi_rd, scsi_wr;
+
+        // The sd card serves one request at a time. Once a source has
+        // been selected, requests of all other sources are held back
+        // until its transfer is done, so neither the data path nor the
+        // busy signal switch in the middle of a transfer. This matters
+        // as the floppy track buffer and the scsi read ahead load sectors
+        // in the background. All sources keep their requests asserted
+        // until they see busy.
+        reg  sdc_active = 1'b0; // selected source is being served
+        reg  sdc_started;       // ... and busy has been seen
+        wire [1:0] iwm_req = iwm_rd | iwm_wr;
+        wire [1:0] scsi_req = scsi_rd | scsi_wr;
    
         // lba needs to come before sdc_rd and sdc_wr. Since their
         // sources are used to mux xx_lba, they need to delayed when
@@ -109,26 +121,45 @@ module dataController (
 	   
 	   if(scsi_rd[1] || scsi_wr[1]) scsiLED_cnt[1] <= 16'hffff; 
 	   else if(scsiLED_cnt[1]) scsiLED_cnt[1] <= scsiLED_cnt[1] - 16'd1;
-	   
-	   sdc_rd <= { scsi_rd, iwm_rd };
-	   sdc_wr <= { scsi_wr, iwm_wr };
-
-	   // any iwm/floppy access disables data path to/from scsi
-	   if(|{iwm_rd,iwm_wr})   scsi_io <= 1'b0;
-	   // any scsi access enables data path to/from scsi
-	   if(|{scsi_rd,scsi_wr}) scsi_io <= 1'b1;
-
-	   // access to scsi #1 enables data path to/from scsi #1
-           if(scsi_rd[1] | scsi_wr[1]) scsi_dev <= 1'b1;	   
-	   // access to scsi #0 enables data path to/from scsi #0
-	   if(scsi_rd[0] | scsi_wr[0]) scsi_dev <= 1'b0;	   
+
+	   // only the selected source's requests are passed on
+	   sdc_rd <= !sdc_active?4'b0000:
+		     !scsi_io?{ 2'b00, iwm_rd }:
+		     scsi_dev?{ scsi_rd[1], 3'b000 }:{ 1'b0, scsi_rd[0], 2'b00 };
+	   sdc_wr <= !sdc_active?4'b0000:
+		     !scsi_io?{ 2'b00, iwm_wr }:
+		     scsi_dev?{ scsi_wr[1], 3'b000 }:{ 1'b0, scsi_wr[0], 2'b00 };
+
+	   if(!sdc_active) begin
+	      sdc_started <= 1'b0;
+
+	      // select the data path to/from scsi #0, scsi #1 or the iwm/floppy
+	      if(scsi_req[0]) begin
+		 scsi_io <= 1'b1;
+		 scsi_dev <= 1'b0;
+		 sdc_active <= 1'b1;
+	      end else if(scsi_req[1]) begin
+		 scsi_io <= 1'b1;
+		 scsi_dev <= 1'b1;
+		 sdc_active <= 1'b1;
+	      end else if(|iwm_req) begin
+		 scsi_io <= 1'b0;
+		 sdc_active <= 1'b1;
+	      end
+	   end else begin
+	      // transfer done once busy has been set and cleared again
+	      if(sdc_busy) sdc_started <= 1'b1;
+	      else if(sdc_started) sdc_active <= 1'b0;
+	   end
         end
 
-        // direct the sd busy signal to the appropriate scsi target
+        // direct the sd busy signal to the selected source
         wire [1:0] io_ack = 
+		   (!sdc_active)?2'b00:
 		   (scsi_io && !scsi_dev)?{1'b0, sdc_busy}:
 		   (scsi_io &&  scsi_dev)?{sdc_busy, 1'b0}:
 		   2'b00;
+        wire iwm_busy = sdc_active && !scsi_io && sdc_busy;
    
         wire [7:0] scsi_data_out[SCSI_DEVS];
         wire [7:0] iwm_data_out;
@@ -502,7 +533,7 @@ module dataController (
 	        .sd_lba     ( iwm_lba     ),
 	        .sd_rd      ( iwm_rd      ),
 	        .sd_wr      ( iwm_wr      ),
-	        .sd_busy    ( sdc_busy    ),
+	        .sd_busy    ( iwm_busy    ),
 	        .sd_done    ( sdc_done    ),
 	        .sd_data_in ( sdc_data_in ),
 	        .sd_data_out( iwm_data_out),
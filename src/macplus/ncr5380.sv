@@ -291,12 +291,15 @@ module ncr5380
 				.io_lba ( io_lba[i] ),
 				.io_rd  ( io_rd[i] ),
 				.io_wr  ( io_wr[i] ),
-				.io_ack ( io_ack[i] & target_bsy[i] ),
+				// the data controller routes the ack to the
+				// target whose request is served, which may
+				// be an idle one finishing its read ahead
+				.io_ack ( io_ack[i] ),
 
 				.sd_buff_addr( sd_buff_addr ),
 				.sd_buff_dout( sd_buff_dout ),
 				.sd_buff_din( sd_buff_din[i] ),
-				.sd_buff_wr( sd_buff_wr & target_bsy[i] )
+				.sd_buff_wr( sd_buff_wr & io_ack[i] )
 			);
 		end
 	endgenerate
@@ -50,15 +50,16 @@ localparam PHASE_MESSAGE_OUT = 3'd5;
 reg [2:0]  phase;
 
 // ------------ sector buffer IO controller read/write -----------------------
-// the buffer itself. Can hold two sectors
-reg sd_buff_sel;
+// the buffer itself. Can hold two sectors. The io controller always
+// uses the half sd_buff_sel points to. The first sector of a command
+// is in half buf_base. This isn't necessarily half 0 as the sector may
+// already have been read ahead at the end of the previous command
+reg sd_buff_sel = 0;
+reg buf_base = 0;
 reg old_io_ack;
 always @(posedge clk) begin
 	old_io_ack <= io_ack;
-	if (phase == PHASE_IDLE)
-		sd_buff_sel <= 0;
-	else
-		if (old_io_ack & ~io_ack) sd_buff_sel <= !sd_buff_sel;
+	if (old_io_ack & ~io_ack && !rd_dropped) sd_buff_sel <= !sd_buff_sel;
 end
    
 // ------------ sector buffer IO controller read/write -----------------------
@@ -74,7 +75,7 @@ scsi_dpram #(.ADDRWIDTH(10)) buffer
 	.wren_a(sd_buff_wr),
 	.q_a(sd_buff_din),
 
-	.address_b(data_cnt[9:0]),
+	.address_b({data_cnt[9] ^ buf_base, data_cnt[8:0]}),
 	.data_b(din),
 	.wren_b(buffer_wr),
 	.q_b(buffer_dout)
@@ -95,9 +96,13 @@ assign msg = (phase == PHASE_MESSAGE_OUT);
 assign cd = (phase == PHASE_CMD_IN) || (phase == PHASE_STATUS_OUT) || (phase == PHASE_MESSAGE_OUT);
 assign io = (phase == PHASE_DATA_OUT) || (phase == PHASE_STATUS_OUT) || (phase == PHASE_MESSAGE_OUT);
 
-wire   io_busy = (phase == PHASE_DATA_OUT && (io_rd | io_ack) && data_cnt[9] == sd_buff_sel) ||
-                 (phase == PHASE_DATA_IN  && (io_wr | io_ack) && data_cnt[9] == sd_buff_sel) ||
-                 (phase != PHASE_DATA_OUT && phase != PHASE_DATA_IN && (io_rd | io_wr | io_ack));
+// a read ahead doesn't delay the status and message phases, it keeps
+// loading in the background after the bus has been released. A read
+// that has been dropped still writes into half sd_buff_sel, so data
+// from the initiator has to wait for it
+wire   io_busy = (phase == PHASE_DATA_OUT && cmd_read && {1'b0, data_cnt[24:9]} >= rd_cnt) ||
+                 (phase == PHASE_DATA_IN  && (rd_active || ((io_wr | io_ack) && (data_cnt[9] ^ buf_base) == sd_buff_sel))) ||
+                 (phase != PHASE_DATA_OUT && phase != PHASE_DATA_IN && (io_wr || (io_ack && !rd_active)));
 assign req = (phase != PHASE_IDLE) && !ack && !io_busy;
 
 assign bsy = (phase != PHASE_IDLE);
@@ -173,31 +178,64 @@ reg [7:0]  cmd [9:0];
 
 assign io_lba = lba;
 
-// generate an io_rd signal whenever the first byte of a 512 byte block is required
-// start fetching the next sector when the 20th byte is read, and it's not the last sector
-wire req_rd = ((phase == PHASE_DATA_OUT) && cmd_read && (data_cnt == 0 || (data_cnt[8:0] == 9'd20 && data_cnt[31:9] != ({7'd0, tlen} - 1'd1))) && !data_complete);
+// Sectors of read commands are requested from the io controller as
+// soon as there's a free half in the buffer. The next sector is thus
+// being loaded while the initiator reads the current one. Once all
+// sectors of the command have been requested the sector following them
+// is read ahead. If the next command reads from there it can start
+// sending data right away, or takes over the read ahead if it's still
+// being loaded. Any other command, a bus reset or a new image drops
+// it. The io controller can't be stopped, so a dropped read is left
+// running and its completion is ignored.
+reg [16:0] rd_cnt;          // sectors loaded into the buffer for the current command
+reg        rd_active = 0;   // read request to io controller in progress
+reg        rd_drop = 0;     // ... and its result is to be ignored
+reg        ra_loading = 0;  // ... and it's the read ahead
+reg        ra_valid = 0;    // buffer half sd_buff_sel^1 contains sector ra_lba
+reg [31:0] ra_lba;
+
+wire rd_done = rd_active && old_io_ack && ~io_ack;
+wire rd_dropped = rd_active && rd_drop;
+
+`ifdef SCSI_NO_READAHEAD
+wire ra_enable = 1'b0;
+`else
+wire ra_enable = 1'b1;
+`endif
+
+wire rd_next = (rd_cnt < {1'b0, tlen}) || (rd_cnt == {1'b0, tlen} && ra_enable && lba < capacity);
+wire rd_room = rd_cnt <= {1'b0, data_cnt[24:9]} + 17'd1;
+wire req_rd = ((phase == PHASE_DATA_OUT) || (phase == PHASE_STATUS_OUT)) && cmd_read &&
+	      rd_next && rd_room && !rd_active && !io_ack && !old_io_ack;
+
+// a new read command starting where the read ahead is, or where it's
+// still being loaded
+wire [31:0] cmd_lba = cmd6_cpl?{11'd0, lba6}:lba10;
+wire ra_hit = ra_valid && cmd_read && (cmd_lba == ra_lba);
+wire ra_take = ra_loading && !rd_drop && cmd_read && (cmd_lba == lba);
+wire ra_taken = ra_take && rd_done;   // ... and it's just being completed
 
 // generate an io_wr signal whenever a 512 byte block has been received or when the status
 // phase of a write command has been reached
 wire req_wr = ((((phase == PHASE_DATA_IN) && (data_cnt[8:0] == 0) && (data_cnt != 0)) || (phase == PHASE_STATUS_OUT)) && cmd_write);
 
 always @(posedge clk) begin
-	reg old_rd, old_wr;
-	reg wr_pending, rd_pending;
+	reg old_wr;
+	reg wr_pending;
 
-	old_rd <= req_rd;
 	old_wr <= req_wr;
-	if(~old_rd & req_rd) rd_pending <= 1;
 	if(~old_wr & req_wr) wr_pending <= 1;
 
 	if(io_ack) begin
 		io_rd <= 1'b0;
 		io_wr <= 1'b0;
 	end else begin
-		if (rd_pending && !io_rd) begin
-			$display("Target %d read %d", ID, lba);
+		if (req_rd) begin
+			$display("Target %d read %d%s", ID, lba, (rd_cnt == {1'b0, tlen})?" (read ahead)":"");
 			io_rd <= 1;
-			rd_pending <= 0;
+			rd_active <= 1;
+			rd_drop <= 0;
+			ra_loading <= (rd_cnt == {1'b0, tlen});
 		end
 
 		if (wr_pending && !io_wr) begin
@@ -206,6 +244,39 @@ always @(posedge clk) begin
 			wr_pending <= 0;
 		end
 	end
+
+	// sector has been loaded
+	if (rd_done) begin
+		rd_active <= 0;
+		rd_drop <= 0;
+		ra_loading <= 0;
+		if (!rd_drop) begin
+			rd_cnt <= rd_cnt + 17'd1;
+			if (ra_loading) begin
+				ra_valid <= 1;
+				ra_lba <= lba;
+			end
+		end
+	end
+
+	// any new command either uses the read ahead or the buffer is
+	// being reused. The first sector is in the half sd_buff_sel points
+	// to when the read ahead is still being loaded. A dropped read
+	// doesn't advance sd_buff_sel, so the next sector goes there as
+	// well. A completed read ahead has advanced it
+	if (cmd_cpl && (phase == PHASE_CMD_IN)) begin
+		ra_valid <= 0;
+		ra_loading <= 0;
+		rd_cnt <= (ra_hit || ra_taken)?17'd1:17'd0;
+		buf_base <= (ra_hit || (rd_done && !rd_drop && !ra_take))?!sd_buff_sel:sd_buff_sel;
+		if (ra_loading && !ra_take && !rd_done) rd_drop <= 1;
+	end
+
+	if (rst || img_mounted) begin
+		ra_valid <= 0;
+		ra_loading <= 0;
+		if (rd_active && !rd_done) rd_drop <= 1;
+	end
 end
 
 reg  stb_ack;
@@ -315,9 +386,9 @@ reg [31:0] lba;
 reg [15:0] tlen;
 
 always @(posedge clk) begin
-	if (old_io_ack & ~io_ack) lba <= lba + 1'd1;
+	if (old_io_ack & ~io_ack && !rd_dropped) lba <= lba + 1'd1;
 	if(cmd_cpl && (phase == PHASE_CMD_IN)) begin
-		lba <= cmd6_cpl?{11'd0, lba6}:lba10;
+		lba <= ra_hit?(ra_lba + 32'd1):ra_taken?(cmd_lba + 32'd1):cmd_lba;
 		tlen <= cmd6_cpl?{7'd0, tlen6}:tlen10;
 	end
 end